@@ -1,122 +1,22 @@
 #include "plugin.hpp"
-
-#define min(a,b) ((a)<(b)?(a):(b))
-#define max(a,b) ((a)<(b)?(b):(a))
-
-// Master clock runs using floating point calculations to be as accurate as possible
-typedef float MasterClockTick;
-// subclocks (subdivisions of master) just use integer counting
-typedef uint16_t SubClockTick;
-
-
-const SubClockTick B_MULTIPLIERS[] = { 48 * 8, 48 * 6, 48 * 4, 48 * 3, 48 * 2, 48 * 1, 48 / 2, 48 / 3, 48 / 4, 48 / 6, 48 / 8 };
-const SubClockTick C_MULTIPLIERS[] = { 48 * 24, 48 * 12, 48 * 8, 48 * 4, 48 * 2, 48 * 1, 48 / 2, 48 / 4, 48 / 8, 48 / 12, 48 / 24 };
+#include "CLKCore.h"
+#include "MidiExport.h"
 
 const std::string B_STRINGS[] = { "/8", "/6", "/4", "/3", "/2", "x1", "x2", "x3", "x4", "x6", "x8" };
 const std::string C_STRINGS[] = { "/24", "/12", "/8", "/4", "/2", "x1", "x2", "x4", "x8", "x12", "x24" };
 
-class MasterClock;
-
-
-template<bool CAN_RESET_MASTER_CLOCK>
-class ClockGenerator {
-private:
-	bool state = false;
-	MasterClock* master;
-public:
-	ClockGenerator(MasterClock* master_) {
-		master = master_;
-	}
-
-	SubClockTick period = 0;
-	SubClockTick duty = 0;
-	SubClockTick pos = 0;
-	void setPeriod(SubClockTick ticks, SubClockTick maxDuty) {
-		duty = min(maxDuty, ticks / 2);
-		period = ticks - 1;
-	}
-	void resetPhase() {
-		pos = -1;
-		on();
-	}
-	void clock() {
-		if (++pos >= duty) {
-			off();
-		}
-		if (pos > period) {
-			pos = 0;
-			on();
-		}
-	}
-	void on();
-	void off() {
-		state = false;
-	}
-	bool isOn() {
-		return state;
-	}
-
-};
-
-class MasterClock {
-private:
-public:
-	bool resetB = false;
-	bool resetC = false;
-
-	ClockGenerator<true> clockA;
-	ClockGenerator<false> clockB;
-	ClockGenerator<false> clockC;
-
-	MasterClock() : clockA(this), clockB(this), clockC(this) {
-
-	}
-
-	MasterClockTick period = 0.f;
-	MasterClockTick pos = 0.f;
-
-	// clock period in seconds
-	void setPeriod(MasterClockTick period_) {
-		period = period_;
-	}
-	void clock(float sampleTime) {
-		pos += sampleTime;
-		if (pos > period) {
-			pos -= period;
-			clockA.clock();
-			clockB.clock();
-			clockC.clock();
-		}
-	}
-	void reset() {
-		if (resetB) {
-			clockB.resetPhase();
-			resetB = false;
-		}
-		if (resetC) {
-			clockC.resetPhase();
-			resetC = false;
-		}
-	}
-};
 
-template<> void ClockGenerator<false>::on() {
-	state = true;
-}
-template<> void ClockGenerator<true>::on() {
-	state = true;
-	if (master)
-		master->reset();
-}
-
-
-struct CLK : Module {
+struct CLK : Module, CacheAligned {
 	enum ParamId {
 		BPM_PARAM,
 		SCALE_8_PARAM,
 		SCALE_24_PARAM,
+		SWING_PARAM,
+		SWING_8_PARAM,
+		SWING_24_PARAM,
 		PARAMS_LEN
 	};
+	// inputs are on the CLK Expander (CLKExpander.cpp)
 	enum InputId {
 		INPUTS_LEN
 	};
@@ -132,107 +32,157 @@ struct CLK : Module {
 		CLOCK_24_LIGHT,
 		LIGHTS_LEN
 	};
-	enum TriggerMode {
-		TRIGGER_MODE,
-		GATE_MODE,
-		ORIGINAL_MODE,
-		OUTPUT_MODE_LEN
-	};
-
-	MasterClock master;
 
-	SubClockTick mulB = 5;
-	SubClockTick mulC = 5;
+	// shows the multiplier table entry or, in ratio mode, the ratio (which can be typed as n/m)
+	struct ScaleParamQuantity : ParamQuantity {
+		const std::string* strings = B_STRINGS;
 
-	int modifier8Cached = 0, modifier24Cached = 0;
-	int outputMultiplier = 0;
-	TriggerMode triggerMode = ORIGINAL_MODE;
-
-	struct Scale8ParamQuantity : ParamQuantity {
-		std::string getDisplayValueString() override {
-			int index = getValue();
-			return B_STRINGS[clamp(index, 0, 10)];
+		const CLKCore& core() {
+			return static_cast<CLK*>(module)->core;
+		}
+		bool isRatioMode() {
+			return module && core().subClockMode == CLKCore::RATIO_MODE;
 		}
-	};
-	struct Scale24ParamQuantity : ParamQuantity {
 		std::string getDisplayValueString() override {
+			if (isRatioMode()) {
+				const CLKCore::Ratio ratio = core().ratioFromParam(getValue(), 0.f);
+				return string::f("%d/%d", ratio.num, ratio.den);
+			}
 			int index = getValue();
-			return C_STRINGS[clamp(index, 0, 10)];
+			return strings[clamp(index, 0, 10)];
+		}
+		void setDisplayValueString(std::string s) override {
+			int num, den;
+			float value;
+			if (isRatioMode() && std::sscanf(s.c_str(), "%d/%d", &num, &den) == 2 && num > 0 && den > 0) {
+				setValue(CLKCore::paramFromRatio(core().nearestRatio((float) num / den)));
+			}
+			else if (isRatioMode() && std::sscanf(s.c_str(), "%f", &value) == 1 && value > 0.f) {
+				setValue(CLKCore::paramFromRatio(core().nearestRatio(value)));
+			}
+			else {
+				ParamQuantity::setDisplayValueString(s);
+			}
 		}
 	};
 	ModuleTheme theme = LIGHT_THEME;
 
+	CLKCore core;
+	LightDivider<LIGHTS_LEN> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+	// copies of the core for MIDI export, see addMidiExportMenuItem()
+	std::shared_ptr<CoreCopy<CLKCore>> coreCopy{new CoreCopy<CLKCore>};
+	// message buffers for inputs from an expander to the right
+	CLKExpanderMessage expanderMessages[2];
+
 	CLK() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configParam(BPM_PARAM, 40.f, 200.f, 120.f, "BPM");
-		configParam<Scale8ParamQuantity>(SCALE_8_PARAM, 0, 10, 5.f, "Multiplication/division");
-		configParam<Scale24ParamQuantity>(SCALE_24_PARAM, 0.f, 10.f, 5.f, "Multiplication/division");
+		configParam<ScaleParamQuantity>(SCALE_8_PARAM, 0, 10, 5.f, "Multiplication/division")->strings = B_STRINGS;
+		configParam<ScaleParamQuantity>(SCALE_24_PARAM, 0.f, 10.f, 5.f, "Multiplication/division")->strings = C_STRINGS;
+		// no panel controls, set from the context menu
+		configParam(SWING_PARAM, 50.f, 75.f, 50.f, "Main clock swing", "%");
+		configParam(SWING_8_PARAM, 50.f, 75.f, 50.f, "Clock #1 swing", "%");
+		configParam(SWING_24_PARAM, 50.f, 75.f, 50.f, "Clock #2 swing", "%");
 		configOutput(MAIN_OUTPUT, "Main clock");
 		configOutput(CLOCK_8_OUTPUT, "Multiplied/divided clock #1");
 		configOutput(CLOCK_24_OUTPUT, "Multiplied/divided clock #2");
 
+		rightExpander.producerMessage = &expanderMessages[0];
+		rightExpander.consumerMessage = &expanderMessages[1];
+
 		theme = loadDefaultTheme();
 	}
 
 	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("CLK");
 
+		edgeCapture.process(this, args);
+		coreCopy->serve(core);
+		PROFILE_PHASE("params");
 		const SubClockTick b = params[SCALE_8_PARAM].getValue();
-		if (b != mulB) {
-			mulB = b;
-			master.resetB = true;
-		}
 		const SubClockTick c = params[SCALE_24_PARAM].getValue();
-		if (c != mulC) {
-			mulC = c;
-			master.resetC = true;
+		// inputs from a CLK Expander, or none
+		Module* expander = rightExpander.module;
+		const bool expanded = expander && expander->model == modelCLKExpander;
+		const CLKExpanderMessage* message = static_cast<const CLKExpanderMessage*>(rightExpander.consumerMessage);
+		if (core.useBanks()) {
+			core.setSubClockRatios(0, core.baseRatioValue(0, params[SCALE_8_PARAM].getValue()),
+			                       message->ratioCV[0], expanded ? message->ratioChannels[0] : 0);
+			core.setSubClockRatios(1, core.baseRatioValue(1, params[SCALE_24_PARAM].getValue()),
+			                       message->ratioCV[1], expanded ? message->ratioChannels[1] : 0);
 		}
-
-		// context menu allows x1, x2, x4, x8, x16 - this applies that factor
-		const uint32_t scale = (1 << outputMultiplier);
-		// length of a tick of the master clock (which runs at x48 to make mult/division easier,
-		// and which includes above scale)
-		const float tickTime = 1. / (scale * 48. * params[BPM_PARAM].getValue() / 60.);
-
-		// master clock, running at 48x intended BPM
-		master.setPeriod(tickTime);
-		float maxDuty;
-		switch (triggerMode) {
-			case ORIGINAL_MODE:
-				maxDuty = 48 >> 1;
-				break;
-			case GATE_MODE:
-				maxDuty = INT16_MAX;
-				break;
-			case TRIGGER_MODE:
-			default:
-				maxDuty = max(1, (1e-3 / tickTime) / 48);
-				break;
+		CLKCore::Inputs in;
+		if (expanded) {
+			in = message->inputs;
+		}
+		// 50% is straight, 75% delays odd pulses by half a period
+		core.swingA = params[SWING_PARAM].getValue() / 50.f - 1.f;
+		core.swingB = params[SWING_8_PARAM].getValue() / 50.f - 1.f;
+		core.swingC = params[SWING_24_PARAM].getValue() / 50.f - 1.f;
+		PROFILE_PHASE("core");
+		core.process(params[BPM_PARAM].getValue(), b, c, args.sampleTime, in);
+
+		PROFILE_PHASE("outputs");
+		const bool a = core.master.clockA.isOn();
+		outputs[MAIN_OUTPUT].setVoltage(10.f * core.outA);
+		const int channels = core.polyChannels;
+		for (int ch = 0; ch < channels; ++ch) {
+			outputs[CLOCK_8_OUTPUT].setVoltage(10.f * core.outB[ch], ch);
+			outputs[CLOCK_24_OUTPUT].setVoltage(10.f * core.outC[ch], ch);
+		}
+		outputs[CLOCK_8_OUTPUT].setChannels(channels);
+		outputs[CLOCK_24_OUTPUT].setChannels(channels);
+
+		PROFILE_PHASE("lights");
+		lightDivider.accumulate(MAIN_LIGHT, a);
+		lightDivider.accumulate(CLOCK_8_LIGHT, core.isOnB());
+		lightDivider.accumulate(CLOCK_24_LIGHT, core.isOnC());
+		if (lightDivider.process()) {
+			lightDivider.setBrightnessSmooth(lights[MAIN_LIGHT], MAIN_LIGHT, args.sampleTime);
+			lightDivider.setBrightnessSmooth(lights[CLOCK_8_LIGHT], CLOCK_8_LIGHT, args.sampleTime);
+			lightDivider.setBrightnessSmooth(lights[CLOCK_24_LIGHT], CLOCK_24_LIGHT, args.sampleTime);
 		}
-
-		// A ticks every 48 master clock ticks
-		master.clockA.setPeriod(48, maxDuty);
-		master.clockB.setPeriod(B_MULTIPLIERS[b], maxDuty);
-		master.clockC.setPeriod(C_MULTIPLIERS[c], maxDuty);
-
-		master.clock(args.sampleTime);
-
-		outputs[MAIN_OUTPUT].setVoltage(10.f * master.clockA.isOn());
-		outputs[CLOCK_8_OUTPUT].setVoltage(10.f * master.clockB.isOn());
-		outputs[CLOCK_24_OUTPUT].setVoltage(10.f * master.clockC.isOn());
-
-		lights[MAIN_LIGHT].setBrightnessSmooth(master.clockA.isOn(), args.sampleTime);
-		lights[CLOCK_8_LIGHT].setBrightnessSmooth(master.clockB.isOn(), args.sampleTime);
-		lights[CLOCK_24_LIGHT].setBrightnessSmooth(master.clockC.isOn(), args.sampleTime);
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
 		json_t* multiplier = json_object_get(rootJ, "multiplier");
 		if (multiplier) {
-			outputMultiplier = json_integer_value(multiplier);
+			core.outputMultiplier = json_integer_value(multiplier);
 		}
 		json_t* modeJ = json_object_get(rootJ, "mode");
 		if (modeJ) {
-			triggerMode = (TriggerMode)json_integer_value(modeJ);
+			core.triggerMode = (CLKCore::TriggerMode) json_integer_value(modeJ);
+		}
+		json_t* subClockModeJ = json_object_get(rootJ, "subClockMode");
+		if (subClockModeJ) {
+			core.subClockMode = (CLKCore::SubClockMode) json_integer_value(subClockModeJ);
+		}
+		json_t* polyChannelsJ = json_object_get(rootJ, "polyChannels");
+		if (polyChannelsJ) {
+			core.polyChannels = clamp((int) json_integer_value(polyChannelsJ), 1, RatioClockBank::maxChannels);
+		}
+		json_t* polySpreadJ = json_object_get(rootJ, "polySpread");
+		if (polySpreadJ) {
+			core.polySpread = (CLKCore::PolySpread) json_integer_value(polySpreadJ);
+		}
+		json_t* externalPPQNJ = json_object_get(rootJ, "externalPPQN");
+		if (externalPPQNJ) {
+			const int ppqn = json_integer_value(externalPPQNJ);
+			// must divide the master clock's 48 ticks per beat
+			if (ppqn > 0 && 48 % ppqn == 0) {
+				core.externalPPQN = ppqn;
+			}
+		}
+		json_t* edgeModeJ = json_object_get(rootJ, "edgeMode");
+		if (edgeModeJ) {
+			core.edgeMode = (CLKCore::EdgeMode) json_integer_value(edgeModeJ);
+		}
+		json_t* oversamplingJ = json_object_get(rootJ, "oversampling");
+		if (oversamplingJ) {
+			core.oversampling = clamp((int) json_integer_value(oversamplingJ), 1, 8);
 		}
 		json_t* themeJ = json_object_get(rootJ, "theme");
 		if (themeJ) {
@@ -242,10 +192,17 @@ struct CLK : Module {
 
 	json_t* dataToJson() override {
 		json_t* rootJ = json_object();
-		json_object_set_new(rootJ, "multiplier", json_integer(outputMultiplier));
+		json_object_set_new(rootJ, "multiplier", json_integer(core.outputMultiplier));
 		json_object_set_new(rootJ, "theme", json_integer(theme));
-		json_object_set_new(rootJ, "mode", json_integer(triggerMode));
-
+		json_object_set_new(rootJ, "mode", json_integer(core.triggerMode));
+		json_object_set_new(rootJ, "subClockMode", json_integer(core.subClockMode));
+		json_object_set_new(rootJ, "polyChannels", json_integer(core.polyChannels));
+		json_object_set_new(rootJ, "polySpread", json_integer(core.polySpread));
+		json_object_set_new(rootJ, "externalPPQN", json_integer(core.externalPPQN));
+		json_object_set_new(rootJ, "edgeMode", json_integer(core.edgeMode));
+		json_object_set_new(rootJ, "oversampling", json_integer(core.oversampling));
+
+		edgeCapture.toJson(rootJ);
 		return rootJ;
 	}
 };
@@ -280,8 +237,50 @@ struct CLKWidget : RebelTechModuleWidget {
 		CLK* module = dynamic_cast<CLK*>(this->module);
 		assert(module);
 
-		menu->addChild(createIndexPtrSubmenuItem("Output multiplier",	{"x1", "x2", "x4", "x8", "x16"}, &module->outputMultiplier));
-		menu->addChild(createIndexPtrSubmenuItem("Trigger mode", {"Trigger", "Gate", "Original"}, &module->triggerMode));
+		menu->addChild(createIndexPtrSubmenuItem("Output multiplier",	{"x1", "x2", "x4", "x8", "x16"}, &module->core.outputMultiplier));
+		menu->addChild(createIndexPtrSubmenuItem("Trigger mode", {"Trigger", "Gate", "Original"}, &module->core.triggerMode));
+		menu->addChild(createIndexPtrSubmenuItem("Subclock mode", {"Multiplier table", "Ratio (n/m)"}, &module->core.subClockMode));
+
+		std::vector<std::string> channelLabels = {"Off (mono)"};
+		for (int c = 2; c <= RatioClockBank::maxChannels; ++c) {
+			channelLabels.push_back(string::f("%d", c));
+		}
+		menu->addChild(createIndexSubmenuItem("Polyphonic subclocks", channelLabels,
+			[=]() { return module->core.polyChannels - 1; },
+			[=](size_t index) { module->core.polyChannels = index + 1; }
+		));
+		menu->addChild(createIndexPtrSubmenuItem("Polyphonic ratios", {"Multiples (x1, x2, x3...)", "Divisions (/1, /2, /3...)", "Same (set by CV)"}, &module->core.polySpread));
+
+		static const std::vector<int> ppqns = {1, 2, 4, 8, 12, 24, 48};
+		std::vector<std::string> ppqnLabels;
+		for (int ppqn : ppqns) {
+			ppqnLabels.push_back(string::f("%d PPQN", ppqn));
+		}
+		menu->addChild(createIndexSubmenuItem("External clock resolution", ppqnLabels,
+			[=]() { return std::find(ppqns.begin(), ppqns.end(), module->core.externalPPQN) - ppqns.begin(); },
+			[=](size_t index) { module->core.externalPPQN = ppqns[index]; }
+		));
+
+		menu->addChild(createSubmenuItem("Swing", "", [=](Menu* menu) {
+			for (int id : {CLK::SWING_PARAM, CLK::SWING_8_PARAM, CLK::SWING_24_PARAM}) {
+				ui::Slider* slider = new ui::Slider();
+				slider->quantity = module->getParamQuantity(id);
+				slider->box.size.x = 200.f;
+				menu->addChild(slider);
+			}
+		}));
+
+		menu->addChild(new MenuSeparator());
+		menu->addChild(createMenuLabel("Audio rate (BPM CV)"));
+		menu->addChild(createIndexPtrSubmenuItem("Edges", {"Naive", "Band-limited (polyBLEP, 1 sample latency)"}, &module->core.edgeMode));
+		menu->addChild(createIndexSubmenuItem("Oversampling", {"Off", "x2", "x4", "x8"},
+			[=]() { return (size_t) std::log2(module->core.oversampling); },
+			[=](size_t index) { module->core.oversampling = 1 << index; }
+		));
+		menu->addChild(new MenuSeparator());
+		addMidiExportMenuItem(menu, module->coreCopy, "CLK", &MidiExport::render);
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
 		addThemeMenuItems(menu, &module->theme);
 	}
 
@@ -0,0 +1,981 @@
+#pragma once
+#include <inttypes.h>
+#include <algorithm>
+#include <cmath>
+#include "CacheAligned.h"
+#include "ClockTrigger.h"
+#include "Profiler.h"
+
+// Rack-independent DSP for CLK (derived from https://github.com/pingdynasty/CLK), used by
+// both the module (CLK.cpp) and the offline tools (see tools/)
+
+// Master clock runs using floating point calculations to be as accurate as possible
+typedef float MasterClockTick;
+// subclocks (subdivisions of master) just use integer counting
+typedef uint16_t SubClockTick;
+
+
+const SubClockTick B_MULTIPLIERS[] = { 48 * 8, 48 * 6, 48 * 4, 48 * 3, 48 * 2, 48 * 1, 48 / 2, 48 / 3, 48 / 4, 48 / 6, 48 / 8 };
+const SubClockTick C_MULTIPLIERS[] = { 48 * 24, 48 * 12, 48 * 8, 48 * 4, 48 * 2, 48 * 1, 48 / 2, 48 / 4, 48 / 8, 48 / 12, 48 / 24 };
+
+class MasterClock;
+
+
+template<bool CAN_RESET_MASTER_CLOCK>
+class ClockGenerator {
+private:
+	bool state = false;
+	MasterClock* master;
+public:
+	ClockGenerator(MasterClock* master_) {
+		master = master_;
+	}
+
+	SubClockTick period = 0;
+	SubClockTick duty = 0;
+	SubClockTick pos = 0;
+	// swing: odd pulses are late by this many ticks (even periods are that much longer and odd
+	// ones that much shorter, so pairs of pulses stay on the grid)
+	SubClockTick swing = 0;
+	bool odd = false;	// the current period started with an odd pulse
+	// swingAmount is the delay of odd pulses as a fraction of the period (0 - 0.5), rounded to ticks
+	void setPeriod(SubClockTick ticks, SubClockTick maxDuty, float swingAmount = 0.f) {
+		swing = (swingAmount > 0.f) ? std::lround(std::min(swingAmount, 0.5f) * ticks) : 0;
+		duty = std::min<int>(maxDuty, (ticks - swing) / 2);
+		period = ticks - 1;
+	}
+	void resetPhase() {
+		pos = -1;
+		odd = false;
+		on();
+	}
+	// goes high now and counts this as the first tick of the period
+	void restart() {
+		pos = 0;
+		odd = false;
+		on();
+	}
+	void clock() {
+		if (++pos >= duty) {
+			off();
+		}
+		if (pos > (odd ? period - swing : period + swing)) {
+			pos = 0;
+			odd = !odd;
+			on();
+		}
+	}
+	void on();
+	void off() {
+		state = false;
+	}
+	bool isOn() const {
+		return state;
+	}
+
+};
+
+class MasterClock {
+private:
+public:
+	bool resetB = false;
+	bool resetC = false;
+
+	ClockGenerator<true> clockA;
+	ClockGenerator<false> clockB;
+	ClockGenerator<false> clockC;
+
+	MasterClock() : clockA(this), clockB(this), clockC(this) {
+
+	}
+
+	MasterClockTick period = 0.f;
+	MasterClockTick pos = 0.f;
+
+	// clock period in seconds
+	void setPeriod(MasterClockTick period_) {
+		period = period_;
+	}
+	// returns true if the master clock ticked
+	bool clock(float sampleTime) {
+		pos += sampleTime;
+		if (pos > period) {
+			pos -= period;
+			tick();
+			return true;
+		}
+		return false;
+	}
+	void tick() {
+		clockA.clock();
+		clockB.clock();
+		clockC.clock();
+	}
+	void reset() {
+		if (resetB) {
+			clockB.resetPhase();
+			resetB = false;
+		}
+		if (resetC) {
+			clockC.resetPhase();
+			resetC = false;
+		}
+	}
+};
+
+template<> inline void ClockGenerator<false>::on() {
+	state = true;
+}
+template<> inline void ClockGenerator<true>::on() {
+	state = true;
+	// subclocks are only reset on the beat, not on a swung (odd) pulse
+	if (master && !odd)
+		master->reset();
+}
+
+
+
+// A bank of up to 16 subclocks, each running at num/den times the main clock (num pulses every
+// den beats), used for the ratio mode and for polyphonic outputs. Each phase is an exact integer
+// accumulator in the master clock's tick domain (num units per tick, one output period is
+// 48 * den units), so patterns realign with the main clock every den beats without drift.
+// Edges that fall between ticks are placed using the master clock's fractional position,
+// which isn't accumulated. Swing delays odd pulses by whole ticks, as for ClockGenerator, and
+// the pulse on a realigning beat is even. State is kept as a structure of arrays, so that all channels are
+// advanced in one (vectorisable) pass.
+class RatioClockBank {
+public:
+	static const int maxChannels = 16;
+	int channels = 1;
+
+	int32_t num[maxChannels];
+	int32_t den[maxChannels];
+	int32_t period[maxChannels];	// 48 * den
+	int32_t acc[maxChannels];		// phase at the last tick
+	int32_t swing[maxChannels];		// delay of odd pulses, in phase units (a multiple of num)
+	int32_t odd[maxChannels];		// 1 if the current period started with an odd pulse
+	float duty[maxChannels];		// gate length, in phase units
+	float state[maxChannels];		// 0 or 1
+	uint16_t beats[maxChannels];	// main clock beats since the pattern was aligned
+	bool realign[maxChannels];		// restart the pattern on the next beat
+	float swingAmount = 0.f;		// see setSwing()
+
+	RatioClockBank() {
+		for (int c = 0; c < maxChannels; ++c) {
+			num[c] = den[c] = 1;
+			period[c] = 48;
+			acc[c] = 0;
+			swing[c] = odd[c] = 0;
+			duty[c] = 0.f;
+		}
+		reset();
+	}
+
+	void setChannels(int channels_) {
+		// channels that weren't running start with the next beat
+		for (int c = channels; c < channels_; ++c) {
+			state[c] = 0.f;
+			realign[c] = true;
+		}
+		channels = channels_;
+	}
+	void setRatio(int c, uint16_t num_, uint16_t den_) {
+		if (num_ == num[c] && den_ == den[c]) {
+			return;
+		}
+		// keep the position within the current period, the pattern is realigned on the next beat
+		acc[c] = (int64_t) acc[c] * den_ / den[c];
+		num[c] = num_;
+		den[c] = den_;
+		period[c] = 48 * den_;
+		realign[c] = true;
+		updateSwing(c);
+	}
+	// delay of odd pulses as a fraction of the period (0 - 0.5), rounded to master clock ticks
+	void setSwing(float amount) {
+		amount = std::min(std::max(amount, 0.f), 0.5f);
+		if (amount == swingAmount) {
+			return;
+		}
+		swingAmount = amount;
+		for (int c = 0; c < maxChannels; ++c) {
+			updateSwing(c);
+		}
+	}
+	void updateSwing(int c) {
+		// at least a tick is left for the short (odd) period
+		const int32_t ticks = std::lround(swingAmount * period[c] / num[c]);
+		swing[c] = std::min(ticks * num[c], period[c] - num[c]);
+	}
+	// maxDuty in master clock ticks, as for ClockGenerator
+	void setDuty(float maxDuty) {
+		for (int c = 0; c < channels; ++c) {
+			duty[c] = std::min(maxDuty * num[c], 0.5f * (period[c] - swing[c]));
+		}
+	}
+	// called on each master clock tick
+	void tick() {
+		for (int c = 0; c < channels; ++c) {
+			acc[c] += num[c];
+		}
+	}
+	// called on each beat of the main clock (after tick)
+	void beat() {
+		for (int c = 0; c < channels; ++c) {
+			if (realign[c] || ++beats[c] >= den[c]) {
+				beats[c] = 0;
+				realign[c] = false;
+				// ends an odd period now, so the pulse is even
+				odd[c] = 1;
+				acc[c] = period[c] - swing[c];
+			}
+		}
+	}
+	// fraction is the master clock's position within the current tick (0 - 1)
+	void process(float fraction) {
+		for (int c = 0; c < channels; ++c) {
+			const float phase = acc[c] + num[c] * fraction;
+			const int32_t length = odd[c] ? period[c] - swing[c] : period[c] + swing[c];
+			const bool rise = phase >= length;
+			acc[c] -= rise ? length : 0;
+			odd[c] = rise ? 1 - odd[c] : odd[c];
+			state[c] = (rise || (state[c] > 0.f && phase < duty[c])) ? 1.f : 0.f;
+		}
+	}
+	bool isOn(int c) const {
+		return state[c] > 0.f;
+	}
+	// outputs low and patterns restart on the next beat
+	void reset() {
+		for (int c = 0; c < maxChannels; ++c) {
+			state[c] = 0.f;
+			beats[c] = 0;
+			realign[c] = true;
+		}
+	}
+};
+
+// Locks the master clock to an external clock with ppqn pulses per beat. The interval between
+// pulses is measured and smoothed, and at each pulse the master clock's rate until the next one
+// is corrected by a fraction of its phase error (a simple second order PLL). The first pulse
+// restarts the master clock in phase and the second sets the tempo (restarting again if the
+// phase is more than a tick out), so with a steady input the loop is locked within three pulses. The master clock never runs more than a pulse ahead of
+// the input, so CLK stops when the input stops (and restarts in phase with the next pulse).
+class ClockSync {
+public:
+	enum Event {
+		NONE,
+		PULSE,
+		RESTART,	// restart the master clock in phase with this pulse
+		STOP		// no pulse for timeoutPulses, the master clock is held
+	};
+
+	// fraction of the phase error corrected per pulse, while acquiring lock and once locked
+	static constexpr float acquireGain = 1.f;
+	static constexpr float lockedGain = 0.25f;
+	static const int acquirePulses = 3;
+	// smoothing of the measured interval, and the relative change taken as a change of tempo
+	static constexpr float periodGain = 0.0625f;
+	static constexpr float tempoJump = 0.1f;
+	static constexpr float timeoutPulses = 4.f;
+
+	ClockTrigger trigger;
+	int ticksPerPulse = 48;
+	int32_t ticks = 0;			// master clock ticks since the last pulse, plus the phase error carried over
+	int pulses = 0;				// pulses since the last restart (saturates), 0 if stopped
+	double elapsed = 0.;		// time since the last pulse
+	float waited = 0.f;			// time the master clock has waited for the next pulse
+	float pulsePeriod = 0.f;	// estimated interval between pulses, 0 until known
+	float correction = 0.f;		// ticks to drop (or, if negative, add) before the next pulse
+
+	bool running() const {
+		return pulses > 0;
+	}
+	// the master clock may run up to a pulse ahead, short of the tick that would start the next
+	// pulse, so if the input stops the gates still fall and at most one extra pulse is output
+	bool canTick() const {
+		return running() && ticks < 2 * ticksPerPulse - 1;
+	}
+	void tick() {
+		++ticks;
+	}
+	// called for each sample the master clock can't tick, the master clock is ahead by that much
+	void wait(float sampleTime) {
+		waited += sampleTime;
+	}
+	// master clock tick length until the next pulse
+	float tickTime() const {
+		return pulsePeriod / std::max(ticksPerPulse - correction, 0.25f * ticksPerPulse);
+	}
+
+	// fraction is the master clock's position within its current tick (0 - 1), defaultPeriod is
+	// used as the interval until one has been measured
+	Event process(float in, float sampleTime, float fraction, float defaultPeriod) {
+		elapsed += sampleTime;
+		if (!trigger.process(in, 0.1f, 2.f)) {
+			if (running() && elapsed > timeoutPulses * pulsePeriod) {
+				pulses = 0;
+				return STOP;
+			}
+			return NONE;
+		}
+
+		if (!running()) {
+			if (pulsePeriod <= 0.f) {
+				pulsePeriod = defaultPeriod;
+			}
+			return restart();
+		}
+
+		const float measured = elapsed;
+		elapsed = 0.;
+		// the first interval after a restart, or a change of tempo, is taken as is
+		const bool newTempo = (pulses == 1 || std::fabs(measured - pulsePeriod) > tempoJump * pulsePeriod);
+		if (newTempo) {
+			pulsePeriod = measured;
+			pulses = 1;
+		}
+		else {
+			pulsePeriod += periodGain * (measured - pulsePeriod);
+		}
+		if (pulses < acquirePulses) {
+			++pulses;
+		}
+
+		// positive if the master clock is ahead of the input
+		const float lead = ticks + fraction - ticksPerPulse + waited / tickTime();
+		waited = 0.f;
+		if (lead < -0.5f * ticksPerPulse || (newTempo && std::fabs(lead) > 1.f)) {
+			// too far behind to catch up smoothly, or more than a tick out while the tempo was
+			// unknown: restarting now is quicker than correcting the phase over several pulses
+			return restart();
+		}
+		correction = (pulses < acquirePulses) ? acquireGain * lead : lockedGain * lead;
+		ticks -= ticksPerPulse;
+		return PULSE;
+	}
+
+	Event restart() {
+		ticks = 0;
+		pulses = 1;
+		elapsed = 0.;
+		waited = 0.f;
+		correction = 0.f;
+		return RESTART;
+	}
+
+	// takes now as the time of a pulse, e.g. when the master clock is reset
+	void realign() {
+		ticks = 0;
+		waited = 0.f;
+		correction = 0.f;
+	}
+
+	// e.g. when the input is disconnected, the next pulse restarts the master clock
+	void reset() {
+		trigger.reset();
+		ticks = 0;
+		pulses = 0;
+		elapsed = 0.;
+		waited = 0.f;
+		correction = 0.f;
+	}
+};
+
+// Band-limited output edges, for when CLK runs at audio rates: each transition is given its
+// position between two samples, and a polyBLEP residual (a two sample polynomial approximation
+// of a band-limited step, minus the naive step) is added to the samples either side of it.
+// The sample before an edge has already been computed when the edge is found, so the output
+// is a sample late. Only samples next to an edge need any work.
+class EdgeShaper {
+public:
+	float naive = 0.f;		// state at the previous sample, which is output next
+	float residual = 0.f;	// correction for the previous sample
+	float next = 0.f;		// correction for this sample
+
+	// where is the position of the transition between the previous sample (0) and this one (1)
+	void transition(bool from, bool to, float where) {
+		if (from == to) {
+			return;
+		}
+		const float height = to ? 1.f : -1.f;
+		const float before = 1.f - where;
+		residual += 0.5f * height * before * before;
+		next -= 0.5f * height * where * where;
+	}
+	// returns the previous sample's level (0 - 1)
+	float process(bool state) {
+		const float out = naive + residual;
+		naive = state;
+		residual = next;
+		next = 0.f;
+		return out;
+	}
+	bool isHigh() const {
+		return naive > 0.5f;
+	}
+	void reset(bool state) {
+		naive = state;
+		residual = next = 0.f;
+	}
+};
+
+// Tempo from tapped beats: the median of the last N intervals, so that a single early, late or
+// missed tap doesn't throw the tempo off. Taps closer than debounceTime to the previous one are
+// ignored, and a gap longer than maxInterval starts a new sequence. Fixed size, no allocation.
+template <int N>
+class TapTempo {
+public:
+	static constexpr float debounceTime = 0.1f;
+	static constexpr float maxInterval = 2.f;
+
+	float intervals[N];		// ring buffer, the first count are valid
+	int count = 0;
+	int next = 0;
+	double elapsed = 0.;	// time since the last tap
+	bool tapped = false;	// a sequence of taps has started
+
+	// returns true if tapped gives a new interval, see interval()
+	bool process(bool tap, float sampleTime) {
+		elapsed += sampleTime;
+		if (!tap || (tapped && elapsed < debounceTime)) {
+			return false;
+		}
+		const bool inSequence = tapped && elapsed <= maxInterval;
+		const float interval = elapsed;
+		tapped = true;
+		elapsed = 0.;
+		if (!inSequence) {
+			count = next = 0;
+			return false;
+		}
+		intervals[next] = interval;
+		next = (next + 1) % N;
+		count = std::min(count + 1, N);
+		return true;
+	}
+
+	// median of the stored intervals (at least one)
+	float interval() const {
+		float sorted[N];
+		for (int i = 0; i < count; ++i) {
+			// insertion sort, N is small
+			int j = i;
+			for (; j > 0 && sorted[j - 1] > intervals[i]; --j) {
+				sorted[j] = sorted[j - 1];
+			}
+			sorted[j] = intervals[i];
+		}
+		return (count % 2) ? sorted[count / 2] : 0.5f * (sorted[count / 2 - 1] + sorted[count / 2]);
+	}
+};
+
+
+struct alignas(cacheLineSize) CLKCore {
+	enum TriggerMode {
+		TRIGGER_MODE,
+		GATE_MODE,
+		ORIGINAL_MODE,
+		OUTPUT_MODE_LEN
+	};
+
+	// B and C either use the multiplier tables (as on the hardware) or arbitrary num/den ratios
+	enum SubClockMode {
+		TABLE_MODE,
+		RATIO_MODE,
+		SUBCLOCK_MODE_LEN
+	};
+
+	struct Ratio {
+		uint16_t num;
+		uint16_t den;
+	};
+	static const uint16_t maxRatioTerm = 16;
+	// knob units (of the 0 - 10 range) per octave of ratio in ratio mode, 5 is 1/1
+	static constexpr float ratioKnobPerOctave = 1.25f;
+
+	// output edges, see EdgeShaper
+	enum EdgeMode {
+		NAIVE_EDGES,
+		BANDLIMITED_EDGES,
+		EDGE_MODE_LEN
+	};
+
+	// polyphonic subclock channels get ratios spread from the knob's ratio
+	enum PolySpread {
+		SPREAD_MULTIPLES,
+		SPREAD_DIVISIONS,
+		SPREAD_NONE,
+		POLY_SPREAD_LEN
+	};
+
+	MasterClock master;
+	// locks the master clock to the external clock input, when connected
+	ClockSync sync;
+	// external clock pulses per beat, must divide 48
+	int externalPPQN = 1;
+
+	// per-sample inputs of process(), connected inputs only
+	struct Inputs {
+		bool externalConnected = false;
+		float external = 0.f;
+		bool runConnected = false;
+		float run = 0.f;
+		float reset = 0.f;
+		float tap = 0.f;
+		float bpmCV = 0.f;		// 1V/oct, can be audio rate
+	};
+
+	EdgeMode edgeMode = NAIVE_EDGES;
+	EdgeMode shapedEdgeMode = NAIVE_EDGES;
+	// steps per sample (1, 2, 4 or 8) with naive edges, whose outputs are averaged
+	int oversampling = 1;
+	EdgeShaper edgeA;
+	EdgeShaper edgesB[RatioClockBank::maxChannels];
+	EdgeShaper edgesC[RatioClockBank::maxChannels];
+
+	// output levels (0 - 1) from the last process(), B and C per channel; with band-limited edges
+	// or oversampling these take values in between around edges
+	float outA = 0.f;
+	float outB[RatioClockBank::maxChannels] = {};
+	float outC[RatioClockBank::maxChannels] = {};
+
+	// clocks run while the run input is high (or unpatched)
+	bool running = true;
+	ClockTrigger runTrigger, resetTrigger, tapTrigger;
+	// tempo tapped in, which overrides the BPM knob until the knob is moved (0 if none)
+	TapTempo<5> tapTempo;
+	float tapBPM = 0.f;
+	float knobBPM = -1.f;
+	// subclocks B and C, used in ratio mode or with polyphonic outputs
+	RatioClockBank bankB, bankC;
+	bool banksInUse = false;
+
+	// indices into B_MULTIPLIERS / C_MULTIPLIERS
+	SubClockTick mulB = 5;
+	SubClockTick mulC = 5;
+
+	int outputMultiplier = 0;
+	TriggerMode triggerMode = ORIGINAL_MODE;
+	SubClockMode subClockMode = TABLE_MODE;
+	int polyChannels = 1;
+	PolySpread polySpread = SPREAD_MULTIPLES;
+	// swing of the main clock and subclocks B and C: the delay of odd pulses as a fraction of the
+	// period (0 - 0.5, i.e. 50% - 75% swing), in whole master clock ticks
+	float swingA = 0.f;
+	float swingB = 0.f;
+	float swingC = 0.f;
+	// master clock ticks since the last beat, the beat isn't swung
+	int beatTick = 0;
+
+	// all reduced fractions with terms up to maxRatioTerm, in ascending order of value, built when
+	// the core is constructed so that nearestRatio() never allocates on the audio thread
+	struct RatioTable {
+		Ratio ratios[maxRatioTerm * maxRatioTerm];
+		int size = 0;
+
+		RatioTable() {
+			for (uint16_t num = 1; num <= maxRatioTerm; ++num) {
+				for (uint16_t den = 1; den <= maxRatioTerm; ++den) {
+					uint16_t a = num, b = den;
+					while (b) {
+						const uint16_t t = a % b;
+						a = b;
+						b = t;
+					}
+					if (a == 1) {
+						ratios[size++] = {num, den};
+					}
+				}
+			}
+			std::sort(ratios, ratios + size, [](const Ratio& x, const Ratio& y) {
+				return x.num * y.den < y.num * x.den;
+			});
+		}
+	};
+	RatioTable ratioTable;
+
+	// ratio nearest (in octaves) to the given value
+	Ratio nearestRatio(float value) const {
+		const Ratio* begin = ratioTable.ratios;
+		const Ratio* end = begin + ratioTable.size;
+		const Ratio* it = std::lower_bound(begin, end, value, [](const Ratio& r, float v) {
+			return r.num < v * r.den;
+		});
+		if (it == end) {
+			return *(end - 1);
+		}
+		if (it != begin) {
+			const Ratio* prev = it - 1;
+			// compare in the log domain, i.e. value / prev against it / value
+			if (value * value * prev->den * it->den < (float) prev->num * it->num) {
+				return *prev;
+			}
+		}
+		return *it;
+	}
+
+	// knob (0 - 10) plus CV (1V/oct)
+	Ratio ratioFromParam(float param, float cv) const {
+		return nearestRatio(ratioValueFromParam(param) * std::exp2(cv));
+	}
+	static float ratioValueFromParam(float param) {
+		return std::exp2((param - 5.f) / ratioKnobPerOctave);
+	}
+	// value of a multiplier table entry (for polyphonic outputs in table mode)
+	static float ratioValueFromTable(SubClockTick ticks) {
+		return 48.f / ticks;
+	}
+	static float paramFromRatio(Ratio ratio) {
+		return 5.f + ratioKnobPerOctave * std::log2((float) ratio.num / ratio.den);
+	}
+
+	// banks are used for ratio mode or polyphonic outputs, otherwise B and C are the hardware
+	// subclocks of the master clock
+	bool useBanks() const {
+		return subClockMode == RATIO_MODE || polyChannels > 1;
+	}
+
+	// base ratio value of subclock i (0 for B, 1 for C) from its knob (0 - 10), for setSubClockRatios()
+	float baseRatioValue(int i, float param) const {
+		if (subClockMode == RATIO_MODE) {
+			return ratioValueFromParam(param);
+		}
+		const int index = std::min(std::max((int) param, 0), 10);
+		return ratioValueFromTable((i == 0) ? B_MULTIPLIERS[index] : C_MULTIPLIERS[index]);
+	}
+
+	// cached inputs of setSubClockRatios(), for B and C
+	float lastBase[2] = {-1.f, -1.f};
+	float lastCV[2][RatioClockBank::maxChannels] = {};
+	int lastSpread[2] = {-1, -1};
+
+	// sets the ratio of each channel of subclock i (0 for B, 1 for C), from the base ratio value
+	// (see ratioValueFromParam/ratioValueFromTable), the spread and CV (1V/oct, either one for
+	// all channels or one per channel). The ratio table is only searched when an input changes.
+	void setSubClockRatios(int i, float base, const float* cv, int cvChannels) {
+		RatioClockBank& bank = (i == 0) ? bankB : bankC;
+		const bool changed = (base != lastBase[i] || polySpread != lastSpread[i] || bank.channels != polyChannels);
+		lastBase[i] = base;
+		lastSpread[i] = polySpread;
+		bank.setChannels(polyChannels);
+
+		for (int c = 0; c < polyChannels; ++c) {
+			const float v = (cvChannels > 0) ? cv[std::min(c, cvChannels - 1)] : 0.f;
+			if (changed || v != lastCV[i][c]) {
+				lastCV[i][c] = v;
+				float spread = 1.f;
+				switch (polySpread) {
+					case SPREAD_MULTIPLES: spread = c + 1; break;
+					case SPREAD_DIVISIONS: spread = 1.f / (c + 1); break;
+					case SPREAD_NONE:
+					default: break;
+				}
+				const Ratio ratio = nearestRatio(base * spread * std::exp2(v));
+				bank.setRatio(c, ratio.num, ratio.den);
+			}
+		}
+	}
+
+	// channel is only used with polyphonic outputs
+	bool isOnB(int c = 0) const {
+		return useBanks() ? bankB.isOn(c) : master.clockB.isOn();
+	}
+	bool isOnC(int c = 0) const {
+		return useBanks() ? bankC.isOn(c) : master.clockC.isOn();
+	}
+
+	// restarts all clocks in phase: the main clock and subclocks go high now
+	void restart() {
+		master.pos = 0.f;
+		beatTick = 0;
+		master.clockA.restart();
+		master.clockB.restart();
+		master.clockC.restart();
+		if (banksInUse) {
+			bankB.reset();
+			bankC.reset();
+			bankB.beat();
+			bankC.beat();
+		}
+	}
+
+	// RESET: restarts all clocks in phase now; following an external clock, now is taken as the
+	// time of a pulse
+	void resetPhase() {
+		if (running) {
+			restart();
+			sync.realign();
+		}
+	}
+
+	// all outputs go low, e.g. when the external clock stops
+	void stop() {
+		master.clockA.off();
+		master.clockB.off();
+		master.clockC.off();
+		bankB.reset();
+		bankC.reset();
+	}
+
+	// run, reset and tap inputs; resets are sample accurate (outputs go high in the same sample)
+	void processTransport(const Inputs& in, float sampleTime, float bpm) {
+		bool run = true;
+		if (in.runConnected) {
+			runTrigger.process(in.run, 0.1f, 2.f);
+			run = runTrigger.isHigh();
+		}
+		if (run != running) {
+			running = run;
+			if (!running) {
+				stop();
+			}
+			else if (in.externalConnected) {
+				// starts with the next pulse
+				sync.reset();
+			}
+			else {
+				restart();
+			}
+		}
+
+		if (resetTrigger.process(in.reset, 0.1f, 2.f)) {
+			resetPhase();
+		}
+
+		if (bpm != knobBPM) {
+			knobBPM = bpm;
+			tapBPM = 0.f;
+		}
+		if (tapTempo.process(tapTrigger.process(in.tap, 0.1f, 2.f), sampleTime)) {
+			tapBPM = 60.f / tapTempo.interval();
+			// the beat follows the taps (unless following an external clock)
+			if (!in.externalConnected) {
+				resetPhase();
+			}
+		}
+	}
+
+	// bpm is the tempo of the main output (before outputMultiplier), b and c index the
+	// multiplier tables for the two subclocks (when using banks, call setSubClockRatios() first).
+	// If the external input is connected, the master clock follows its pulses instead of bpm
+	// (which is only used until the input's tempo has been measured).
+	void process(float bpm, SubClockTick b, SubClockTick c, float sampleTime, const Inputs& in) {
+		PROFILE_ZONE("CLKCore");
+
+		PROFILE_PHASE("transport");
+		processTransport(in, sampleTime, bpm);
+		if (tapBPM > 0.f) {
+			bpm = tapBPM;
+		}
+		if (in.bpmCV != 0.f) {
+			bpm *= std::exp2(in.bpmCV);
+		}
+		const bool external = in.externalConnected;
+
+		if (b != mulB) {
+			mulB = b;
+			master.resetB = true;
+		}
+		if (c != mulC) {
+			mulC = c;
+			master.resetC = true;
+		}
+
+		// context menu allows x1, x2, x4, x8, x16 - this applies that factor
+		const uint32_t scale = (1 << outputMultiplier);
+		// length of a tick of the master clock (which runs at x48 to make mult/division easier,
+		// and which includes above scale)
+		float tickTime = 1. / (scale * 48. * bpm / 60.);
+
+		PROFILE_PHASE("sync");
+		if (external) {
+			sync.ticksPerPulse = scale * 48 / externalPPQN;
+			const float fraction = (master.period > 0.f) ? std::min(master.pos / master.period, 1.f) : 0.f;
+			const ClockSync::Event event = sync.process(in.external, sampleTime, fraction, tickTime * sync.ticksPerPulse);
+			if (running) {
+				switch (event) {
+					case ClockSync::RESTART: restart(); break;
+					case ClockSync::STOP: stop(); break;
+					default: break;
+				}
+			}
+			tickTime = sync.tickTime();
+		}
+		else if (sync.running()) {
+			sync.reset();
+		}
+		// the main output's period can't go below two samples, which also bounds the master
+		// clock ticks per sample
+		tickTime = std::max(tickTime, sampleTime / 24.f);
+
+		// master clock, running at 48x intended BPM
+		master.setPeriod(tickTime);
+		float maxDuty;
+		switch (triggerMode) {
+			case ORIGINAL_MODE:
+				maxDuty = 48 >> 1;
+				break;
+			case GATE_MODE:
+				maxDuty = INT16_MAX;
+				break;
+			case TRIGGER_MODE:
+			default:
+				maxDuty = std::max(1., (1e-3 / tickTime) / 48);
+				break;
+		}
+
+		// A ticks every 48 master clock ticks
+		master.clockA.setPeriod(48, maxDuty, swingA);
+		master.clockB.setPeriod(B_MULTIPLIERS[b], maxDuty, swingB);
+		master.clockC.setPeriod(C_MULTIPLIERS[c], maxDuty, swingC);
+
+		const bool banks = useBanks();
+		if (banks) {
+			bankB.setSwing(swingB);
+			bankC.setSwing(swingC);
+			bankB.setDuty(maxDuty);
+			bankC.setDuty(maxDuty);
+		}
+		else if (banksInUse) {
+			// so that they start from the next beat when used again
+			bankB.reset();
+			bankC.reset();
+		}
+		banksInUse = banks;
+
+		if (edgeMode != shapedEdgeMode) {
+			shapedEdgeMode = edgeMode;
+			resetEdges();
+		}
+
+		// outputs are the mean of the oversampled steps; band-limited edges don't need oversampling
+		PROFILE_PHASE("clock");
+		const int steps = (edgeMode == BANDLIMITED_EDGES) ? 1 : oversampling;
+		const int channels = banks ? polyChannels : 1;
+		if (steps == 1) {
+			step(sampleTime, external, banks);
+			outA = level(edgeA, master.clockA.isOn());
+			for (int ch = 0; ch < channels; ++ch) {
+				outB[ch] = level(edgesB[ch], isOnB(ch));
+				outC[ch] = level(edgesC[ch], isOnC(ch));
+			}
+			return;
+		}
+
+		const float stepTime = sampleTime / steps;
+		outA = 0.f;
+		std::fill(outB, outB + channels, 0.f);
+		std::fill(outC, outC + channels, 0.f);
+		for (int k = 0; k < steps; ++k) {
+			step(stepTime, external, banks);
+			outA += master.clockA.isOn();
+			for (int ch = 0; ch < channels; ++ch) {
+				outB[ch] += isOnB(ch);
+				outC[ch] += isOnC(ch);
+			}
+		}
+		const float gain = 1.f / steps;
+		outA *= gain;
+		for (int ch = 0; ch < channels; ++ch) {
+			outB[ch] *= gain;
+			outC[ch] *= gain;
+		}
+	}
+
+	// advances the clocks by stepTime, which can include several master clock ticks
+	void step(float stepTime, bool external, bool banks) {
+		if (!running) {
+			return;
+		}
+		if (external && !sync.canTick()) {
+			if (sync.running()) {
+				sync.wait(stepTime);
+			}
+		}
+		else {
+			master.pos += stepTime;
+			while (master.pos > master.period && (!external || sync.canTick())) {
+				master.pos -= master.period;
+				// master.pos is now the time since the tick
+				tick(external, banks, 1.f - master.pos / stepTime);
+			}
+		}
+
+		if (banks) {
+			const float fraction = std::min(std::max(master.pos / master.period, 0.f), 1.f);
+			bankB.process(fraction);
+			bankC.process(fraction);
+			if (edgeMode == BANDLIMITED_EDGES) {
+				bankEdges(bankB, edgesB, fraction, stepTime);
+				bankEdges(bankC, edgesC, fraction, stepTime);
+			}
+		}
+	}
+
+	// where is the position of the tick between the previous step (0) and this one (1)
+	void tick(bool external, bool banks, float where) {
+		const bool a = master.clockA.isOn();
+		const bool b = master.clockB.isOn();
+		const bool c = master.clockC.isOn();
+		master.tick();
+
+		if (external) {
+			sync.tick();
+		}
+		if (++beatTick >= 48) {
+			beatTick = 0;
+		}
+		if (banks) {
+			bankB.tick();
+			bankC.tick();
+			if (beatTick == 0) {
+				bankB.beat();
+				bankC.beat();
+			}
+		}
+
+		if (edgeMode == BANDLIMITED_EDGES) {
+			where = std::min(std::max(where, 0.f), 1.f);
+			edgeA.transition(a, master.clockA.isOn(), where);
+			if (!banks) {
+				edgesB[0].transition(b, master.clockB.isOn(), where);
+				edgesC[0].transition(c, master.clockC.isOn(), where);
+			}
+		}
+	}
+
+	// bank edges fall between master clock ticks: the phase past the edge gives its position
+	void bankEdges(const RatioClockBank& bank, EdgeShaper* shapers, float fraction, float stepTime) {
+		for (int ch = 0; ch < bank.channels; ++ch) {
+			const bool on = bank.isOn(ch);
+			if (on != shapers[ch].isHigh()) {
+				// a rise resets the phase, so what is left is past the edge; a fall is past the duty
+				const float phase = bank.acc[ch] + bank.num[ch] * fraction - (on ? 0.f : bank.duty[ch]);
+				const float since = phase / bank.num[ch] * master.period;
+				shapers[ch].transition(!on, on, std::min(std::max(1.f - since / stepTime, 0.f), 1.f));
+			}
+		}
+	}
+
+	float level(EdgeShaper& shaper, bool state) {
+		return (edgeMode == BANDLIMITED_EDGES) ? shaper.process(state) : state;
+	}
+
+	void resetEdges() {
+		edgeA.reset(master.clockA.isOn());
+		for (int ch = 0; ch < RatioClockBank::maxChannels; ++ch) {
+			edgesB[ch].reset(isOnB(ch));
+			edgesC[ch].reset(isOnC(ch));
+		}
+	}
+};
+
+// Message from a CLK Expander (CLKExpander.cpp) placed directly to the right of CLK, carrying the
+// inputs that don't fit on CLK's 4HP panel
+struct CLKExpanderMessage {
+	CLKCore::Inputs inputs;
+	// ratio CV of subclocks B and C, see setSubClockRatios()
+	float ratioCV[2][RatioClockBank::maxChannels] = {};
+	int ratioChannels[2] = {0, 0};
+};
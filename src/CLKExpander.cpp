@@ -0,0 +1,142 @@
+#include "plugin.hpp"
+#include "CLKCore.h"
+
+// Inputs for CLK, which has no room for them on its 4HP panel: external clock, run, reset, tap
+// tempo, BPM CV and the ratio CV of both subclocks. Placed directly to the right of CLK, the
+// expander passes them on through expander messages (see CLKExpanderMessage), one sample late.
+struct CLKExpander : Module, CacheAligned {
+	enum ParamId {
+		PARAMS_LEN
+	};
+	enum InputId {
+		BPM_CV_INPUT,
+		SCALE_8_CV_INPUT,
+		SCALE_24_CV_INPUT,
+		EXT_CLOCK_INPUT,
+		RUN_INPUT,
+		RESET_INPUT,
+		TAP_INPUT,
+		INPUTS_LEN
+	};
+	enum OutputId {
+		OUTPUTS_LEN
+	};
+	enum LightId {
+		LINK_LIGHT,
+		LIGHTS_LEN
+	};
+
+	ModuleTheme theme = LIGHT_THEME;
+
+	LightDivider<LIGHTS_LEN> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+
+	CLKExpander() {
+		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
+		configInput(BPM_CV_INPUT, "BPM CV (1V/oct, up to audio rate)");
+		configInput(SCALE_8_CV_INPUT, "Clock #1 ratio CV (1V/oct, ratio mode or polyphonic)");
+		configInput(SCALE_24_CV_INPUT, "Clock #2 ratio CV (1V/oct, ratio mode or polyphonic)");
+		configInput(EXT_CLOCK_INPUT, "External clock (overrides BPM)");
+		configInput(RUN_INPUT, "Run (gate)");
+		configInput(RESET_INPUT, "Reset");
+		configInput(TAP_INPUT, "Tap tempo (overrides BPM until the knob is moved)");
+
+		configLight(LINK_LIGHT, "Connected to CLK");
+
+		theme = loadDefaultTheme();
+	}
+
+	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("CLKExpander");
+
+		edgeCapture.process(this, args);
+
+		Module* clk = leftExpander.module;
+		const bool connected = clk && clk->model == modelCLK;
+		if (connected) {
+			CLKExpanderMessage* message = static_cast<CLKExpanderMessage*>(clk->rightExpander.producerMessage);
+			message->inputs.externalConnected = inputs[EXT_CLOCK_INPUT].isConnected();
+			message->inputs.external = inputs[EXT_CLOCK_INPUT].getVoltage();
+			message->inputs.runConnected = inputs[RUN_INPUT].isConnected();
+			message->inputs.run = inputs[RUN_INPUT].getVoltage();
+			message->inputs.reset = inputs[RESET_INPUT].getVoltage();
+			message->inputs.tap = inputs[TAP_INPUT].getVoltage();
+			message->inputs.bpmCV = inputs[BPM_CV_INPUT].getVoltage();
+			for (int i = 0; i < 2; ++i) {
+				Input& cv = inputs[SCALE_8_CV_INPUT + i];
+				const int channels = std::min(cv.getChannels(), RatioClockBank::maxChannels);
+				for (int c = 0; c < channels; ++c) {
+					message->ratioCV[i][c] = cv.getVoltage(c);
+				}
+				message->ratioChannels[i] = channels;
+			}
+			clk->rightExpander.requestMessageFlip();
+		}
+
+		lightDivider.accumulate(LINK_LIGHT, connected);
+		if (lightDivider.process()) {
+			lightDivider.setBrightness(lights[LINK_LIGHT], LINK_LIGHT);
+		}
+	}
+
+	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
+		json_t* themeJ = json_object_get(rootJ, "theme");
+		if (themeJ) {
+			theme = (ModuleTheme) json_integer_value(themeJ);
+		}
+	}
+
+	json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "theme", json_integer(theme));
+
+		edgeCapture.toJson(rootJ);
+		return rootJ;
+	}
+};
+
+
+struct CLKExpanderWidget : RebelTechModuleWidget {
+
+	CLKExpanderWidget(CLKExpander* module) : RebelTechModuleWidget("res/panels/CLKExpander.svg", "res/panels/CLKExpander_drk.svg") {
+		setModule(module);
+		setPanel(lightSvg);
+
+		screws.push_back(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+		screws.push_back(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+		for (auto screw : screws) {
+			addChild(screw);
+		}
+
+		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(10.16, 16.3)), module, CLKExpander::LINK_LIGHT));
+
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 28.2)), module, CLKExpander::BPM_CV_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 42.0)), module, CLKExpander::SCALE_8_CV_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 55.8)), module, CLKExpander::SCALE_24_CV_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 69.6)), module, CLKExpander::EXT_CLOCK_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 83.4)), module, CLKExpander::RUN_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 97.2)), module, CLKExpander::RESET_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(10.16, 111.0)), module, CLKExpander::TAP_INPUT));
+	}
+
+	void draw(const DrawArgs& args) override {
+
+		CLKExpander* module = dynamic_cast<CLKExpander*>(this->module);
+		updateComponentsForTheme<CLKExpander>(module, this, theme);
+		ModuleWidget::draw(args);
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		CLKExpander* module = dynamic_cast<CLKExpander*>(this->module);
+		assert(module);
+
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
+		addThemeMenuItems(menu, &module->theme);
+	}
+};
+
+
+Model* modelCLKExpander = createModel<CLKExpander, CLKExpanderWidget>("CLKExpander");
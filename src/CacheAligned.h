@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+// Rack spreads modules across engine threads, so each module's per-sample state (its core) is
+// kept on cache lines of its own: otherwise neighbouring modules on different threads keep
+// invalidating each other's lines (false sharing).
+
+constexpr std::size_t cacheLineSize = 64;
+
+// Before C++17, new only guarantees alignof(std::max_align_t), which isn't enough for members
+// declared alignas(cacheLineSize). Structs holding such members derive from this so they are
+// allocated on a cache line boundary.
+struct CacheAligned {
+	static void* operator new(std::size_t size) {
+#ifdef _WIN32
+		void* p = _aligned_malloc(size, cacheLineSize);
+		if (!p) {
+			throw std::bad_alloc();
+		}
+#else
+		void* p = nullptr;
+		if (posix_memalign(&p, cacheLineSize, size) != 0) {
+			throw std::bad_alloc();
+		}
+#endif
+		return p;
+	}
+
+	static void operator delete(void* p) {
+#ifdef _WIN32
+		_aligned_free(p);
+#else
+		free(p);
+#endif
+	}
+};
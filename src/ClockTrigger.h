@@ -0,0 +1,59 @@
+#pragma once
+
+// Rack-independent equivalents of dsp::SchmittTrigger and dsp::BooleanTrigger, so that the
+// module cores (*Core.h) can also be built into the offline tools (see tools/). Behaviour,
+// including starting in the "high" state, matches Rack v2.
+
+struct ClockTrigger {
+	bool state = true;
+
+	void reset() {
+		state = true;
+	}
+
+	// returns true on a rising edge, i.e. when the input crosses highThreshold from below
+	bool process(float in, float lowThreshold = 0.f, float highThreshold = 1.f) {
+		if (state) {
+			if (in <= lowThreshold) {
+				state = false;
+			}
+		}
+		else if (in >= highThreshold) {
+			state = true;
+			return true;
+		}
+		return false;
+	}
+
+	bool isHigh() const {
+		return state;
+	}
+};
+
+struct BooleanTrigger {
+	bool last = true;
+
+	void reset() {
+		last = true;
+	}
+
+	// returns true when state goes from false to true
+	bool process(bool state) {
+		const bool triggered = state && !last;
+		last = state;
+		return triggered;
+	}
+};
+
+// gate state of a signal, with hysteresis: high from 1V, low again below 0.5V
+struct GateDetector {
+	bool high = false;
+
+	// +1 on a rising edge, -1 on a falling edge, otherwise 0
+	int process(float voltage) {
+		const bool state = high ? (voltage > 0.5f) : (voltage >= 1.f);
+		const int edge = state - high;
+		high = state;
+		return edge;
+	}
+};
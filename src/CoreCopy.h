@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include "CacheAligned.h"
+
+// Hands a copy of a module's core from the audio thread to another thread, e.g. for the worker
+// thread of a MIDI export (see MidiExport.h), without either side locking: the other thread calls
+// request() then take(), and the audio thread calls serve() at the top of every process(), which
+// costs one atomic load per sample until a copy is requested.
+template <typename T>
+struct CoreCopy : CacheAligned {
+	enum State {
+		IDLE,
+		REQUESTED,
+		READY
+	};
+
+	std::atomic<int> state{IDLE};
+	T core;
+
+	// audio thread
+	void serve(const T& source) {
+		if (state.load(std::memory_order_acquire) == REQUESTED) {
+			core = source;
+			state.store(READY, std::memory_order_release);
+		}
+	}
+
+	// false if an earlier request hasn't been taken yet
+	bool request() {
+		int expected = IDLE;
+		return state.compare_exchange_strong(expected, REQUESTED);
+	}
+
+	// waits up to timeout (seconds) for the copy, returns false if it didn't arrive, e.g. while
+	// the module is bypassed or the engine paused
+	bool take(T& out, float timeout) {
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<float>(timeout);
+		while (state.load(std::memory_order_acquire) != READY) {
+			if (std::chrono::steady_clock::now() > deadline) {
+				int expected = REQUESTED;
+				if (state.compare_exchange_strong(expected, IDLE)) {
+					return false;
+				}
+				// served just now
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		out = core;
+		state.store(IDLE, std::memory_order_release);
+		return true;
+	}
+};
@@ -0,0 +1,354 @@
+#pragma once
+#include <inttypes.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "CacheAligned.h"
+
+// The edge log, a flight recorder of every rising and falling edge at a module's ports: the module
+// detects edges in process() and pushes them to an EdgeRing of its own, which EdgeRecorder's
+// thread drains to a compact binary file (see EdgeRecorder.h). tools/edgedump decodes the file.
+//
+// File format, integers as unsigned LEB128 varints (signed ones zigzag encoded first), strings as
+// a varint length then the bytes:
+//
+//   header   "RTEL", version byte (1), start time (unix seconds)
+//   records  a tag byte then
+//     MODULE   index, slug, Rack module id, input count and names, output count and names
+//     RATE     index, sample rate (Hz)
+//     EDGES    index, count, then for each edge: the frame change since the module's previous
+//              edge (signed, from 0 for the first edge after its MODULE record), port, and a byte
+//              with bit 5 set for a rising edge, bit 4 for an output, and the channel in bits 0-3
+//     DROPPED  index, edges lost because the ring was full
+//     REMOVED  index (the module was deleted)
+//
+// Frames are Rack's engine frame. Output edges are stamped with the frame they were written in,
+// i.e. one before inputs patched from them see them.
+
+struct EdgeEvent {
+	enum Flags {
+		OUTPUT = 1 << 4,
+		RISING = 1 << 5
+	};
+
+	int64_t frame;
+	uint8_t port;
+	// channel | flags
+	uint8_t bits;
+};
+
+// Single producer (the audio thread) single consumer (the recorder thread) queue of one module's
+// edges, which also holds the audio thread's edge detectors. Edges are dropped (and counted) if the
+// recorder falls behind, rather than the audio thread waiting.
+class EdgeRing : public CacheAligned {
+public:
+	static const size_t size = 4096;
+
+	// audio thread only, gate state per port: bit c set while channel c is high
+	std::vector<uint16_t> inputHigh;
+	std::vector<uint16_t> outputHigh;
+	std::atomic<float> sampleRate{0.f};
+	std::atomic<uint64_t> dropped{0};
+
+	EdgeRing(int numInputs, int numOutputs) : inputHigh(numInputs), outputHigh(numOutputs) {}
+
+	// audio thread: detects edges on one port (with the same hysteresis as GateDetector), or with
+	// prime only takes the state, e.g. when capture has just been enabled
+	void detect(int64_t frame, bool output, int port, const float* voltages, int channels, bool prime) {
+		uint16_t& high = output ? outputHigh[port] : inputHigh[port];
+		uint16_t state = high;
+		for (int c = 0; c < channels; ++c) {
+			const uint16_t bit = 1 << c;
+			if (!(state & bit) && voltages[c] >= 1.f) {
+				state |= bit;
+			}
+			else if ((state & bit) && voltages[c] < 0.5f) {
+				state &= ~bit;
+			}
+		}
+		// channels no longer there read as low
+		state &= (1u << channels) - 1;
+		uint16_t changed = state ^ high;
+		high = state;
+		if (prime) {
+			return;
+		}
+		for (int c = 0; changed; ++c, changed >>= 1) {
+			if (changed & 1) {
+				push({frame, (uint8_t) port, (uint8_t)(c | (output ? EdgeEvent::OUTPUT : 0) | ((state >> c) & 1 ? EdgeEvent::RISING : 0))});
+			}
+		}
+	}
+
+	void push(const EdgeEvent& event) {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == size) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		events[h & (size - 1)] = event;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// recorder thread: appends everything pushed so far to out
+	void pop(std::vector<EdgeEvent>& out) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		const size_t h = head.load(std::memory_order_acquire);
+		for (; t != h; ++t) {
+			out.push_back(events[t & (size - 1)]);
+		}
+		tail.store(t, std::memory_order_release);
+	}
+
+private:
+	EdgeEvent events[size];
+	std::atomic<size_t> head{0};
+	std::atomic<size_t> tail{0};
+};
+
+struct EdgeLog {
+	enum Tag {
+		MODULE = 1,
+		RATE,
+		EDGES,
+		DROPPED,
+		REMOVED
+	};
+
+	static const uint8_t version = 1;
+
+	// a module as described by its MODULE record
+	struct Module {
+		std::string slug;
+		int64_t id = 0;
+		std::vector<std::string> inputs;
+		std::vector<std::string> outputs;
+	};
+
+	// encoding, appending to out
+
+	static void putVarint(std::vector<uint8_t>& out, uint64_t value) {
+		while (value >= 0x80) {
+			out.push_back((value & 0x7f) | 0x80);
+			value >>= 7;
+		}
+		out.push_back(value);
+	}
+
+	static void putSigned(std::vector<uint8_t>& out, int64_t value) {
+		putVarint(out, ((uint64_t) value << 1) ^ (uint64_t)(value >> 63));
+	}
+
+	static void putString(std::vector<uint8_t>& out, const std::string& s) {
+		putVarint(out, s.size());
+		out.insert(out.end(), s.begin(), s.end());
+	}
+
+	static void putHeader(std::vector<uint8_t>& out, int64_t startTime) {
+		out.insert(out.end(), {'R', 'T', 'E', 'L', version});
+		putVarint(out, startTime);
+	}
+
+	static void putModule(std::vector<uint8_t>& out, int index, const Module& module) {
+		out.push_back(MODULE);
+		putVarint(out, index);
+		putString(out, module.slug);
+		putVarint(out, module.id);
+		putVarint(out, module.inputs.size());
+		for (const std::string& name : module.inputs) {
+			putString(out, name);
+		}
+		putVarint(out, module.outputs.size());
+		for (const std::string& name : module.outputs) {
+			putString(out, name);
+		}
+	}
+
+	// lastFrame is the module's previous edge, updated
+	static void putEdges(std::vector<uint8_t>& out, int index, const std::vector<EdgeEvent>& events, int64_t& lastFrame) {
+		out.push_back(EDGES);
+		putVarint(out, index);
+		putVarint(out, events.size());
+		for (const EdgeEvent& event : events) {
+			putSigned(out, event.frame - lastFrame);
+			lastFrame = event.frame;
+			putVarint(out, event.port);
+			out.push_back(event.bits);
+		}
+	}
+
+	static void putValue(std::vector<uint8_t>& out, Tag tag, int index, uint64_t value) {
+		out.push_back(tag);
+		putVarint(out, index);
+		putVarint(out, value);
+	}
+
+	static void putRemoved(std::vector<uint8_t>& out, int index) {
+		out.push_back(REMOVED);
+		putVarint(out, index);
+	}
+};
+
+// Decodes an edge log held in memory, record by record (see EdgeLog)
+class EdgeLogReader {
+public:
+	struct Record {
+		EdgeLog::Tag tag;
+		int module;
+		// RATE and DROPPED
+		uint64_t value;
+		// EDGES, with absolute frames
+		std::vector<EdgeEvent> events;
+	};
+
+	int64_t startTime = 0;
+	// by index, as described by their MODULE records so far
+	std::vector<EdgeLog::Module> modules;
+
+	explicit EdgeLogReader(const std::vector<uint8_t>& data) : data(data) {}
+
+	// false if the data doesn't start with an edge log header of a known version
+	bool readHeader() {
+		if (data.size() < 5 || std::string(data.begin(), data.begin() + 4) != "RTEL" || data[4] != EdgeLog::version) {
+			return fail("not an edge log (or a newer version)");
+		}
+		pos = 5;
+		return getVarint((uint64_t&) startTime);
+	}
+
+	// false at the end of the data, or on an error (see getError()): a log cut short by a crash ends with
+	// a truncated record, which is reported as an error after all complete records
+	bool next(Record& record) {
+		if (pos >= data.size() || !error.empty()) {
+			return false;
+		}
+		uint64_t index;
+		const uint8_t tag = data[pos++];
+		if (!getVarint(index)) {
+			return false;
+		}
+		if (tag != EdgeLog::MODULE && (index >= modules.size() || modules[index].slug.empty())) {
+			return fail("record for an undeclared module");
+		}
+		record.tag = (EdgeLog::Tag) tag;
+		record.module = index;
+		record.value = 0;
+		record.events.clear();
+		switch (tag) {
+			case EdgeLog::MODULE: return getModule(index);
+			case EdgeLog::RATE:
+			case EdgeLog::DROPPED: return getVarint(record.value);
+			case EdgeLog::EDGES: return getEdges(index, record.events);
+			case EdgeLog::REMOVED: return true;
+			default: return fail("unknown record");
+		}
+	}
+
+	const std::string& getError() const {
+		return error;
+	}
+
+	// offset of the next record, for error messages
+	size_t offset() const {
+		return pos;
+	}
+
+private:
+	static const size_t maxModules = 1 << 16;
+
+	const std::vector<uint8_t>& data;
+	size_t pos = 0;
+	std::string error;
+	// previous edge of each module
+	std::vector<int64_t> lastFrames;
+
+	bool fail(const std::string& message) {
+		error = message;
+		return false;
+	}
+
+	bool getVarint(uint64_t& value) {
+		value = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (pos >= data.size()) {
+				return fail("truncated record");
+			}
+			const uint8_t byte = data[pos++];
+			value |= (uint64_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) {
+				return true;
+			}
+		}
+		return fail("invalid varint");
+	}
+
+	bool getString(std::string& s) {
+		uint64_t size;
+		if (!getVarint(size)) {
+			return false;
+		}
+		if (size > data.size() - pos) {
+			return fail("truncated record");
+		}
+		s.assign(data.begin() + pos, data.begin() + pos + size);
+		pos += size;
+		return true;
+	}
+
+	bool getNames(std::vector<std::string>& names) {
+		uint64_t count;
+		if (!getVarint(count) || count > 256) {
+			return error.empty() ? fail("too many ports") : false;
+		}
+		names.resize(count);
+		for (std::string& name : names) {
+			if (!getString(name)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool getModule(uint64_t index) {
+		// indices of deleted modules aren't reused, so there may be gaps
+		if (index > modules.size() + maxModules) {
+			return fail("module index out of range");
+		}
+		EdgeLog::Module module;
+		if (!getString(module.slug) || !getVarint((uint64_t&) module.id) || !getNames(module.inputs) || !getNames(module.outputs)) {
+			return false;
+		}
+		if (index >= modules.size()) {
+			modules.resize(index + 1);
+			lastFrames.resize(index + 1);
+		}
+		modules[index] = module;
+		lastFrames[index] = 0;
+		return true;
+	}
+
+	bool getEdges(uint64_t index, std::vector<EdgeEvent>& events) {
+		uint64_t count;
+		if (!getVarint(count)) {
+			return false;
+		}
+		const EdgeLog::Module& module = modules[index];
+		for (uint64_t i = 0; i < count; ++i) {
+			uint64_t delta, port;
+			if (!getVarint(delta) || !getVarint(port)) {
+				return false;
+			}
+			if (pos >= data.size()) {
+				return fail("truncated record");
+			}
+			const uint8_t bits = data[pos++];
+			const size_t ports = (bits & EdgeEvent::OUTPUT) ? module.outputs.size() : module.inputs.size();
+			if (port >= ports) {
+				return fail("edge on an undeclared port");
+			}
+			lastFrames[index] += (int64_t)(delta >> 1) ^ -(int64_t)(delta & 1);
+			events.push_back({lastFrames[index], (uint8_t) port, bits});
+		}
+		return true;
+	}
+};
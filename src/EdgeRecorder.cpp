@@ -0,0 +1,188 @@
+// Writer side of the edge log, see EdgeRecorder.h
+#include "EdgeRecorder.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct Entry {
+	EdgeRing* ring;
+	EdgeLog::Module module;
+	int index;
+	// what has been written to the current file
+	bool declared = false;
+	float sampleRate = 0.f;
+	uint64_t dropped = 0;
+	int64_t lastFrame = 0;
+	// edges and drop count left by remove(), which clears ring
+	std::vector<EdgeEvent> removedEvents;
+	uint64_t removedDropped = 0;
+};
+
+// guards entries, taken by the writer thread while draining and by add() and remove()
+std::mutex entriesMutex;
+std::list<Entry> entries;
+int nextIndex = 0;
+
+std::thread writer;
+std::atomic<bool> running{false};
+std::string filePath;
+FILE* file = nullptr;
+long fileSize = 0;
+
+bool openFile() {
+	// keep the previous log rather than overwriting it
+	std::rename(filePath.c_str(), (filePath + ".1").c_str());
+	file = std::fopen(filePath.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	std::vector<uint8_t> header;
+	EdgeLog::putHeader(header, std::time(nullptr));
+	fileSize = std::fwrite(header.data(), 1, header.size(), file);
+	return true;
+}
+
+// encodes what each ring has, and declares modules new to the file
+void drain(std::vector<uint8_t>& out, std::vector<EdgeEvent>& events) {
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	for (auto it = entries.begin(); it != entries.end();) {
+		Entry& entry = *it;
+		if (!entry.declared) {
+			EdgeLog::putModule(out, entry.index, entry.module);
+			entry.declared = true;
+			entry.sampleRate = 0.f;
+			entry.lastFrame = 0;
+		}
+
+		events.clear();
+		uint64_t dropped = entry.removedDropped;
+		if (entry.ring) {
+			const float sampleRate = entry.ring->sampleRate.load(std::memory_order_relaxed);
+			if (sampleRate != entry.sampleRate) {
+				EdgeLog::putValue(out, EdgeLog::RATE, entry.index, std::round(sampleRate));
+				entry.sampleRate = sampleRate;
+			}
+			entry.ring->pop(events);
+			dropped = entry.ring->dropped.load(std::memory_order_relaxed);
+		}
+		else {
+			events.swap(entry.removedEvents);
+		}
+		if (dropped != entry.dropped) {
+			EdgeLog::putValue(out, EdgeLog::DROPPED, entry.index, dropped - entry.dropped);
+			entry.dropped = dropped;
+		}
+		if (!events.empty()) {
+			EdgeLog::putEdges(out, entry.index, events, entry.lastFrame);
+		}
+
+		if (!entry.ring) {
+			EdgeLog::putRemoved(out, entry.index);
+			it = entries.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+// a new file once this one is full, in which every module is declared again
+void rotate() {
+	std::fclose(file);
+	file = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(entriesMutex);
+		for (Entry& entry : entries) {
+			entry.declared = false;
+		}
+	}
+	openFile();
+}
+
+void write() {
+	std::vector<uint8_t> out;
+	std::vector<EdgeEvent> events;
+	drain(out, events);
+	if (!file || out.empty()) {
+		return;
+	}
+	fileSize += std::fwrite(out.data(), 1, out.size(), file);
+	std::fflush(file);
+	if (fileSize >= EdgeRecorder::maxFileSize) {
+		rotate();
+	}
+}
+
+void run() {
+	const float period = EdgeRecorder::drainPeriod;
+	while (running.load()) {
+		std::this_thread::sleep_for(std::chrono::duration<float>(period));
+		write();
+	}
+}
+
+// joins the writer before it is destroyed (declared after it, so destroyed first)
+struct StopAtExit {
+	~StopAtExit() {
+		EdgeRecorder::stop();
+	}
+} stopAtExit;
+
+} // namespace
+
+bool EdgeRecorder::start(const std::string& path) {
+	if (running.load()) {
+		return true;
+	}
+	filePath = path;
+	if (!openFile()) {
+		return false;
+	}
+	{
+		// modules already registered are declared in the new file
+		std::lock_guard<std::mutex> lock(entriesMutex);
+		for (Entry& entry : entries) {
+			entry.declared = false;
+		}
+	}
+	running.store(true);
+	writer = std::thread(run);
+	return true;
+}
+
+void EdgeRecorder::stop() {
+	if (!running.exchange(false)) {
+		return;
+	}
+	writer.join();
+	write();
+	if (file) {
+		std::fclose(file);
+		file = nullptr;
+	}
+}
+
+void EdgeRecorder::add(EdgeRing* ring, const EdgeLog::Module& module) {
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	entries.emplace_back();
+	entries.back().ring = ring;
+	entries.back().module = module;
+	entries.back().index = nextIndex++;
+}
+
+void EdgeRecorder::remove(EdgeRing* ring) {
+	std::lock_guard<std::mutex> lock(entriesMutex);
+	for (Entry& entry : entries) {
+		if (entry.ring == ring) {
+			ring->pop(entry.removedEvents);
+			entry.removedDropped = ring->dropped.load();
+			entry.ring = nullptr;
+		}
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <string>
+#include "EdgeLog.h"
+
+// Writes the edges captured by modules to an edge log (see EdgeLog.h). Modules register their
+// EdgeRing, and a background thread drains every ring each drainPeriod and appends the edges to
+// the file, flushed so that a crash loses at most the last period. The log from before the
+// current one (the previous Rack session, or the file before it reached maxFileSize) is kept with
+// ".1" appended to the path, so it always holds at least the last maxFileSize of edges.
+class EdgeRecorder {
+public:
+	// seconds
+	static constexpr float drainPeriod = 0.02f;
+	static const long maxFileSize = 64 << 20;
+
+	// starts the thread writing to path, true if it is running (already, or now) and false if the
+	// file can't be written
+	static bool start(const std::string& path);
+	// drains the rings a last time, closes the file and joins the thread (also done at exit)
+	static void stop();
+
+	// the ring is drained until remove() is called, which must be before it is destroyed
+	static void add(EdgeRing* ring, const EdgeLog::Module& module);
+	// takes the edges left in the ring, so the audio thread must have stopped pushing to it
+	static void remove(EdgeRing* ring);
+};
@@ -1,7 +1,10 @@
 #include "plugin.hpp"
-#include "Sequence.h"
+#include <osdialog.h>
+#include "KlasmataCore.h"
+#include "StoicheiaCore.h"
+#include "MidiExport.h"
 
-struct Klasmata : Module {
+struct Klasmata : Module, CacheAligned {
 	enum ParamIds {
 		OFFSET_PARAM,
 		LENGTH_PARAM,
@@ -9,6 +12,7 @@ struct Klasmata : Module {
 		DENSITY_PARAM,
 		LENGTH_CV_PARAM,
 		DENSITY_CV_PARAM,
+		PROB_PARAM,
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -63,7 +67,13 @@ struct Klasmata : Module {
 		// effective number of fills will depend on on the sequence length
 		std::string getDisplayValueString() override {
 			if (module != nullptr) {
-				if (paramId == DENSITY_PARAM) {
+				const PatternBank* bank = static_cast<Klasmata*>(module)->bank.load();
+				if (bank) {
+					// pattern bank mode: the pattern selected by the knobs (without CV)
+					const size_t pattern = bank->indexAt(KlasmataCore::bankPosition(module->params[LENGTH_PARAM].getValue(), getValue()));
+					return "pattern " + std::to_string(pattern + 1) + " of " + std::to_string(bank->size());
+				}
+				else if (paramId == DENSITY_PARAM) {
 					int length = module->params[LENGTH_PARAM].getValue();
 					return std::to_string(paramToFill(getValue(), length));
 				}
@@ -90,27 +100,28 @@ struct Klasmata : Module {
 		}
 	};
 
-	enum SequenceMode {
-		LATCHED,
-		NORMAL,
-		MUTE
-	};
-
-	struct SequenceParams {
-		int length = -1;
-		int fill = -1;
-		int start = -1;
-		SequenceMode mode;
-	};
+	typedef KlasmataCore::SequenceMode SequenceMode;
 
-	// uint32_t for 32 steps
-	Sequence<uint32_t> seq;
-	SequenceParams oldParams, currentParams;
-	dsp::SchmittTrigger clockTrigger;
-	dsp::SchmittTrigger resetTrigger;
-	bool state, stateAlternating = false;
 	ModuleTheme theme = LIGHT_THEME;
 
+	KlasmataCore core;
+	// with no cables patched the output only depends on the params, so processing can be skipped
+	IdleDetector idleDetector{NUM_PARAMS};
+	LightDivider<NUM_LIGHTS> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+	// copies of the core for MIDI export, see addMidiExportMenuItem()
+	std::shared_ptr<CoreCopy<KlasmataCore>> coreCopy{new CoreCopy<KlasmataCore>};
+	// pattern and playhead for the display
+	PatternPublisher patternPublisher;
+	// pattern bank mode (context menu): the bank is set by the UI thread and picked up by
+	// process(); banks are never freed, so the audio thread can't be left with a stale one
+	std::atomic<const PatternBank*> bank{nullptr};
+	std::string bankPath;
+	// message buffers for a Stoicheia Expander to the right, which sends the probability CV (its
+	// PROB A input) the way it does to Stoicheia
+	StoicheiaChainParams expanderMessages[2];
+
 	Klasmata() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam<OffsetParam>(OFFSET_PARAM, 0.f, 1.f, 0.f, "Offset");
@@ -118,10 +129,12 @@ struct Klasmata : Module {
 		auto lengthParam = configParam(LENGTH_PARAM, 1.f, 32.f, 1.f, "Length");
 		lengthParam->snapEnabled = true;
 
-		configSwitch(SWITCH_PARAM, LATCHED, MUTE, NORMAL, "Mode", {"Latched", "Normal", "Mute"});
+		configSwitch(SWITCH_PARAM, KlasmataCore::LATCHED, KlasmataCore::MUTE, KlasmataCore::NORMAL, "Mode", {"Latched", "Normal", "Mute"});
 		configParam<FillParam>(DENSITY_PARAM, 0.f, 1.f, 0.5f, "Fill Density");
 		configParam(LENGTH_CV_PARAM, 0.f, 1.f, 0.f, "Length CV Attenution");
 		configParam(DENSITY_CV_PARAM, 0.f, 1.f, 0.f, "Density CV Attenution");
+		// no panel control, set from the context menu (with CV on a Stoicheia Expander)
+		configParam(PROB_PARAM, 0.f, 1.f, 1.f, "Probability of each hit", "%", 0.f, 100.f);
 
 		configInput(RESET_INPUT, "Reset");
 		configInput(LENGTH_CV_INPUT, "Length CV");
@@ -132,86 +145,117 @@ struct Klasmata : Module {
 		configLight(IN_LIGHT, "Clock input");
 		configLight(OUT_LIGHT, "Sequence");
 
-		seq.offset = 0;
-		seq.calculate(12, 8);
+		// a different sequence of random choices for each instance, then saved with the patch
+		core.random.setSeed(random::u64());
+
+		rightExpander.producerMessage = &expanderMessages[0];
+		rightExpander.consumerMessage = &expanderMessages[1];
 
 		theme = loadDefaultTheme();
 	}
 
 	void processBypass(const ProcessArgs& args) override {
-		clockTrigger.process(rescale(inputs[CLOCK_INPUT].getVoltage(), 0.1f, 2.f, 0.f, 1.f));
-		outputs[OUT_OUTPUT].setVoltage(clockTrigger.isHigh() * 10.f);
+		core.clockTrigger.process(inputs[CLOCK_INPUT].getVoltage(), 0.1f, 2.f);
+		outputs[OUT_OUTPUT].setVoltage(core.clockTrigger.isHigh() * 10.f);
+	}
+
+	// "" leaves pattern bank mode; returns false (and leaves the bank unchanged) if the file
+	// can't be loaded, with the reason in error
+	bool loadBank(const std::string& path, std::string* error = nullptr) {
+		const PatternBank* newBank = path.empty() ? nullptr : PatternBank::load(path, error);
+		if (!path.empty() && !newBank) {
+			return false;
+		}
+		bankPath = path;
+		bank.store(newBank, std::memory_order_release);
+		return true;
 	}
 
 	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("Klasmata");
+
+		edgeCapture.process(this, args);
 
-		if (resetTrigger.process(rescale(inputs[RESET_INPUT].getVoltage(), 0.1f, 2.f, 0.f, 1.f))) {
-			seq.reset();
+		const PatternBank* newBank = bank.load(std::memory_order_acquire);
+		if (newBank != core.bank) {
+			core.setBank(newBank);
+			idleDetector.wake();
+		}
+
+		coreCopy->serve(core);
+		if (idleDetector.process(this)) {
+			return;
 		}
 
 		// process knobs and CV
+		PROFILE_PHASE("params");
 		{
 			// value between -1 and 1
-			const float lengthCV = clamp(inputs[LENGTH_CV_INPUT].getVoltage() / 10.f, -1.f, +1.f) * params[LENGTH_CV_PARAM].getValue();
-			// actual length is knob value plus CV (adds)
-			currentParams.length = std::round(clamp(params[LENGTH_PARAM].getValue() + lengthCV * 31, 1.f, 32.f));
-
+			const float lengthCV = KlasmataCore::scaledCV(inputs[LENGTH_CV_INPUT].getVoltage(), params[LENGTH_CV_PARAM].getValue());
 			// value between -1 and 1
-			const float fillCV = clamp(inputs[DENSITY_CV_INPUT].getVoltage() / 10.f, -1.f, +1.f) * params[DENSITY_CV_PARAM].getValue();
-			// knob + CV gives a density in range [0, 1]
-			const float density = clamp(fillCV + params[DENSITY_PARAM].getValue(), 0.f, 1.0f);
-			// fill is then the this fraction of length
-			currentParams.fill = paramToFill(density, currentParams.length);
-
-			currentParams.start = paramToOffset(params[OFFSET_PARAM].getValue(), currentParams.length);
-			currentParams.mode = static_cast<SequenceMode>(params[SWITCH_PARAM].getValue());
-		}
-
-		// update params of sequence (if changed)
-		if (currentParams.length != oldParams.length || currentParams.fill != oldParams.fill) {
-			seq.calculate(currentParams.length, currentParams.fill);
-		}
-		if (currentParams.start != oldParams.start) {
-			seq.rotate(currentParams.start);
+			const float fillCV = KlasmataCore::scaledCV(inputs[DENSITY_CV_INPUT].getVoltage(), params[DENSITY_CV_PARAM].getValue());
+
+			// knob + CV gives a length in range [1, 32] and a density in range [0, 1]
+			core.setParams(params[LENGTH_PARAM].getValue() + lengthCV * 31,
+			               params[DENSITY_PARAM].getValue() + fillCV,
+			               params[OFFSET_PARAM].getValue(),
+			               static_cast<SequenceMode>(params[SWITCH_PARAM].getValue()));
+			// CV of +/-10V adds +/-100% to the menu setting
+			Module* expander = rightExpander.module;
+			const bool expanded = expander && expander->model == modelStoicheiaExpander;
+			const float probCV = expanded ? static_cast<const StoicheiaChainParams*>(rightExpander.consumerMessage)->probCV[0] : 0.f;
+			core.setProbability(params[PROB_PARAM].getValue() + probCV / 10.f);
 		}
 
+		PROFILE_PHASE("core");
 		const float in = inputs[CLOCK_INPUT].getVoltage();
-		if (clockTrigger.process(rescale(in, 0.1f, 2.f, 0.f, 1.f))) {
-			bool newState = seq.next();
-			if (newState != state) {
-				stateAlternating = !stateAlternating;
-			}
-			state = newState;
-		}
+		core.process(in, inputs[RESET_INPUT].getVoltage());
 
-		float out = 0.f;
-		if (currentParams.mode == NORMAL) {
-			out = state * in;
-		}
-		else if (currentParams.mode == LATCHED) {
-			out = stateAlternating * 10.f;
+		PROFILE_PHASE("outputs");
+		outputs[OUT_OUTPUT].setVoltage(core.out);
+
+		if (patternPublisher.pattern.set(0, core.seq)) {
+			patternPublisher.publish();
 		}
-		else {
-			out = 0.f;
+
+		PROFILE_PHASE("lights");
+		lightDivider.accumulate(OUT_LIGHT, core.out / 10.f);
+		lightDivider.accumulate(IN_LIGHT, in / 10.f);
+		if (lightDivider.process()) {
+			lightDivider.setBrightness(lights[OUT_LIGHT], OUT_LIGHT);
+			lightDivider.setBrightness(lights[IN_LIGHT], IN_LIGHT);
 		}
 
-		outputs[OUT_OUTPUT].setVoltage(out);
-		lights[OUT_LIGHT].setBrightness(out / 10.f);
-		lights[IN_LIGHT].setBrightness(in / 10.f);
-		oldParams = currentParams;
+		if (idleDetector.update(this, true, args.sampleTime)) {
+			lightDivider.reset();
+		}
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
 		json_t* themeJ = json_object_get(rootJ, "theme");
 		if (themeJ) {
 			theme = (ModuleTheme) json_integer_value(themeJ);
 		}
+		randomStateFromJson(json_object_get(rootJ, "random"), core.random);
+		json_t* patternBankJ = json_object_get(rootJ, "patternBank");
+		if (json_is_string(patternBankJ)) {
+			std::string error;
+			if (!loadBank(json_string_value(patternBankJ), &error)) {
+				WARN("Klasmata pattern bank not loaded, %s", error.c_str());
+			}
+		}
 	}
 
 	json_t* dataToJson() override {
 		json_t* rootJ = json_object();
 		json_object_set_new(rootJ, "theme", json_integer(theme));
+		json_object_set_new(rootJ, "random", randomStateToJson(core.random));
+		if (!bankPath.empty()) {
+			json_object_set_new(rootJ, "patternBank", json_string(bankPath.c_str()));
+		}
 
+		edgeCapture.toJson(rootJ);
 		return rootJ;
 	}
 };
@@ -247,6 +291,19 @@ struct KlasmataWidget : RebelTechModuleWidget {
 
 		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(22.715, 70.625)), module, Klasmata::OUT_LIGHT));
 		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(22.715, 108.725)), module, Klasmata::IN_LIGHT));
+
+		PatternDisplay* display = createWidget<PatternDisplay>(mm2px(Vec(25.0, 21.0)));
+		display->setSize(mm2px(Vec(13.0, 13.0)));
+		if (module) {
+			display->buffer = &module->patternPublisher.buffer;
+		}
+		else {
+			Sequence<uint32_t> preview;
+			preview.offset = 0;
+			preview.calculate(16, 5);
+			display->snapshot.set(0, preview);
+		}
+		addChild(display);
 	}
 
 	void draw(const DrawArgs& args) override {
@@ -257,10 +314,44 @@ struct KlasmataWidget : RebelTechModuleWidget {
 	}
 
 
+	static void loadBankDialog(Klasmata* module) {
+		const std::string dir = module->bankPath.empty() ? asset::plugin(pluginInstance, "res/banks") : system::getDirectory(module->bankPath);
+		osdialog_filters* filters = osdialog_filters_parse("Pattern bank (.rtpb):rtpb");
+		char* path = osdialog_file(OSDIALOG_OPEN, dir.c_str(), NULL, filters);
+		osdialog_filters_free(filters);
+		if (!path) {
+			return;
+		}
+		std::string error;
+		if (!module->loadBank(path, &error)) {
+			osdialog_message(OSDIALOG_WARNING, OSDIALOG_OK, ("Could not load pattern bank " + error).c_str());
+		}
+		std::free(path);
+	}
+
 	void appendContextMenu(Menu* menu) override {
 		Klasmata* module = dynamic_cast<Klasmata*>(this->module);
 		assert(module);
 
+		const PatternBank* bank = module->bank.load();
+		const std::string bankInfo = bank ? system::getFilename(bank->path()) + " (" + std::to_string(bank->size()) + ")" : "";
+		menu->addChild(createMenuItem("Load pattern bank...", bankInfo, [=]() {
+			loadBankDialog(module);
+		}));
+		if (bank) {
+			menu->addChild(createMenuItem("Unload pattern bank", "", [=]() {
+				module->loadBank("");
+			}));
+		}
+		menu->addChild(createSubmenuItem("Probability", "", [=](Menu* menu) {
+			ui::Slider* slider = new ui::Slider();
+			slider->quantity = module->getParamQuantity(Klasmata::PROB_PARAM);
+			slider->box.size.x = 200.f;
+			menu->addChild(slider);
+		}));
+		addMidiExportMenuItem(menu, module->coreCopy, "Klasmata", &MidiExport::render);
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
 		addThemeMenuItems(menu, &module->theme);
 	}
 };
@@ -0,0 +1,163 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include "Sequence.h"
+#include "ClockTrigger.h"
+#include "Random.h"
+#include "PatternBank.h"
+#include "CacheAligned.h"
+#include "Profiler.h"
+
+// Rack-independent DSP for Klasmata, used by both the module (Klasmata.cpp) and the offline
+// tools (see tools/)
+
+struct alignas(cacheLineSize) KlasmataCore {
+
+	enum SequenceMode {
+		LATCHED,
+		NORMAL,
+		MUTE
+	};
+
+	struct SequenceParams {
+		int length = -1;
+		int fill = -1;
+		int start = -1;
+		// index into the pattern bank, -1 for a calculated (Euclidean) pattern
+		int pattern = -1;
+		SequenceMode mode;
+	};
+
+	// output voltage
+	float out = 0.f;
+
+	// uint32_t for 32 steps
+	Sequence<uint32_t> seq;
+	SequenceParams oldParams, currentParams;
+	ClockTrigger clockTrigger;
+	ClockTrigger resetTrigger;
+	bool state = false, stateAlternating = false;
+	// each hit of the pattern fires with this probability, drawn from random (only on hits)
+	float probability = 1.f;
+	Xoshiro128Plus random;
+	// pattern bank mode if set (see setBank())
+	const PatternBank* bank = nullptr;
+
+	// the per-sample work is done by a kernel specialised at compile time on the mode, which
+	// is only re-selected when the mode switch changes
+	typedef void (KlasmataCore::*Kernel)(float in);
+	Kernel kernel = nullptr;
+	SequenceMode kernelMode = NORMAL;
+
+	KlasmataCore() {
+		seq.offset = 0;
+		seq.calculate(12, 8);
+
+		selectKernel(kernelMode);
+	}
+
+	// value between -1 and 1, from CV input (-10V to +10V) and attenuator (0 - 1)
+	static float scaledCV(float cv, float attenuator) {
+		return std::min(std::max(cv / 10.f, -1.f), +1.f) * attenuator;
+	}
+
+	// in pattern bank mode length and density select a pattern from the bank, rather than
+	// calculating one: length steps through the bank in 32 equal pages, density within a page.
+	// Patterns are only read when the selection changes. nullptr leaves pattern bank mode.
+	void setBank(const PatternBank* newBank) {
+		bank = newBank;
+		currentParams = oldParams = SequenceParams();
+	}
+
+	// position (0 - 1) through the bank for a length (1 - 32) and density (0 - 1)
+	static float bankPosition(float length, float density) {
+		return (std::min(std::max(length, 1.f), 32.f) - 1.f + std::min(std::max(density, 0.f), 1.f)) / 32.f;
+	}
+
+	// length (1 - 32) and density (0 - 1) include CV, see scaledCV()
+	void setParams(float length, float density, float offset, SequenceMode mode) {
+		if (bank) {
+			const int pattern = bank->indexAt(bankPosition(length, density));
+			if (pattern != currentParams.pattern) {
+				currentParams.pattern = pattern;
+				currentParams.length = bank->get(pattern).length;
+			}
+			currentParams.start = std::round((currentParams.length - 1) * offset);
+			currentParams.mode = mode;
+			return;
+		}
+		// actual length is knob value plus CV (adds)
+		currentParams.length = std::round(std::min(std::max(length, 1.f), 32.f));
+		// fill is then the this fraction of length
+		currentParams.fill = 1 + std::round((currentParams.length - 1) * std::min(std::max(density, 0.f), 1.f));
+		currentParams.start = std::round((currentParams.length - 1) * offset);
+		currentParams.mode = mode;
+	}
+
+	// range 0 - 1, includes CV
+	void setProbability(float p) {
+		probability = std::min(std::max(p, 0.f), 1.f);
+	}
+
+	void process(float in, float resetIn) {
+		PROFILE_ZONE("KlasmataCore");
+
+		PROFILE_PHASE("reset");
+		if (resetTrigger.process(resetIn, 0.1f, 2.f)) {
+			seq.reset();
+		}
+
+		// update params of sequence (if changed)
+		PROFILE_PHASE("sequence");
+		if (currentParams.pattern >= 0) {
+			if (currentParams.pattern != oldParams.pattern) {
+				const BankPattern pattern = bank->get(currentParams.pattern);
+				seq.bits = pattern.bits;
+				seq.length = pattern.length;
+			}
+		}
+		else if (currentParams.length != oldParams.length || currentParams.fill != oldParams.fill) {
+			seq.calculate(currentParams.length, currentParams.fill);
+		}
+		if (currentParams.start != oldParams.start) {
+			seq.rotate(currentParams.start);
+		}
+
+		if (currentParams.mode != kernelMode) {
+			selectKernel(currentParams.mode);
+		}
+
+		PROFILE_PHASE("clock");
+		(this->*kernel)(in);
+
+		oldParams = currentParams;
+	}
+
+	void selectKernel(SequenceMode mode) {
+		kernelMode = mode;
+		switch (mode) {
+			case LATCHED: kernel = &KlasmataCore::kernelFor<LATCHED>; break;
+			case MUTE: kernel = &KlasmataCore::kernelFor<MUTE>; break;
+			case NORMAL:
+			default: kernel = &KlasmataCore::kernelFor<NORMAL>; break;
+		}
+	}
+
+	template <SequenceMode MODE>
+	void kernelFor(float in) {
+		if (clockTrigger.process(in, 0.1f, 2.f)) {
+			const bool newState = seq.next() && random.chance(probability);
+			if (newState != state) {
+				stateAlternating = !stateAlternating;
+			}
+			state = newState;
+		}
+
+		switch (MODE) {
+			case NORMAL: out = state * in; break;
+			case LATCHED: out = stateAlternating * 10.f; break;
+			case MUTE:
+			default: out = 0.f; break;
+		}
+	}
+};
@@ -1,193 +1,9 @@
 #include "plugin.hpp"
+#include "LogoiCore.h"
 
 
 
-struct Logoi : Module {
-
-	// derived from https://github.com/pingdynasty/ClockDelay/blob/master/ClockDelay.cpp
-	class ClockCounter {
-	public:
-		inline void reset() {
-			pos = 0;
-			off();
-		}
-		bool next() {
-			if (++pos > value) {
-				pos = 0;
-				return true;
-			}
-			return false;
-		}
-
-		uint8_t pos = 0;
-		uint8_t value = 0;
-
-		void rise() {
-			if (next())
-				on();
-			else
-				off();
-		}
-		inline void fall() {
-			off();
-		}
-		virtual bool isOff() {
-			return delayOutput->getVoltage() == 0;
-		}
-		virtual void on() {
-			delayOutput->setVoltage(10.f);
-		}
-		virtual void off() {
-			delayOutput->setVoltage(0.f);
-		}
-		void setOutput(Output* delayOutput_) {
-			delayOutput = delayOutput_;
-		}
-	private:
-		Output* delayOutput;
-	};
-
-
-	class ClockDivider {
-	public:
-		inline void reset() {
-			pos = 0;
-			toggled = false;
-			off();
-		}
-		bool next() {
-			if (++pos > value) {
-				pos = 0;
-				return true;
-			}
-			return false;
-		}
-
-		uint8_t pos = 0;
-		int8_t value = 0;
-		bool toggled = false;
-		inline bool isOff() {
-			return dividedOutput->getVoltage() == 0;
-		}
-		void rise() {
-			if (next()) {
-				toggle();
-				toggled = true;
-			}
-		}
-		void fall() {
-			if (value == -1)
-				off();
-		}
-		void toggle() {
-			bool state = (bool) dividedOutput->getVoltage();
-			dividedOutput->setVoltage(10.f * !state);
-		}
-		void on() {
-			dividedOutput->setVoltage(10.f);
-		}
-		void off() {
-			dividedOutput->setVoltage(0.f);
-		}
-		void setOutput(Output* dividedOutput_) {
-			dividedOutput = dividedOutput_;
-		}
-	private:
-		Output* dividedOutput;
-	};
-
-	class ClockDelay {
-	public:
-		uint16_t riseMark = 0;
-		uint16_t fallMark = 0;
-		uint16_t value = 0; 	// number of (pseudo) clock ticks until rise should happen
-		uint16_t pos = 0;
-		bool running = false;
-		inline void start() {
-			pos = 0;
-			fallMark = 0;
-			running = true;
-		}
-		inline void stop() {
-			running = false;
-		}
-		inline void reset() {
-			stop();
-			off();
-		}
-		inline void rise() {
-			riseMark = value;
-			start();
-		}
-		inline void fall() {
-			fallMark = riseMark + pos;
-		}
-		inline void clock() {
-			if (running) {
-				if (++pos == riseMark) {
-					on();
-				}
-				else if (pos == fallMark) {
-					off();
-					stop(); // one-shot
-				}
-			}
-		}
-		virtual void on() {
-			delayOutput->setVoltage(10.f);
-		}
-		virtual void off() {
-			delayOutput->setVoltage(0.f);
-		}
-		virtual bool isOff() {
-			return delayOutput->getVoltage() == 0;
-		}
-		void setOutput(Output* delayOutput_) {
-			delayOutput = delayOutput_;
-		}
-	private:
-		Output* delayOutput;
-	};
-
-	class ClockSwing : public ClockDelay {
-	public:
-		void on() override {
-			combinedOutput->setVoltage(10.f);
-		}
-		void off() override {
-			combinedOutput->setVoltage(0.f);
-		}
-		bool isOff() override {
-			return combinedOutput->getVoltage() == 0;
-		}
-		void setOutputs(Output* delayOutput_, Output* combinedOutput_) {
-			ClockDelay::setOutput(delayOutput_);
-			combinedOutput = combinedOutput_;
-		}
-	private:
-		Output* combinedOutput;
-	};
-
-	class DividingCounter : public ClockCounter {
-	public:
-		void setOutputs(Output* delayOutput_, Output* combinedOutput_) {
-			ClockCounter::setOutput(delayOutput_);
-			combinedOutput = combinedOutput_;
-		}
-		void on() override {
-			combinedOutput->setVoltage(10.f);
-
-		}
-		void off() override {
-			combinedOutput->setVoltage(0.f);
-		}
-		bool isOff() override {
-			return combinedOutput->getVoltage() == 0;
-		}
-	private:
-		Output* combinedOutput;
-	};
-	// end of imported/modifed hardware code
+struct Logoi : Module, CacheAligned {
 
 	enum ParamId {
 		DIVISION_PARAM,
@@ -209,6 +25,7 @@ struct Logoi : Module {
 		ADDITION_DELAY_OUTPUT,
 		COMBINED_OUTPUT,
 		CLOCK_THRU_OUTPUT,
+		POSITION_OUTPUT,
 		OUTPUTS_LEN
 	};
 	enum LightId {
@@ -219,46 +36,20 @@ struct Logoi : Module {
 	};
 
 	ModuleTheme theme = LIGHT_THEME;
+	int lastMode = -1;
 
-
-	dsp::SchmittTrigger clockDetector, resetDetector;
-	dsp::BooleanTrigger fallDetector;
-
-	dsp::PulseGenerator pulseGenerator;
-	dsp::Timer delayTimer;
-	bool delaying = false;
-
-
-	dsp::ClockDivider updateClocksController; 	// used to update delay counters every N samples
-	const int updateClocksFrequency = 64;		// number of samples to wait between updates (N)
-
-	ClockDivider divider;	// standard clock divider, powers left hand side
-	ClockCounter counter;	// clock counter, powers right hand side (when in count mode)
-	ClockDelay delay; 		// clock delay, powers right hand side (when in delay mode)
-
-	DividingCounter divcounter;		// used to combine left+right (when right in count mode)
-	ClockSwing swinger;				// used to combine left+right (when right in delay mode)
-	static constexpr float maxDelayTime = 1.f;
-
-	enum OperatingMode {
-		COUNT_MODE,
-		DELAY_MODE,
-		DISABLED_MODE
-	};
-
-	void reset() {
-		divider.reset();
-		counter.reset();
-		divcounter.reset();
-		delay.reset();
-		swinger.reset();
-	}
+	LogoiCore core;
+	// skips processing while nothing is patched and no delayed pulse is pending
+	IdleDetector idleDetector{PARAMS_LEN};
+	LightDivider<LIGHTS_LEN> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
 
 	struct DividerParam : ParamQuantity {
 		std::string getDisplayValueString() override {
 			if (module != nullptr) {
 				if (paramId == DIVISION_PARAM) {
-					int divisionForLabel = divisionFromParamUser(getValue());
+					int divisionForLabel = LogoiCore::divisionFromParamUser(getValue(), static_cast<Logoi*>(module)->core.range);
 					return std::to_string(divisionForLabel);
 				}
 				else {
@@ -275,7 +66,7 @@ struct Logoi : Module {
 			float division = std::atof(s.c_str());
 			if (module != nullptr) {
 				if (paramId == DIVISION_PARAM) {
-					ParamQuantity::setValue(paramFromDivisionUser(division));
+					ParamQuantity::setValue(LogoiCore::paramFromDivisionUser(division, static_cast<Logoi*>(module)->core.range));
 				}
 				else {
 					assert(false);
@@ -285,13 +76,45 @@ struct Logoi : Module {
 	};
 
 	struct CountOrDelayParam : ParamQuantity {
+		bool isSynced() {
+			return static_cast<Logoi*>(module)->core.delaySync == LogoiCore::SYNCED_DELAY;
+		}
+		std::string syncedDelayString() {
+			const LogoiCore::Fraction bars = LogoiCore::syncedDelays()[LogoiCore::syncedDelayFromParamInternal(getValue())];
+			if (bars.den == 1) {
+				return string::f("%d bar%s", bars.num, (bars.num == 1) ? "" : "s");
+			}
+			return string::f("%d/%d bar", bars.num, bars.den);
+		}
+		// nearest tempo-synced delay to a number of bars, typed as e.g. 3/16 or 2
+		void setSyncedDelayString(std::string s) {
+			int num, den;
+			float bars = std::atof(s.c_str());
+			if (std::sscanf(s.c_str(), "%d/%d", &num, &den) == 2 && den > 0) {
+				bars = (float) num / den;
+			}
+			int nearest = 0;
+			for (int i = 1; i < LogoiCore::numSyncedDelays; ++i) {
+				const LogoiCore::Fraction f = LogoiCore::syncedDelays()[i];
+				const LogoiCore::Fraction best = LogoiCore::syncedDelays()[nearest];
+				if (std::fabs((float) f.num / f.den - bars) < std::fabs((float) best.num / best.den - bars)) {
+					nearest = i;
+				}
+			}
+			ParamQuantity::setValue(LogoiCore::paramFromSyncedDelayIndex(nearest));
+		}
+
 		std::string getDisplayValueString() override {
 			if (module != nullptr) {
 				if (paramId == COUNT_OR_DELAY_PARAM) {
 					const int mode = module->params[MODE_PARAM].getValue();
 					switch (mode) {
-						case DELAY_MODE: return std::to_string(delayFromParamUser(getValue())) + " ms";
-						case COUNT_MODE: return std::to_string(countFromParamUser(getValue()));
+						case LogoiCore::DELAY_MODE:
+							if (isSynced()) {
+								return syncedDelayString();
+							}
+							return std::to_string(LogoiCore::delayFromParamUser(getValue())) + " ms";
+						case LogoiCore::COUNT_MODE: return std::to_string(LogoiCore::countFromParamUser(getValue(), static_cast<Logoi*>(module)->core.range));
 						default: return "Not in use";
 					}
 				}
@@ -311,8 +134,15 @@ struct Logoi : Module {
 				if (paramId == COUNT_OR_DELAY_PARAM) {
 					const int mode = module->params[MODE_PARAM].getValue();
 					switch (mode) {
-						case DELAY_MODE: ParamQuantity::setValue(paramFromDelayUser(value)); break;
-						case COUNT_MODE: ParamQuantity::setValue(paramFromCountUser(value)); break;
+						case LogoiCore::DELAY_MODE:
+							if (isSynced()) {
+								setSyncedDelayString(s);
+							}
+							else {
+								ParamQuantity::setValue(LogoiCore::paramFromDelayUser(value));
+							}
+							break;
+						case LogoiCore::COUNT_MODE: ParamQuantity::setValue(LogoiCore::paramFromCountUser(value, static_cast<Logoi*>(module)->core.range)); break;
 						default: ParamQuantity::setValue(value);
 					}
 				}
@@ -341,192 +171,124 @@ struct Logoi : Module {
 		configOutput(ADDITION_DELAY_OUTPUT, "Counter/Delay");
 		configOutput(COMBINED_OUTPUT, "Combined Output");
 		configOutput(CLOCK_THRU_OUTPUT, "Clock thru");
-
-		// individual processors
-		divider.setOutput(&outputs[DIVISION_OUTPUT]); 			// left side, clock divider
-		counter.setOutput(&outputs[ADDITION_DELAY_OUTPUT]);		// right side, mode COUNT (switch down)
-		delay.setOutput(&outputs[ADDITION_DELAY_OUTPUT]);		// right side, mode DELAY (switch middle)
-
-		// combined processors: COUNT mode
-		divcounter.setOutputs(&outputs[ADDITION_DELAY_OUTPUT], &outputs[COMBINED_OUTPUT]);
-		// combined processors: DELAY mode
-		swinger.setOutputs(&outputs[ADDITION_DELAY_OUTPUT], &outputs[COMBINED_OUTPUT]);
-
-		reset();
-
-		updateClocksController.setDivision(updateClocksFrequency);
+		configOutput(POSITION_OUTPUT, "Divider/counter position (stepped CV)");
 
 		theme = loadDefaultTheme();
 	}
 
-	// given VCV param in range 0 - 1, convert to the expected division (for the algorithm)
-	static int8_t divisionFromParamInternal(float paramValue) {
-		return (paramValue < 1. / 64.f) ? -1 : (int)(paramValue * 31.f);
-	}
-	// given VCV param in range 0 - 1, convert to the expected division (in a form meaningful for the user)
-	static int8_t divisionFromParamUser(float paramValue) {
-		const int8_t divisionInternal = divisionFromParamInternal(paramValue);
-		return divisionInternal == -1 ? 1 : (2 * (1 + divisionInternal));
-	}
-	// given a clock division from the user, convert to the param value (0 - 1)
-	static float paramFromDivisionUser(int division) {
-		int divisionInternal = (division == 1) ? -1 : (division / 2 - 1);
-		return rescale(clamp(divisionInternal, -1, 31), -1.f, 31.f, 0.f, 1.f);
-	}
-
-	// given VCV param in range 0 - 1, convert to the expected count (for the algorithm)
-	static int8_t countFromParamInternal(float paramValue) {
-		return std::round(31 * paramValue);
-	}
-	// given VCV param in range 0 - 1, convert to the expected count (for the algorithm)
-	static int8_t countFromParamUser(float paramValue) {
-		return 1 + countFromParamInternal(paramValue);
-	}
-
-	// given VCV param in range 0 - 1, convert to the expected count (for right hand side)
-	static float paramFromCountUser(float count) {
-		count = clamp(count, 1.f, 32.f);
-		return clamp((count - 1) / 31.f, 0.f, 1.f);
-	}
-
-	static float delayFromParamUser(float paramValue) {
-		return maxDelayTime * 1000.f * paramValue;
-	}
-
-	static float paramFromDelayUser(float delay) {
-		return delay / (maxDelayTime * 1000.f);
-	}
-
-
-	// given VCV param in range 0 - 1, convert to the expected delay (for the algorithm)
-	uint16_t delayFromParamInternal(float paramValue) {
-		// max Rack sample rate is 768kHz - with updateClocksFrequency == 64, which means we ping the clocks,
-		// delay.clock() and swinger.clock() every 64 samples, the largest reasonable value
-		// of maxClockTicks is 12000. Tick counter of type uint16_t [0, +65535] shouldn't overflow.
-		const float maxClockTicks = (maxDelayTime / APP->engine->getSampleTime()) / updateClocksFrequency;
-
-		return 1 + std::round(maxClockTicks * paramValue);
-	}
-
 	void processBypass(const ProcessArgs& args) override {
-		clockDetector.process(inputs[CLOCK_INPUT].getVoltage());
-		outputs[DIVISION_OUTPUT].setVoltage(clockDetector.isHigh() * 10.f);
-		outputs[ADDITION_DELAY_OUTPUT].setVoltage(clockDetector.isHigh() * 10.f);
-		outputs[COMBINED_OUTPUT].setVoltage(clockDetector.isHigh() * 10.f);
-		outputs[CLOCK_THRU_OUTPUT].setVoltage(clockDetector.isHigh() * 10.f);
+		core.clockDetector.process(inputs[CLOCK_INPUT].getVoltage());
+		outputs[DIVISION_OUTPUT].setVoltage(core.clockDetector.isHigh() * 10.f);
+		outputs[ADDITION_DELAY_OUTPUT].setVoltage(core.clockDetector.isHigh() * 10.f);
+		outputs[COMBINED_OUTPUT].setVoltage(core.clockDetector.isHigh() * 10.f);
+		outputs[CLOCK_THRU_OUTPUT].setVoltage(core.clockDetector.isHigh() * 10.f);
 	}
 
 	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("Logoi");
 
-		// process LHS knobs
-		{
-			// input CV in range -10V to +10V
-			const float scaledDivisionCV = clamp(params[DIVISION_CV_PARAM].getValue() * inputs[DIVISION_CV_INPUT].getVoltage(), -10.f, +10.f);
-			// CV sums with knob, where +10V is equivalent to full clockwise knob turn
-			const float divisionWithCV = clamp(params[DIVISION_PARAM].getValue() + scaledDivisionCV / 10.f, 0.f, 1.f);
-			divider.value = divisionFromParamInternal(divisionWithCV);
-		}
-		// process RHS knobs
-		{
-			// input CV in range -10V to +10V
-			const float scaledCountDelayCV = clamp(params[COUNT_OR_DELAY_CV_PARAM].getValue() * inputs[COUNT_OR_DELAY_CV_INPUT].getVoltage(), -10.f, +10.f);
-			// CV sums with knob, where +10V is equivalent to full clockwise knob turn
-			const float countDelayWithCV = clamp(params[COUNT_OR_DELAY_PARAM].getValue() + scaledCountDelayCV / 10.f, 0.f, 1.f);
-			// mode RHS modes infer params from the same source(s)
-			divcounter.value = counter.value = countFromParamInternal(countDelayWithCV);
-			delay.value = swinger.value = delayFromParamInternal(countDelayWithCV);
+		edgeCapture.process(this, args);
+		if (idleDetector.process(this)) {
+			return;
 		}
+		core.skip(idleDetector.takeSkippedFrames());
 
-		if (resetDetector.process(inputs[RESET_INPUT].getVoltage())) {
-			reset();
-		}
+		PROFILE_PHASE("params");
+		// process LHS knobs
+		core.setDivision(LogoiCore::paramWithCV(params[DIVISION_PARAM].getValue(),
+		                                        params[DIVISION_CV_PARAM].getValue(), inputs[DIVISION_CV_INPUT].getVoltage()));
+		// process RHS knobs
+		core.setCountOrDelay(LogoiCore::paramWithCV(params[COUNT_OR_DELAY_PARAM].getValue(),
+		                                            params[COUNT_OR_DELAY_CV_PARAM].getValue(), inputs[COUNT_OR_DELAY_CV_INPUT].getVoltage()),
+		                     args.sampleTime);
 
 		const int mode = (int) params[MODE_PARAM].getValue();
-
-		// do every N ticks (set by updateClocksFrequency)
-		if (updateClocksController.process()) {
-			delay.clock();
-			swinger.clock();
-
+		if (mode != lastMode) {
 			switch (mode) {
-				case DELAY_MODE: getParamQuantity(COUNT_OR_DELAY_PARAM)->name = "Delay"; break;
-				case COUNT_MODE: getParamQuantity(COUNT_OR_DELAY_PARAM)->name = "Count"; break;
-				case DISABLED_MODE: getParamQuantity(COUNT_OR_DELAY_PARAM)->name = "Off"; break;
+				case LogoiCore::DELAY_MODE: getParamQuantity(COUNT_OR_DELAY_PARAM)->name = "Delay"; break;
+				case LogoiCore::COUNT_MODE: getParamQuantity(COUNT_OR_DELAY_PARAM)->name = "Count"; break;
+				case LogoiCore::DISABLED_MODE: getParamQuantity(COUNT_OR_DELAY_PARAM)->name = "Off"; break;
 			}
+			lastMode = mode;
 		}
 
-		// Schmitt trigger on incoming clock
-		const bool rising = clockDetector.process(inputs[CLOCK_INPUT].getVoltage());
-		// returns true when previous clock state was high and next is low
-		const bool falling = fallDetector.process(!clockDetector.isHigh());
-		// and forward the clock to the thru output
-		outputs[CLOCK_THRU_OUTPUT].setVoltage(clockDetector.isHigh() * 10.f);
+		PROFILE_PHASE("core");
+		core.process(inputs[CLOCK_INPUT].getVoltage(), inputs[RESET_INPUT].getVoltage(), mode);
 
-		if (rising) {
-			divider.rise();
-			switch (mode) {
-				case DELAY_MODE: {
-					delay.rise();
-					if (divider.toggled) {
-						swinger.rise();
-					}
-					else {
-						outputs[COMBINED_OUTPUT].setVoltage(10.f);
-						// COMBINED_OUTPUT_PORT &= ~_BV(COMBINED_OUTPUT_PIN); // pass through clock
-						// CLOCKDELAY_LEDS_PORT |= _BV(CLOCKDELAY_LED_1_PIN);
-					}
-					break;
-				}
-				case COUNT_MODE: {
-					counter.rise();
-					if (divider.toggled) {
-						divcounter.rise();
-						if (!divcounter.isOff())
-							divider.toggled = false;
-					}
-					break;
-				}
-			}
-		}
-		else if (falling) {
-			switch (mode) {
-				case DELAY_MODE: {
-					delay.fall();
-					if (divider.toggled) {
-						swinger.fall();
-						divider.toggled = false;
-					}
-					else {
-						outputs[COMBINED_OUTPUT].setVoltage(0.f);
-						// COMBINED_OUTPUT_PORT |= _BV(COMBINED_OUTPUT_PIN); // pass through clock
-						// CLOCKDELAY_LEDS_PORT &= ~_BV(CLOCKDELAY_LED_1_PIN);
-					}
-					break;
-				}
-				case COUNT_MODE: {
-					counter.fall();
-					divcounter.fall();
-					break;
-				}
-			}
-			divider.fall();
+		PROFILE_PHASE("outputs");
+		outputs[DIVISION_OUTPUT].setVoltage(core.divisionOutput);
+		outputs[ADDITION_DELAY_OUTPUT].setVoltage(core.countOrDelayOutput);
+		outputs[COMBINED_OUTPUT].setVoltage(core.combinedOutput);
+		outputs[CLOCK_THRU_OUTPUT].setVoltage(core.clockThruOutput);
+		if (outputs[POSITION_OUTPUT].isConnected()) {
+			processPosition(mode);
 		}
 
-		if (mode == DISABLED_MODE) {
-			outputs[DIVISION_OUTPUT].setVoltage(0.f);
-			outputs[ADDITION_DELAY_OUTPUT].setVoltage(0.f);
-			outputs[COMBINED_OUTPUT].setVoltage(0.f);
+		// do lights (just mirror output voltages)
+		PROFILE_PHASE("lights");
+		lightDivider.accumulate(DIVISION_LIGHT, (bool) core.divisionOutput);
+		lightDivider.accumulate(COMBINED_LIGHT, (bool) core.combinedOutput);
+		lightDivider.accumulate(COUNT_OR_DELAY_LIGHT, (bool) core.countOrDelayOutput);
+		if (lightDivider.process()) {
+			lightDivider.setBrightnessSmooth(lights[DIVISION_LIGHT], DIVISION_LIGHT, args.sampleTime);
+			lightDivider.setBrightnessSmooth(lights[COMBINED_LIGHT], COMBINED_LIGHT, args.sampleTime);
+			lightDivider.setBrightnessSmooth(lights[COUNT_OR_DELAY_LIGHT], COUNT_OR_DELAY_LIGHT, args.sampleTime);
+		}
+
+		if (idleDetector.update(this, core.isQuiescent(), args.sampleTime)) {
+			// finish any fades now, as lights won't be updated while idle
+			lightDivider.reset();
+			lights[DIVISION_LIGHT].setBrightness((bool) core.divisionOutput);
+			lights[COMBINED_LIGHT].setBrightness((bool) core.combinedOutput);
+			lights[COUNT_OR_DELAY_LIGHT].setBrightness((bool) core.countOrDelayOutput);
 		}
+	}
 
-		// do lights (just mirror output voltages)
-		{
-			lights[DIVISION_LIGHT].setBrightnessSmooth((bool) outputs[DIVISION_OUTPUT].getVoltage(), args.sampleTime);
-			lights[COMBINED_LIGHT].setBrightnessSmooth((bool) outputs[COMBINED_OUTPUT].getVoltage(), args.sampleTime);
-			lights[COUNT_OR_DELAY_LIGHT].setBrightnessSmooth((bool) outputs[ADDITION_DELAY_OUTPUT].getVoltage(), args.sampleTime);
+	void processPosition(int mode) {
+		float divider = 0.f, counter = 0.f;
+		if (mode != LogoiCore::DISABLED_MODE) {
+			divider = LogoiCore::positionVoltage(core.dividerStep(), core.dividerSteps(), core.positionScale);
+			// the counter only runs in count mode
+			if (mode == LogoiCore::COUNT_MODE) {
+				counter = LogoiCore::positionVoltage(core.counterStep(), core.counterSteps(), core.positionScale);
+			}
+		}
+		switch (core.positionSource) {
+			case LogoiCore::POSITION_COUNTER:
+				outputs[POSITION_OUTPUT].setVoltage(counter);
+				outputs[POSITION_OUTPUT].setChannels(1);
+				break;
+			case LogoiCore::POSITION_BOTH:
+				outputs[POSITION_OUTPUT].setVoltage(divider, 0);
+				outputs[POSITION_OUTPUT].setVoltage(counter, 1);
+				outputs[POSITION_OUTPUT].setChannels(2);
+				break;
+			case LogoiCore::POSITION_DIVIDER:
+			default:
+				outputs[POSITION_OUTPUT].setVoltage(divider);
+				outputs[POSITION_OUTPUT].setChannels(1);
+				break;
 		}
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
+		json_t* rangeJ = json_object_get(rootJ, "range");
+		if (rangeJ) {
+			core.range = (LogoiCore::Range) json_integer_value(rangeJ);
+		}
+		json_t* positionSourceJ = json_object_get(rootJ, "positionSource");
+		if (positionSourceJ) {
+			core.positionSource = (LogoiCore::PositionSource) json_integer_value(positionSourceJ);
+		}
+		json_t* positionScaleJ = json_object_get(rootJ, "positionScale");
+		if (positionScaleJ) {
+			core.positionScale = (LogoiCore::PositionScale) json_integer_value(positionScaleJ);
+		}
+		json_t* delaySyncJ = json_object_get(rootJ, "delaySync");
+		if (delaySyncJ) {
+			core.delaySync = (LogoiCore::DelaySync) json_integer_value(delaySyncJ);
+		}
 		json_t* themeJ = json_object_get(rootJ, "theme");
 		if (themeJ) {
 			theme = (ModuleTheme) json_integer_value(themeJ);
@@ -536,7 +298,12 @@ struct Logoi : Module {
 	json_t* dataToJson() override {
 		json_t* rootJ = json_object();
 		json_object_set_new(rootJ, "theme", json_integer(theme));
+		json_object_set_new(rootJ, "delaySync", json_integer(core.delaySync));
+		json_object_set_new(rootJ, "range", json_integer(core.range));
+		json_object_set_new(rootJ, "positionSource", json_integer(core.positionSource));
+		json_object_set_new(rootJ, "positionScale", json_integer(core.positionScale));
 
+		edgeCapture.toJson(rootJ);
 		return rootJ;
 	}
 };
@@ -572,6 +339,7 @@ struct LogoiWidget : RebelTechModuleWidget {
 		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(37.925, 95.88)), module, Logoi::ADDITION_DELAY_OUTPUT));
 		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(25.225, 108.58)), module, Logoi::COMBINED_OUTPUT));
 		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(37.925, 108.58)), module, Logoi::CLOCK_THRU_OUTPUT));
+		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(25.225, 83.18)), module, Logoi::POSITION_OUTPUT));
 
 		addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(25.225, 57.78)), module, Logoi::COMBINED_LIGHT));
 		addChild(createLightCentered<MediumLight<RedLight>>(mm2px(Vec(12.525, 70.48)), module, Logoi::DIVISION_LIGHT));
@@ -589,6 +357,12 @@ struct LogoiWidget : RebelTechModuleWidget {
 		Logoi* module = dynamic_cast<Logoi*>(this->module);
 		assert(module);
 
+		menu->addChild(createIndexPtrSubmenuItem("Division/count range", {"Original (/64, 32 counts)", "Extended (/4096, 4096 counts)"}, &module->core.range));
+		menu->addChild(createIndexPtrSubmenuItem("Position output", {"Divider", "Counter", "Both (polyphonic)"}, &module->core.positionSource));
+		menu->addChild(createIndexPtrSubmenuItem("Position scale", {"0-10V over the cycle", "1/12V per step (semitones)"}, &module->core.positionScale));
+		menu->addChild(createIndexPtrSubmenuItem("Delay time", {"Free (up to 1 s)", "Tempo-synced (1/16 to 16 bars)"}, &module->core.delaySync));
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
 		addThemeMenuItems(menu, &module->theme);
 	}
 };
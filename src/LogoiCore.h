@@ -0,0 +1,639 @@
+#pragma once
+#include <inttypes.h>
+#include <cmath>
+#include <algorithm>
+#include "ClockTrigger.h"
+#include "CacheAligned.h"
+#include "Profiler.h"
+
+// Rack-independent DSP for Logoi, used by both the module (Logoi.cpp) and the offline tools
+// (see tools/). Output "ports" are plain floats holding the voltage, which the module copies
+// to its outputs after each call to process().
+
+// derived from https://github.com/pingdynasty/ClockDelay/blob/master/ClockDelay.cpp
+class ClockCounter {
+public:
+	inline void reset() {
+		pos = 0;
+		off();
+	}
+	bool next() {
+		if (++pos > value) {
+			pos = 0;
+			return true;
+		}
+		return false;
+	}
+
+	uint32_t pos = 0;
+	uint32_t value = 0;
+
+	void rise() {
+		if (next())
+			on();
+		else
+			off();
+	}
+	inline void fall() {
+		off();
+	}
+	virtual bool isOff() {
+		return *delayOutput == 0;
+	}
+	virtual void on() {
+		*delayOutput = 10.f;
+	}
+	virtual void off() {
+		*delayOutput = 0.f;
+	}
+	void setOutput(float* delayOutput_) {
+		delayOutput = delayOutput_;
+	}
+private:
+	float* delayOutput;
+};
+
+
+class ClockDivider {
+public:
+	inline void reset() {
+		pos = 0;
+		toggled = false;
+		off();
+	}
+	bool next() {
+		if (++pos > value) {
+			pos = 0;
+			return true;
+		}
+		return false;
+	}
+
+	// signed, value is -1 for division by 1
+	int32_t pos = 0;
+	int32_t value = 0;
+	bool toggled = false;
+	inline bool isOff() {
+		return *dividedOutput == 0;
+	}
+	bool isHigh() const {
+		return *dividedOutput != 0;
+	}
+	void rise() {
+		if (next()) {
+			toggle();
+			toggled = true;
+		}
+	}
+	void fall() {
+		if (value == -1)
+			off();
+	}
+	void toggle() {
+		bool state = (bool) *dividedOutput;
+		*dividedOutput = 10.f * !state;
+	}
+	void on() {
+		*dividedOutput = 10.f;
+	}
+	void off() {
+		*dividedOutput = 0.f;
+	}
+	void setOutput(float* dividedOutput_) {
+		dividedOutput = dividedOutput_;
+	}
+private:
+	float* dividedOutput;
+};
+
+class ClockDelay {
+public:
+	uint16_t riseMark = 0;
+	uint16_t fallMark = 0;
+	uint16_t value = 0; 	// number of (pseudo) clock ticks until rise should happen
+	uint16_t pos = 0;
+	bool running = false;
+	inline void start() {
+		pos = 0;
+		fallMark = 0;
+		running = true;
+	}
+	inline void stop() {
+		running = false;
+	}
+	inline void reset() {
+		stop();
+		off();
+	}
+	inline void rise() {
+		riseMark = value;
+		start();
+	}
+	inline void fall() {
+		fallMark = riseMark + pos;
+	}
+	inline void clock() {
+		if (running) {
+			if (++pos == riseMark) {
+				on();
+			}
+			else if (pos == fallMark) {
+				off();
+				stop(); // one-shot
+			}
+		}
+	}
+	virtual void on() {
+		*delayOutput = 10.f;
+	}
+	virtual void off() {
+		*delayOutput = 0.f;
+	}
+	virtual bool isOff() {
+		return *delayOutput == 0;
+	}
+	void setOutput(float* delayOutput_) {
+		delayOutput = delayOutput_;
+	}
+private:
+	float* delayOutput;
+};
+
+class ClockSwing : public ClockDelay {
+public:
+	void on() override {
+		*combinedOutput = 10.f;
+	}
+	void off() override {
+		*combinedOutput = 0.f;
+	}
+	bool isOff() override {
+		return *combinedOutput == 0;
+	}
+	void setOutputs(float* delayOutput_, float* combinedOutput_) {
+		ClockDelay::setOutput(delayOutput_);
+		combinedOutput = combinedOutput_;
+	}
+private:
+	float* combinedOutput;
+};
+
+class DividingCounter : public ClockCounter {
+public:
+	void setOutputs(float* delayOutput_, float* combinedOutput_) {
+		ClockCounter::setOutput(delayOutput_);
+		combinedOutput = combinedOutput_;
+	}
+	void on() override {
+		*combinedOutput = 10.f;
+
+	}
+	void off() override {
+		*combinedOutput = 0.f;
+	}
+	bool isOff() override {
+		return *combinedOutput == 0;
+	}
+private:
+	float* combinedOutput;
+};
+// end of imported/modifed hardware code
+
+// Delays pulses by any number of samples, for the tempo-synced delay mode, where the delay can
+// be many clock periods long: each rise and fall is queued with the sample it is due, so several
+// pulses can be in flight. Events fall due in the order they were queued, so only the oldest is
+// checked each sample (O(1)). Times are 64 bit sample counts, which never overflow.
+class PulseDelayLine {
+public:
+	static const int maxEvents = 256;	// a power of 2, i.e. 128 pulses in flight
+
+	uint64_t due[maxEvents];
+	bool level[maxEvents];
+	int head = 0;
+	int count = 0;
+	bool dropping = false;	// the queue was full at the last rise, so its fall is dropped too
+
+	void rise(uint64_t at) {
+		dropping = (count > maxEvents - 2);
+		if (!dropping) {
+			push(at, true);
+		}
+	}
+	void fall(uint64_t at) {
+		if (!dropping) {
+			push(at, false);
+		}
+		dropping = false;
+	}
+	// now is the current sample count
+	void process(uint64_t now) {
+		while (count > 0 && due[head] <= now) {
+			*output = level[head] ? 10.f : 0.f;
+			head = (head + 1) & (maxEvents - 1);
+			--count;
+		}
+	}
+	bool isEmpty() const {
+		return count == 0;
+	}
+	void reset() {
+		head = count = 0;
+		dropping = false;
+		*output = 0.f;
+	}
+	void setOutput(float* output_) {
+		output = output_;
+	}
+private:
+	float* output;
+
+	void push(uint64_t at, bool high) {
+		// if the delay was shortened, events can't overtake the ones already queued
+		if (count > 0) {
+			at = std::max(at, due[(head + count - 1) & (maxEvents - 1)]);
+		}
+		const int i = (head + count) & (maxEvents - 1);
+		due[i] = at;
+		level[i] = high;
+		++count;
+	}
+};
+
+
+struct alignas(cacheLineSize) LogoiCore {
+
+	enum OperatingMode {
+		COUNT_MODE,
+		DELAY_MODE,
+		DISABLED_MODE
+	};
+
+	// the delay (right hand side, in delay mode) is either a time, or a number of bars of the
+	// input clock, measured as the interval between its last two rises (taken as quarter notes)
+	enum DelaySync {
+		FREE_DELAY,
+		SYNCED_DELAY,
+		DELAY_SYNC_LEN
+	};
+
+	struct Fraction {
+		uint16_t num;
+		uint16_t den;
+	};
+
+	// the division and count knobs either have the hardware's linear range (/64, 32 counts) or an
+	// extended exponential range (/4096, 4096 counts), in which every value can be reached by CV
+	enum Range {
+		ORIGINAL_RANGE,
+		EXTENDED_RANGE,
+		RANGE_LEN
+	};
+
+	// what the stepped position CV output shows, both is polyphonic (divider, counter)
+	enum PositionSource {
+		POSITION_DIVIDER,
+		POSITION_COUNTER,
+		POSITION_BOTH,
+		POSITION_SOURCE_LEN
+	};
+
+	// scale of the stepped position CV output
+	enum PositionScale {
+		POSITION_CYCLE,			// 0 - 10V over the cycle
+		POSITION_SEMITONES,		// 1/12V per step (up to 10V)
+		POSITION_SCALE_LEN
+	};
+
+	static const int maxDivision = 4096;
+	static const int maxCount = 4096;
+	// log2 of maxDivision / 2 and of maxCount
+	static constexpr float divisionOctaves = 11.f;
+	static constexpr float countOctaves = 12.f;
+	// below this the divider passes the clock through (division by 1)
+	static constexpr float divisionOffParam = 1.f / 64.f;
+
+	static constexpr float maxDelayTime = 1.f;
+	static const int updateClocksFrequency = 64;		// number of samples to wait between updates (N)
+	static const int clocksPerBar = 4;
+	static const int numSyncedDelays = 13;
+
+	// output voltages
+	float divisionOutput = 0.f;
+	float countOrDelayOutput = 0.f;
+	float combinedOutput = 0.f;
+	float clockThruOutput = 0.f;
+
+	ClockTrigger clockDetector, resetDetector;
+	BooleanTrigger fallDetector;
+
+	int updateClocksCounter = 0; 	// used to update delay counters every N samples
+
+	ClockDivider divider;	// standard clock divider, powers left hand side
+	ClockCounter counter;	// clock counter, powers right hand side (when in count mode)
+	ClockDelay delay; 		// clock delay, powers right hand side (when in delay mode)
+
+	DividingCounter divcounter;		// used to combine left+right (when right in count mode)
+	ClockSwing swinger;				// used to combine left+right (when right in delay mode)
+
+	// the hardware's range unless the extended one is picked from the menu
+	Range range = ORIGINAL_RANGE;
+	PositionSource positionSource = POSITION_DIVIDER;
+	PositionScale positionScale = POSITION_CYCLE;
+
+	// tempo-synced delay mode, the equivalents of delay and swinger
+	DelaySync delaySync = FREE_DELAY;
+	PulseDelayLine syncedDelay, syncedSwinger;
+	int syncedDelayIndex = 0;		// into syncedDelays()
+	uint64_t sampleCount = 0;
+	uint64_t lastRise = 0;
+	uint64_t clockPeriod = 0;		// in samples, 0 until two rises have been seen
+
+	LogoiCore() {
+		// individual processors
+		divider.setOutput(&divisionOutput); 			// left side, clock divider
+		counter.setOutput(&countOrDelayOutput);		// right side, mode COUNT (switch down)
+		delay.setOutput(&countOrDelayOutput);		// right side, mode DELAY (switch middle)
+
+		// combined processors: COUNT mode
+		divcounter.setOutputs(&countOrDelayOutput, &combinedOutput);
+		// combined processors: DELAY mode
+		swinger.setOutputs(&countOrDelayOutput, &combinedOutput);
+		syncedDelay.setOutput(&countOrDelayOutput);
+		syncedSwinger.setOutput(&combinedOutput);
+
+		reset();
+	}
+
+	// the outputs point into this object, so copying would leave them pointing at the original
+	LogoiCore(const LogoiCore&) = delete;
+	LogoiCore& operator=(const LogoiCore&) = delete;
+
+	void reset() {
+		divider.reset();
+		counter.reset();
+		divcounter.reset();
+		delay.reset();
+		swinger.reset();
+		syncedDelay.reset();
+		syncedSwinger.reset();
+	}
+
+	// given VCV param in range 0 - 1, convert to the expected division (for the algorithm)
+	static int32_t divisionFromParamInternal(float paramValue, Range range) {
+		if (paramValue < divisionOffParam) {
+			return -1;
+		}
+		if (range == ORIGINAL_RANGE) {
+			return (int)(paramValue * 31.f);
+		}
+		const float x = (paramValue - divisionOffParam) / (1.f - divisionOffParam);
+		return std::round(std::exp2(x * divisionOctaves)) - 1;
+	}
+	// given VCV param in range 0 - 1, convert to the expected division (in a form meaningful for the user)
+	static int32_t divisionFromParamUser(float paramValue, Range range) {
+		const int32_t divisionInternal = divisionFromParamInternal(paramValue, range);
+		return divisionInternal == -1 ? 1 : (2 * (1 + divisionInternal));
+	}
+	// given a clock division from the user, convert to the param value (0 - 1)
+	static float paramFromDivisionUser(int division, Range range) {
+		if (range == ORIGINAL_RANGE) {
+			int divisionInternal = (division == 1) ? -1 : (division / 2 - 1);
+			return (std::min(std::max(divisionInternal, -1), 31) + 1) / 32.f;
+		}
+		if (division <= 1) {
+			return 0.f;
+		}
+		const int half = std::min(division / 2, maxDivision / 2);
+		return divisionOffParam + (1.f - divisionOffParam) * std::log2((float) half) / divisionOctaves;
+	}
+
+	// given VCV param in range 0 - 1, convert to the expected count (for the algorithm)
+	static int32_t countFromParamInternal(float paramValue, Range range) {
+		if (range == ORIGINAL_RANGE) {
+			return std::round(31 * paramValue);
+		}
+		return std::round(std::exp2(paramValue * countOctaves)) - 1;
+	}
+	// given VCV param in range 0 - 1, convert to the expected count (for the algorithm)
+	static int32_t countFromParamUser(float paramValue, Range range) {
+		return 1 + countFromParamInternal(paramValue, range);
+	}
+
+	// given VCV param in range 0 - 1, convert to the expected count (for right hand side)
+	static float paramFromCountUser(float count, Range range) {
+		if (range == ORIGINAL_RANGE) {
+			count = std::min(std::max(count, 1.f), 32.f);
+			return (count - 1) / 31.f;
+		}
+		count = std::min(std::max(count, 1.f), (float) maxCount);
+		return std::log2(count) / countOctaves;
+	}
+
+	static float delayFromParamUser(float paramValue) {
+		return maxDelayTime * 1000.f * paramValue;
+	}
+
+	static float paramFromDelayUser(float delay) {
+		return delay / (maxDelayTime * 1000.f);
+	}
+
+	// given VCV param in range 0 - 1, convert to the expected delay (for the algorithm)
+	static uint16_t delayFromParamInternal(float paramValue, float sampleTime) {
+		// max Rack sample rate is 768kHz - with updateClocksFrequency == 64, which means we ping the clocks,
+		// delay.clock() and swinger.clock() every 64 samples, the largest reasonable value
+		// of maxClockTicks is 12000. Tick counter of type uint16_t [0, +65535] shouldn't overflow.
+		const float maxClockTicks = (maxDelayTime / sampleTime) / updateClocksFrequency;
+
+		return 1 + std::round(maxClockTicks * paramValue);
+	}
+
+	// tempo-synced delays, in bars
+	static const Fraction* syncedDelays() {
+		static const Fraction table[numSyncedDelays] = {
+			{1, 16}, {1, 8}, {3, 16}, {1, 4}, {3, 8}, {1, 2}, {3, 4}, {1, 1}, {2, 1}, {3, 1}, {4, 1}, {8, 1}, {16, 1}
+		};
+		return table;
+	}
+	// given VCV param in range 0 - 1, convert to the index of the tempo-synced delay
+	static int syncedDelayFromParamInternal(float paramValue) {
+		return std::round((numSyncedDelays - 1) * paramValue);
+	}
+	static float paramFromSyncedDelayIndex(int index) {
+		return std::min(std::max(index, 0), numSyncedDelays - 1) / (float) (numSyncedDelays - 1);
+	}
+
+	// knob (0 - 1) and CV (attenuator 0 - 1, input -10V to +10V), CV sums with the knob
+	// where +10V is equivalent to a full clockwise turn
+	static float paramWithCV(float knob, float attenuator, float cv) {
+		const float scaledCV = std::min(std::max(attenuator * cv, -10.f), +10.f);
+		return std::min(std::max(knob + scaledCV / 10.f, 0.f), 1.f);
+	}
+
+	// process LHS knobs (param including CV, see paramWithCV)
+	void setDivision(float divisionWithCV) {
+		divider.value = divisionFromParamInternal(divisionWithCV, range);
+	}
+
+	// process RHS knobs (param including CV, see paramWithCV)
+	void setCountOrDelay(float countDelayWithCV, float sampleTime) {
+		// mode RHS modes infer params from the same source(s)
+		divcounter.value = counter.value = countFromParamInternal(countDelayWithCV, range);
+		delay.value = swinger.value = delayFromParamInternal(countDelayWithCV, sampleTime);
+		syncedDelayIndex = syncedDelayFromParamInternal(countDelayWithCV);
+	}
+
+	// tempo-synced delay in samples, from the measured clock period
+	uint64_t syncedDelaySamples() const {
+		const Fraction bars = syncedDelays()[syncedDelayIndex];
+		return clockPeriod * clocksPerBar * bars.num / bars.den;
+	}
+
+	// divider's step within its cycle (0 to division - 1), counting from the rise that took the
+	// output high
+	int32_t dividerStep() const {
+		if (divider.value < 0) {
+			return 0;
+		}
+		return divider.isHigh() ? divider.pos : divider.pos + divider.value + 1;
+	}
+	int32_t dividerSteps() const {
+		return (divider.value < 0) ? 1 : 2 * (divider.value + 1);
+	}
+	// counter's step within its cycle (0 to count - 1), 0 on the rise that fired it
+	int32_t counterStep() const {
+		return counter.pos;
+	}
+	int32_t counterSteps() const {
+		return counter.value + 1;
+	}
+
+	static float positionVoltage(int32_t step, int32_t steps, PositionScale scale) {
+		if (scale == POSITION_SEMITONES) {
+			return std::min(step / 12.f, 10.f);
+		}
+		return 10.f * step / steps;
+	}
+
+	// true if the outputs won't change until the next clock or reset
+	bool isQuiescent() const {
+		return !delay.running && !swinger.running && syncedDelay.isEmpty() && syncedSwinger.isEmpty();
+	}
+
+	// account for frames passed without processing (while quiescent), keeps the delay clocks in phase
+	void skip(int64_t frames) {
+		updateClocksCounter = (updateClocksCounter + frames) % updateClocksFrequency;
+		sampleCount += frames;
+	}
+
+	void process(float clockIn, float resetIn, int mode) {
+		PROFILE_ZONE("LogoiCore");
+
+		PROFILE_PHASE("clock");
+		if (resetDetector.process(resetIn)) {
+			reset();
+		}
+
+		// do every N ticks (set by updateClocksFrequency)
+		if (++updateClocksCounter >= updateClocksFrequency) {
+			updateClocksCounter = 0;
+			delay.clock();
+			swinger.clock();
+		}
+		++sampleCount;
+		syncedDelay.process(sampleCount);
+		syncedSwinger.process(sampleCount);
+
+		// Schmitt trigger on incoming clock
+		PROFILE_PHASE("triggers");
+		const bool rising = clockDetector.process(clockIn);
+		// returns true when previous clock state was high and next is low
+		const bool falling = fallDetector.process(!clockDetector.isHigh());
+		// and forward the clock to the thru output
+		clockThruOutput = clockDetector.isHigh() * 10.f;
+
+		const bool synced = (delaySync == SYNCED_DELAY);
+		if (rising) {
+			if (lastRise > 0) {
+				clockPeriod = sampleCount - lastRise;
+			}
+			lastRise = sampleCount;
+
+			divider.rise();
+			switch (mode) {
+				case DELAY_MODE: {
+					if (synced) {
+						// nothing is output until the clock period is known
+						if (clockPeriod > 0) {
+							syncedDelay.rise(sampleCount + syncedDelaySamples());
+						}
+					}
+					else {
+						delay.rise();
+					}
+					if (divider.toggled) {
+						if (!synced) {
+							swinger.rise();
+						}
+						else if (clockPeriod > 0) {
+							syncedSwinger.rise(sampleCount + syncedDelaySamples());
+						}
+					}
+					else {
+						combinedOutput = 10.f;
+						// COMBINED_OUTPUT_PORT &= ~_BV(COMBINED_OUTPUT_PIN); // pass through clock
+						// CLOCKDELAY_LEDS_PORT |= _BV(CLOCKDELAY_LED_1_PIN);
+					}
+					break;
+				}
+				case COUNT_MODE: {
+					counter.rise();
+					if (divider.toggled) {
+						divcounter.rise();
+						if (!divcounter.isOff())
+							divider.toggled = false;
+					}
+					break;
+				}
+			}
+		}
+		else if (falling) {
+			switch (mode) {
+				case DELAY_MODE: {
+					if (synced) {
+						syncedDelay.fall(sampleCount + syncedDelaySamples());
+					}
+					else {
+						delay.fall();
+					}
+					if (divider.toggled) {
+						if (synced) {
+							syncedSwinger.fall(sampleCount + syncedDelaySamples());
+						}
+						else {
+							swinger.fall();
+						}
+						divider.toggled = false;
+					}
+					else {
+						combinedOutput = 0.f;
+						// COMBINED_OUTPUT_PORT |= _BV(COMBINED_OUTPUT_PIN); // pass through clock
+						// CLOCKDELAY_LEDS_PORT &= ~_BV(CLOCKDELAY_LED_1_PIN);
+					}
+					break;
+				}
+				case COUNT_MODE: {
+					counter.fall();
+					divcounter.fall();
+					break;
+				}
+			}
+			divider.fall();
+		}
+
+		if (mode == DISABLED_MODE) {
+			divisionOutput = 0.f;
+			countOrDelayOutput = 0.f;
+			combinedOutput = 0.f;
+		}
+	}
+};
@@ -0,0 +1,165 @@
+#pragma once
+#include <cmath>
+#include <string>
+#include <vector>
+#include "MidiFile.h"
+#include "StoicheiaCore.h"
+#include "KlasmataCore.h"
+#include "CLKCore.h"
+#include "PhoreoCore.h"
+
+// Offline rendering of a module's outputs to a MidiFile, from a copy of its core. The copy is
+// reset and run sample by sample on a clock of its own, exactly as the module would run it, so the
+// file has what the module plays from a reset (pattern, modes, expander chain, subclock ratios,
+// and hits dropped by probability as the core's generator will drop them), in a fraction of the
+// time a live recording takes. Each output gets a track, and a key in whole tones up from C1 (36).
+//
+// Stoicheia and Klasmata are clocked in 16th notes and Phoreo in quarter notes, all at 120 BPM
+// (Phoreo's three clock inputs as if normalled). CLK runs at its BPM knob or tapped tempo, without
+// BPM CV or an external clock.
+
+class MidiExport {
+public:
+	static const int sampleRate = 48000;
+	static constexpr double defaultBPM = 120.;
+
+	static MidiFile render(const StoicheiaCore& source, int bars) {
+		StoicheiaCore core = source;
+		const StoicheiaCore::ABMode mode = core.kernelABMode;
+		Recording recording(defaultBPM, bars);
+		recording.addOutput("A");
+		recording.addOutput("B");
+		recording.addOutput("Logic");
+		// expander sequences, C, D, ...
+		for (int i = 2; i < core.numSequences; ++i) {
+			recording.addOutput(std::string(1, 'A' + i));
+		}
+		StoicheiaChainState chain;
+
+		const double step = recording.framesPerBeat / 4.;
+		// a frame with the inputs low, so the first clock and reset are edges
+		core.process(0.f, 0.f, mode);
+		for (uint64_t frame = 0; frame < recording.frames; ++frame) {
+			core.process(recording.clock(frame, step), recording.reset(frame), mode);
+			recording.record(0, core.outA);
+			recording.record(1, core.outB);
+			recording.record(2, core.outLogic);
+			if (core.numSequences > 2) {
+				chain.set(core, mode);
+				for (int i = 2; i < core.numSequences; ++i) {
+					recording.record(i + 1, chain.output(i));
+				}
+			}
+		}
+		return recording.finish();
+	}
+
+	static MidiFile render(const KlasmataCore& source, int bars) {
+		KlasmataCore core = source;
+		Recording recording(defaultBPM, bars);
+		recording.addOutput("Out");
+
+		const double step = recording.framesPerBeat / 4.;
+		// as for Stoicheia
+		core.process(0.f, 0.f);
+		for (uint64_t frame = 0; frame < recording.frames; ++frame) {
+			core.process(recording.clock(frame, step), recording.reset(frame));
+			recording.record(0, core.out);
+		}
+		return recording.finish();
+	}
+
+	static MidiFile render(const CLKCore& source, int bars) {
+		CLKCore core = source;
+		// the knob's value as last processed, passed back unchanged so a tapped tempo is kept
+		const float knobBPM = core.knobBPM > 0.f ? core.knobBPM : defaultBPM;
+		Recording recording(core.tapBPM > 0.f ? core.tapBPM : knobBPM, bars);
+		const int channels = core.polyChannels;
+		recording.addOutput("Main");
+		for (int ch = 0; ch < channels; ++ch) {
+			recording.addOutput(channels > 1 ? "Clock #1." + std::to_string(ch + 1) : "Clock #1");
+		}
+		for (int ch = 0; ch < channels; ++ch) {
+			recording.addOutput(channels > 1 ? "Clock #2." + std::to_string(ch + 1) : "Clock #2");
+		}
+
+		const float sampleTime = 1.f / sampleRate;
+		CLKCore::Inputs in;
+		core.process(knobBPM, core.mulB, core.mulC, sampleTime, in);
+		for (uint64_t frame = 0; frame < recording.frames; ++frame) {
+			in.reset = recording.reset(frame);
+			core.process(knobBPM, core.mulB, core.mulC, sampleTime, in);
+			recording.record(0, 10.f * core.outA);
+			for (int ch = 0; ch < channels; ++ch) {
+				recording.record(1 + ch, 10.f * core.outB[ch]);
+				recording.record(1 + channels + ch, 10.f * core.outC[ch]);
+			}
+		}
+		return recording.finish();
+	}
+
+	static MidiFile render(const PhoreoCore& source, int bars) {
+		PhoreoCore core = source;
+		core.reset();
+		Recording recording(defaultBPM, bars);
+		recording.addOutput("Pulse width");
+		recording.addOutput("Multiplied");
+		recording.addOutput("Repeated");
+
+		// a bar of clock first, so its period has been measured when the recording starts
+		const float sampleTime = 1.f / sampleRate;
+		const double beat = recording.framesPerBeat;
+		const uint64_t preroll = std::round(4. * beat);
+		for (uint64_t frame = 0; frame < preroll + recording.frames; ++frame) {
+			const float clock = recording.clock(frame, beat);
+			core.process(clock, clock, clock, sampleTime);
+			if (frame >= preroll) {
+				recording.record(0, 10.f * !core.dur.isOff());
+				recording.record(1, 10.f * !core.mul.isOff());
+				recording.record(2, 10.f * !core.rep.isOff());
+			}
+		}
+		return recording.finish();
+	}
+
+private:
+	// outputs recorded over a number of 4/4 bars, each to a track of its own
+	class Recording {
+	public:
+		const double framesPerBeat;
+		const uint64_t frames;
+
+		Recording(double bpm, int bars) : framesPerBeat(60. * sampleRate / bpm), frames(std::round(4. * bars * framesPerBeat)), file(bpm) {}
+
+		void addOutput(const std::string& name) {
+			const int track = file.addTrack(name);
+			gates.push_back(GateRecorder(track, 36 + 2 * track, MidiFile::ppqn / framesPerBeat));
+		}
+
+		// square wave, high for the first half of each period
+		float clock(uint64_t frame, double period) const {
+			return std::fmod((double) frame, period) < 0.5 * period ? 10.f : 0.f;
+		}
+
+		// a reset pulse on the first frame, which the cores process before that frame's clock
+		float reset(uint64_t frame) const {
+			return frame == 0 ? 10.f : 0.f;
+		}
+
+		void record(int output, float voltage) {
+			gates[output].process(file, voltage);
+		}
+
+		MidiFile finish() {
+			for (GateRecorder& gate : gates) {
+				gate.finish(file);
+			}
+			file.setEnd(std::round(frames * MidiFile::ppqn / framesPerBeat));
+			return std::move(file);
+		}
+
+	private:
+		MidiFile file;
+		std::vector<GateRecorder> gates;
+	};
+};
@@ -0,0 +1,200 @@
+#pragma once
+#include <inttypes.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "ClockTrigger.h"
+
+// Standard MIDI files (format 1) of gate patterns, for exporting what a module plays (see
+// MidiExport.h). Track 0 holds the tempo and a 4/4 time signature, each further track the notes of
+// one output, all on channel 10 (drums). Times are in ticks, ppqn per quarter note.
+
+class MidiFile {
+public:
+	static const int ppqn = 96;
+
+	explicit MidiFile(double bpm = 120.) : bpm(bpm) {}
+
+	double getBPM() const {
+		return bpm;
+	}
+
+	// a new (empty) track, returns its index for addNote()
+	int addTrack(const std::string& name) {
+		tracks.push_back(Track());
+		tracks.back().name = name;
+		return tracks.size() - 1;
+	}
+
+	void addNote(int track, uint32_t tick, uint32_t duration, uint8_t key, uint8_t velocity = 100) {
+		duration = std::max(duration, 1u);
+		tracks[track].notes.push_back({tick, duration, key, velocity});
+		end = std::max(end, tick + duration);
+	}
+
+	// length of the file, which is extended to the last note off if that is later
+	void setEnd(uint32_t tick) {
+		end = std::max(end, tick);
+	}
+
+	size_t numNotes(int track) const {
+		return tracks[track].notes.size();
+	}
+
+	std::vector<uint8_t> bytes() const {
+		std::vector<uint8_t> out;
+		out.insert(out.end(), {'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1});
+		put16(out, tracks.size() + 1);
+		put16(out, ppqn);
+
+		std::vector<uint8_t> conductor;
+		const uint32_t tempo = std::round(60e6 / bpm);
+		conductor.insert(conductor.end(), {0, 0xff, 0x51, 3, uint8_t(tempo >> 16), uint8_t(tempo >> 8), uint8_t(tempo)});
+		// 4/4, 24 clocks per click, 8 32nds per quarter
+		conductor.insert(conductor.end(), {0, 0xff, 0x58, 4, 4, 2, 24, 8});
+		endTrack(conductor, end);
+		putChunk(out, conductor);
+
+		for (const Track& track : tracks) {
+			putChunk(out, trackBytes(track));
+		}
+		return out;
+	}
+
+	bool write(const std::string& path) const {
+		const std::vector<uint8_t> data = bytes();
+		FILE* file = std::fopen(path.c_str(), "wb");
+		if (!file) {
+			return false;
+		}
+		const bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size();
+		return (std::fclose(file) == 0) && ok;
+	}
+
+private:
+	struct Note {
+		uint32_t tick;
+		uint32_t duration;
+		uint8_t key;
+		uint8_t velocity;
+	};
+
+	struct Track {
+		std::string name;
+		std::vector<Note> notes;
+	};
+
+	double bpm;
+	std::vector<Track> tracks;
+	uint32_t end = 0;
+
+	static void put16(std::vector<uint8_t>& out, uint16_t value) {
+		out.push_back(value >> 8);
+		out.push_back(value & 0xff);
+	}
+
+	static void put32(std::vector<uint8_t>& out, uint32_t value) {
+		put16(out, value >> 16);
+		put16(out, value & 0xffff);
+	}
+
+	// variable length quantity, 7 bits per byte, most significant first
+	static void putVarLen(std::vector<uint8_t>& out, uint32_t value) {
+		uint8_t buffer[5];
+		int n = 0;
+		do {
+			buffer[n++] = value & 0x7f;
+			value >>= 7;
+		}
+		while (value);
+		while (n--) {
+			out.push_back(buffer[n] | (n ? 0x80 : 0));
+		}
+	}
+
+	static void putChunk(std::vector<uint8_t>& out, const std::vector<uint8_t>& track) {
+		out.insert(out.end(), {'M', 'T', 'r', 'k'});
+		put32(out, track.size());
+		out.insert(out.end(), track.begin(), track.end());
+	}
+
+	static void endTrack(std::vector<uint8_t>& out, uint32_t delta) {
+		putVarLen(out, delta);
+		out.insert(out.end(), {0xff, 0x2f, 0});
+	}
+
+	std::vector<uint8_t> trackBytes(const Track& track) const {
+		std::vector<uint8_t> out;
+		out.insert(out.end(), {0, 0xff, 0x03});
+		putVarLen(out, track.name.size());
+		out.insert(out.end(), track.name.begin(), track.name.end());
+
+		// note offs sort before note ons at the same tick, so repeated notes don't overlap
+		struct Event {
+			uint32_t tick;
+			bool on;
+			uint8_t key;
+			uint8_t velocity;
+
+			bool operator<(const Event& other) const {
+				return tick != other.tick ? tick < other.tick : on < other.on;
+			}
+		};
+		std::vector<Event> events;
+		events.reserve(2 * track.notes.size());
+		for (const Note& note : track.notes) {
+			events.push_back({note.tick, true, note.key, note.velocity});
+			events.push_back({note.tick + note.duration, false, note.key, 0});
+		}
+		std::stable_sort(events.begin(), events.end());
+
+		uint32_t tick = 0;
+		for (const Event& event : events) {
+			putVarLen(out, event.tick - tick);
+			tick = event.tick;
+			out.insert(out.end(), {uint8_t(event.on ? 0x99 : 0x89), event.key, event.velocity});
+		}
+		endTrack(out, end - tick);
+		return out;
+	}
+};
+
+// Records one output, sampled at a fixed rate, as notes on a track of a MidiFile: a note from
+// each rising edge (see GateDetector) until the gate falls
+class GateRecorder {
+public:
+	GateRecorder(int track, uint8_t key, double ticksPerFrame) : track(track), key(key), ticksPerFrame(ticksPerFrame) {}
+
+	void process(MidiFile& file, float voltage) {
+		const int edge = gate.process(voltage);
+		if (edge > 0) {
+			start = tick();
+		}
+		else if (edge < 0) {
+			file.addNote(track, start, tick() - start, key);
+		}
+		++frame;
+	}
+
+	// ends a note still held, dropping one that only started on the last frame
+	void finish(MidiFile& file) {
+		if (gate.high && tick() > start) {
+			file.addNote(track, start, tick() - start, key);
+			gate.high = false;
+		}
+	}
+
+private:
+	int track;
+	uint8_t key;
+	double ticksPerFrame;
+	GateDetector gate;
+	uint64_t frame = 0;
+	uint32_t start = 0;
+
+	uint32_t tick() const {
+		return std::round(frame * ticksPerFrame);
+	}
+};
@@ -0,0 +1,139 @@
+#include "PatternBank.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// not part of Rack, so the offline tools can load banks too (see tools/patternbank.cpp)
+
+const PatternBank* PatternBank::load(const std::string& path, std::string* error) {
+	// by path, size and modification time, so a rewritten file is a new bank and modules still
+	// playing the old one keep it
+	static std::mutex mutex;
+	static std::map<std::tuple<std::string, size_t, int64_t>, std::unique_ptr<PatternBank>> banks;
+
+	std::vector<uint8_t> data;
+	int64_t modified = 0;
+	std::string reason;
+	if (!read(path, data, modified, reason)) {
+		if (error) {
+			*error = path + ": " + reason;
+		}
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	const auto key = std::make_tuple(path, data.size(), modified);
+	auto it = banks.find(key);
+	if (it != banks.end()) {
+		return it->second.get();
+	}
+	std::unique_ptr<PatternBank> bank(new PatternBank);
+	bank->data.swap(data);
+	if (!bank->open(path, reason)) {
+		if (error) {
+			*error = path + ": " + reason;
+		}
+		return nullptr;
+	}
+	return (banks[key] = std::move(bank)).get();
+}
+
+bool PatternBank::open(const std::string& path, std::string& reason) {
+	if (data.size() < headerSize || std::memcmp(data.data(), "RTPB", 4) != 0) {
+		reason = "not a pattern bank";
+		return false;
+	}
+	uint16_t fileVersion;
+	uint32_t fileCount;
+	std::memcpy(&fileVersion, data.data() + 4, sizeof(fileVersion));
+	std::memcpy(&fileCount, data.data() + 8, sizeof(fileCount));
+	if (fileVersion != version) {
+		reason = "unsupported version " + std::to_string(fileVersion);
+		return false;
+	}
+	if (fileCount == 0) {
+		reason = "no patterns";
+		return false;
+	}
+	if (fileCount > (data.size() - headerSize) / patternSize) {
+		reason = "truncated (" + std::to_string(fileCount) + " patterns in header)";
+		return false;
+	}
+	count = fileCount;
+	filePath = path;
+	return true;
+}
+
+#ifdef _WIN32
+
+bool PatternBank::read(const std::string& path, std::vector<uint8_t>& data, int64_t& modified, std::string& reason) {
+	// paths are UTF-8
+	std::wstring widePath(MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0), 0);
+	MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &widePath[0], widePath.size());
+	HANDLE file = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		reason = "can't open file";
+		return false;
+	}
+	LARGE_INTEGER size;
+	FILETIME writeTime;
+	bool ok = GetFileSizeEx(file, &size) && GetFileTime(file, NULL, NULL, &writeTime);
+	if (ok) {
+		modified = ((int64_t) writeTime.dwHighDateTime << 32) | writeTime.dwLowDateTime;
+		data.resize(size.QuadPart);
+		DWORD bytesRead = 0;
+		ok = data.empty() || (ReadFile(file, data.data(), data.size(), &bytesRead, NULL) && bytesRead == data.size());
+	}
+	CloseHandle(file);
+	if (!ok) {
+		reason = "can't read file";
+	}
+	return ok;
+}
+
+#else
+
+bool PatternBank::read(const std::string& path, std::vector<uint8_t>& data, int64_t& modified, std::string& reason) {
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		reason = "can't open file";
+		return false;
+	}
+	struct stat st;
+	bool ok = fstat(fd, &st) == 0;
+	if (ok) {
+		// in nanoseconds, so a file rewritten twice in a second is still seen to have changed
+#ifdef __APPLE__
+		modified = (int64_t) st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+		modified = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+		data.resize(st.st_size);
+		size_t done = 0;
+		while (done < data.size()) {
+			const ssize_t n = ::read(fd, data.data() + done, data.size() - done);
+			if (n <= 0) {
+				break;
+			}
+			done += n;
+		}
+		ok = done == data.size();
+	}
+	::close(fd);
+	if (!ok) {
+		reason = "can't read file";
+	}
+	return ok;
+}
+
+#endif
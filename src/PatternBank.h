@@ -0,0 +1,78 @@
+#pragma once
+#include <inttypes.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// A bank of fixed rhythms (Euclidean variants, world rhythms, captured grooves, ...) for
+// Klasmata's pattern bank mode. A bank file (.rtpb) is a 16 byte header followed by 8 bytes per
+// pattern, all little endian:
+//
+//   header:  "RTPB", uint16 version (1), uint16 reserved, uint32 count, uint32 reserved
+//   pattern: uint32 bits (bit i is step i), uint8 length (1 - 32), 3 reserved bytes
+//
+// Files are read into memory (8 bytes a pattern, so under 100 KB for every Euclidean pattern) and
+// each version of a file, by path, size and modification time, is read once and shared by all
+// modules using it; a file rewritten since it was loaded is read again. Banks are kept until exit,
+// so a bank read by the audio thread is never freed under it. Loading is in PatternBank.cpp,
+// which keeps the platform headers out of the module cores.
+// tools/patternbank.cpp builds banks.
+
+struct BankPattern {
+	uint32_t bits;
+	uint8_t length;
+};
+
+class PatternBank {
+public:
+	static const uint16_t version = 1;
+	static const size_t headerSize = 16;
+	static const size_t patternSize = 8;
+
+	// the shared bank for a file, read on first use (or if the file has changed since); nullptr (with a reason in error) if the
+	// file can't be opened or isn't a bank. Not for the audio thread.
+	static const PatternBank* load(const std::string& path, std::string* error = nullptr);
+
+	size_t size() const {
+		return count;
+	}
+
+	const std::string& path() const {
+		return filePath;
+	}
+
+	// pattern i, with i clamped to the bank and the length to 1 - 32 (bits past the length are
+	// cleared), so a corrupt entry can't produce an invalid sequence
+	BankPattern get(size_t i) const {
+		if (i >= count) {
+			i = count - 1;
+		}
+		const uint8_t* entry = data.data() + headerSize + i * patternSize;
+		BankPattern pattern;
+		std::memcpy(&pattern.bits, entry, sizeof(pattern.bits));
+		pattern.length = entry[4] < 1 ? 1 : (entry[4] > 32 ? 32 : entry[4]);
+		if (pattern.length < 32) {
+			pattern.bits &= (1UL << pattern.length) - 1;
+		}
+		return pattern;
+	}
+
+	// index of the pattern at position x (0 - 1) through the bank
+	size_t indexAt(float x) const {
+		const size_t i = x > 0.f ? (size_t)(x * count) : 0;
+		return i < count ? i : count - 1;
+	}
+
+private:
+	PatternBank() {}
+	PatternBank(const PatternBank&) = delete;
+	PatternBank& operator=(const PatternBank&) = delete;
+
+	std::vector<uint8_t> data;
+	size_t count = 0;
+	std::string filePath;
+
+	bool open(const std::string& path, std::string& reason);
+	// the whole file, and its modification time in the platform's units
+	static bool read(const std::string& path, std::vector<uint8_t>& data, int64_t& modified, std::string& reason);
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <atomic>
+#include <inttypes.h>
+#include "Sequence.h"
+#include "CacheAligned.h"
+
+// Lock-free hand over of the latest value of T from one writer thread (the audio thread) to one
+// reader thread (the UI thread). Neither side ever waits for the other: the writer fills
+// write() and publishes it, and the reader takes the most recent publish with update(), then
+// reads read() for as long as it likes. The writer and reader each own one of the three
+// buffers, and swap theirs with the shared middle one, so a buffer is never read while it is
+// being written. T should be trivially copyable.
+template <typename T>
+class TripleBuffer {
+public:
+	// for the writer: the buffer to fill before calling publish()
+	T& write() {
+		return buffers[back];
+	}
+
+	// for the writer: make the buffer from write() the latest value
+	void publish() {
+		back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+	}
+
+	// for the reader: takes the latest value if one was published since the last call, in
+	// which case it returns true
+	bool update() {
+		if (!(middle.load(std::memory_order_relaxed) & freshBit)) {
+			return false;
+		}
+		front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+		return true;
+	}
+
+	// for the reader: the value taken by the last update()
+	const T& read() const {
+		return buffers[front];
+	}
+
+private:
+	static const uint8_t indexMask = 3;
+	static const uint8_t freshBit = 4;
+
+	T buffers[3];
+	// index of the buffer neither side owns, plus freshBit if it holds a value the reader hasn't taken
+	alignas(cacheLineSize) std::atomic<uint8_t> middle{1};
+	// written only by the writer / the reader, on lines of their own
+	alignas(cacheLineSize) uint8_t back = 0;
+	alignas(cacheLineSize) uint8_t front = 2;
+};
+
+// The patterns and playheads of up to two Euclidean sequences, as shown by the pattern display
+// (see PatternDisplay in plugin.hpp). The module keeps the last published snapshot, and only
+// publishes a new one (with the next version) when set() reports a change.
+struct PatternSnapshot {
+	static const int maxSequences = 2;
+
+	uint32_t version = 0;
+	int numSequences = 1;
+	// the sequence currently clocked (Stoicheia's alternating mode), -1 if all are
+	int active = -1;
+	uint32_t bits[maxSequences] = {};
+	uint8_t length[maxSequences] = {1, 1};
+	int8_t offset[maxSequences] = {};
+	// the next step to be played (Sequence::pos)
+	uint8_t pos[maxSequences] = {};
+
+	// copy sequence i, returns true if anything shown has changed
+	template <typename T>
+	bool set(int i, const Sequence<T>& seq) {
+		const uint8_t seqPos = seq.pos;
+		if (bits[i] == seq.bits && length[i] == seq.length && offset[i] == seq.offset && pos[i] == seqPos) {
+			return false;
+		}
+		bits[i] = seq.bits;
+		length[i] = seq.length;
+		offset[i] = seq.offset;
+		pos[i] = seqPos;
+		return true;
+	}
+
+	bool setActive(int newActive) {
+		if (active == newActive) {
+			return false;
+		}
+		active = newActive;
+		return true;
+	}
+
+	bool isHit(int i, int step) const {
+		return bits[i] & (1UL << step);
+	}
+
+	// step k of sequence i in playing order, counting from its start (offset)
+	int stepAt(int i, int k) const {
+		return wrap(offset[i] + k, length[i]);
+	}
+
+	// playing order index of the step last played (the one before pos)
+	int playhead(int i) const {
+		return wrap(pos[i] - 1 - offset[i], length[i]);
+	}
+
+	static int wrap(int step, int length) {
+		return ((step % length) + length) % length;
+	}
+};
+
+// The audio thread side of the display: the module updates pattern (in process()) and calls
+// publish() only when set() reports a change, so an unchanging pattern costs a few compares.
+struct PatternPublisher {
+	PatternSnapshot pattern;
+	TripleBuffer<PatternSnapshot> buffer;
+
+	void publish() {
+		++pattern.version;
+		buffer.write() = pattern;
+		buffer.publish();
+	}
+};
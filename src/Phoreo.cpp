@@ -1,7 +1,9 @@
 #include "plugin.hpp"
+#include "PhoreoCore.h"
+#include "MidiExport.h"
 
 
-struct Phoreo : Module {
+struct Phoreo : Module, CacheAligned {
 	enum ParamId {
 		MOD_PARAM,
 		MOD_CV_PARAM,
@@ -9,6 +11,7 @@ struct Phoreo : Module {
 		MUL_CV_PARAM,
 		REP_PARAM,
 		REP_CV_PARAM,
+		CURVE_PARAM,
 		PARAMS_LEN
 	};
 	enum InputId {
@@ -32,159 +35,17 @@ struct Phoreo : Module {
 		LIGHTS_LEN
 	};
 
-	// derived from https://github.com/pingdynasty/ClockMultiplier/blob/master/ClockMultiplier.cpp
-	typedef uint32_t ClockTick;
-
-	class ClockDuration {
-	public:
-		float period;
-		float fallMark;
-		float pos;
-		bool state;
-		float duration;
-
-		ClockDuration() {
-			reset();
-		}
-		inline void reset() {
-			period = fallMark = pos = 0;
-			off();
-		}
-		inline void rise() {
-			period = pos;
-			fallMark = period * duration;
-			pos = 0;
-			on();
-		}
-		inline void clock(float sampleTime) {
-			pos += sampleTime;
-			if (pos >= fallMark) {
-				off();
-			}
-		}
-		void on() {
-			state = true;
-		}
-		void off() {
-			state = false;
-		}
-		bool isOff() {
-			return !state;
-		}
-	};
-
-
-	class ClockMultiplier {
-	public:
-		float fallMark;
-		float pos;
-		float counter;
-		float period;
-		bool state;
-		uint16_t mul;
-
-		ClockMultiplier() {
-			reset();
-		}
-		inline void reset() {
-			fallMark = pos = period = counter = 0;
-			off();
-		}
-		inline void rise(ClockDuration& dur) {
-			on();
-			period = counter / mul;
-			fallMark = period * dur.duration;
-
-			counter = 0;
-			pos = 0;
-		}
-		inline void clock(float sampleTime) {
-			pos += sampleTime;
-			if (pos >= fallMark && state) {
-				off();
-			}
-			else if (pos >= period) {
-				on();
-				pos = 0;
-			}
-			counter += sampleTime;
-		}
-		void on() {
-			state = true;
-		}
-		void off() {
-			state = false;
-		}
-		bool isOff() {
-			return !state;
-		}
-	};
-
-	class ClockRepeater {
-	public:
-		ClockRepeater() {
-			reset();
-		}
-		float period;
-		float fallMark;
-		uint8_t reps;
-		uint8_t times;
-		float pos;
-		bool running;
-		bool state;
-		uint16_t rep;
-		inline void stop() {
-			running = false;
-		}
-		inline void reset() {
-			stop();
-			off();
-		}
-		inline void rise(ClockDuration& dur, ClockMultiplier& mul) {
-			on();
-			times = 0;
-			reps = rep;
-			period = mul.period;
-			fallMark = period * dur.duration;
-			pos = 0;
-			running = true;
-		}
-		inline void clock(float sampleTime) {
-			if (running) {
-				pos += sampleTime;
-				if (pos >= fallMark && state) {
-					off();
-				}
-				else if (pos >= period) {
-					if (++times >= reps) {
-						stop();
-					}
-					else {
-						on();
-					}
-					pos = 0;
-				}
-			}
-		}
-		void on() {
-			state = true;
-		}
-		void off() {
-			state = false;
-		}
-		bool isOff() {
-			return !state;
-		}
-	};
-
-	ClockDuration dur;
-	ClockMultiplier mul;
-	ClockRepeater rep;
-
-	dsp::SchmittTrigger clockTriggers[3];
-
 	ModuleTheme theme = LIGHT_THEME;
 
+	PhoreoCore core;
+	// skips processing while nothing is patched and the outputs have settled
+	IdleDetector idleDetector{PARAMS_LEN};
+	LightDivider<LIGHTS_LEN> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+	// copies of the core for MIDI export, see addMidiExportMenuItem()
+	std::shared_ptr<CoreCopy<PhoreoCore>> coreCopy{new CoreCopy<PhoreoCore>};
+
 	Phoreo() {
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configParam(MOD_PARAM, 0.f, 100.f, 50.f, "Pulse width", "%");
@@ -198,6 +59,9 @@ struct Phoreo : Module {
 		repParam->snapEnabled = true;
 		configParam(REP_CV_PARAM, 0.f, 1.f, 0.f, "Number of repetions CV");
 
+		// no panel control, set from the context menu
+		configParam(CURVE_PARAM, -100.f, 100.f, 0.f, "Repetition curve (+ accelerating, - decelerating)", "%");
+
 		configInput(MOD_TRIG_INPUT, "Modulated clock");
 		configInput(MOD_CV_INPUT, "Pulsewidth CV");
 		configInput(MUL_TRIG_INPUT, "Multiplied clock (normalled to above clock)");
@@ -209,69 +73,63 @@ struct Phoreo : Module {
 		configOutput(MULT_OUTPUT, "Multiplied clock");
 		configOutput(REP_OUTPUT, "Repeated clock");
 
-		reset();
-
 		theme = loadDefaultTheme();
 	}
 
 	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("Phoreo");
+
+		edgeCapture.process(this, args);
+		coreCopy->serve(core);
+		if (idleDetector.process(this)) {
+			return;
+		}
+		core.skip(idleDetector.takeSkippedFrames() * args.sampleTime);
 
 		// knob and CV processing
+		PROFILE_PHASE("params");
 		{
-			// range -10V to +10V scaled to -1 to +1
-			float durCV = params[MOD_CV_PARAM].getValue() * clamp(inputs[MOD_CV_INPUT].getVoltage(), -10.f, +10.f) / 10.f;
-			dur.duration = clamp(params[MOD_PARAM].getValue() / 100.f + durCV, 0.f, 1.f);
-
-			// range -10V to +10V scaled to -1 to +1
-			float mulCV = params[MUL_CV_PARAM].getValue() * clamp(inputs[MUL_CV_INPUT].getVoltage(), -10.f, +10.f) / 10.f;
-			float mulTotal = clamp(params[MUL_PARAM].getValue() + mulCV * 16, 1.f, 16.f);
-			// range of 1 to 16
-			mul.mul = (uint16_t) std::round(mulTotal);
-
-			// range -10V to +10V scaled to -1 to +1
-			float repCV = params[REP_CV_PARAM].getValue() * clamp(inputs[REP_CV_INPUT].getVoltage(), -10.f, +10.f) / 10.f;
-			float repTotal = clamp(params[REP_PARAM].getValue() + repCV * 16, 1.f, 16.f);
-			// range 1 to 16
-			rep.rep = (uint16_t) std::round(repTotal);
+			core.setDuration(PhoreoCore::paramWithCV(params[MOD_PARAM].getValue() / 100.f, params[MOD_CV_PARAM].getValue(),
+			                                         inputs[MOD_CV_INPUT].getVoltage(), 1.f));
+			core.setMultiplier(PhoreoCore::paramWithCV(params[MUL_PARAM].getValue(), params[MUL_CV_PARAM].getValue(),
+			                                           inputs[MUL_CV_INPUT].getVoltage(), 16.f));
+			core.setRepetitions(PhoreoCore::paramWithCV(params[REP_PARAM].getValue(), params[REP_CV_PARAM].getValue(),
+			                                            inputs[REP_CV_INPUT].getVoltage(), 16.f));
+			core.setCurve(params[CURVE_PARAM].getValue() / 100.f);
 		}
 
-
 		const float durClock = inputs[MOD_TRIG_INPUT].getVoltage();
-		if (clockTriggers[0].process(durClock, 0.1f, 2.f)) {
-			dur.rise();
-		}
-
 		// normalled from top clock
 		const float mulClock = inputs[MUL_TRIG_INPUT].getNormalVoltage(durClock);
-		if (clockTriggers[1].process(mulClock, 0.1f, 2.f)) {
-			mul.rise(dur);
-		}
-
 		// normalled from top two clocks
 		const float repClock = inputs[REP_TRIG_INPUT].getNormalVoltage(mulClock);
-		if (clockTriggers[2].process(repClock, 0.1f, 2.f)) {
-			rep.rise(dur, mul);
-		}
 
-		dur.clock(args.sampleTime);
-		mul.clock(args.sampleTime);
-		rep.clock(args.sampleTime);
+		PROFILE_PHASE("core");
+		core.process(durClock, mulClock, repClock, args.sampleTime);
 
-		lights[PWM_LIGHT].setBrightnessSmooth(!dur.isOff(), args.sampleTime);
-		lights[REP_LIGHT].setBrightnessSmooth(!rep.isOff(), args.sampleTime);
+		PROFILE_PHASE("lights");
+		lightDivider.accumulate(PWM_LIGHT, !core.dur.isOff());
+		lightDivider.accumulate(REP_LIGHT, !core.rep.isOff());
+		if (lightDivider.process()) {
+			lightDivider.setBrightnessSmooth(lights[PWM_LIGHT], PWM_LIGHT, args.sampleTime);
+			lightDivider.setBrightnessSmooth(lights[REP_LIGHT], REP_LIGHT, args.sampleTime);
+		}
 
-		outputs[MOD_OUTPUT].setVoltage(10.f * !dur.isOff());
-		outputs[MULT_OUTPUT].setVoltage(10.f * !mul.isOff());
-		outputs[REP_OUTPUT].setVoltage(10.f * !rep.isOff());
-	}
+		PROFILE_PHASE("outputs");
+		outputs[MOD_OUTPUT].setVoltage(10.f * !core.dur.isOff());
+		outputs[MULT_OUTPUT].setVoltage(10.f * !core.mul.isOff());
+		outputs[REP_OUTPUT].setVoltage(10.f * !core.rep.isOff());
 
-	void reset() {
-		mul.reset();
-		dur.reset();
-		rep.reset();
+		if (idleDetector.update(this, core.isQuiescent(), args.sampleTime)) {
+			// finish any fades now, as lights won't be updated while idle
+			lightDivider.reset();
+			lights[PWM_LIGHT].setBrightness(!core.dur.isOff());
+			lights[REP_LIGHT].setBrightness(!core.rep.isOff());
+		}
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
 		json_t* themeJ = json_object_get(rootJ, "theme");
 		if (themeJ) {
 			theme = (ModuleTheme) json_integer_value(themeJ);
@@ -282,6 +140,7 @@ struct Phoreo : Module {
 		json_t* rootJ = json_object();
 		json_object_set_new(rootJ, "theme", json_integer(theme));
 
+		edgeCapture.toJson(rootJ);
 		return rootJ;
 	}
 };
@@ -334,6 +193,15 @@ struct PhoreoWidget : RebelTechModuleWidget {
 		Phoreo* module = dynamic_cast<Phoreo*>(this->module);
 		assert(module);
 
+		menu->addChild(createSubmenuItem("Repetition curve", "", [=](Menu* menu) {
+			ui::Slider* slider = new ui::Slider();
+			slider->quantity = module->getParamQuantity(Phoreo::CURVE_PARAM);
+			slider->box.size.x = 200.f;
+			menu->addChild(slider);
+		}));
+		addMidiExportMenuItem(menu, module->coreCopy, "Phoreo", &MidiExport::render);
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
 		addThemeMenuItems(menu, &module->theme);
 	}
 };
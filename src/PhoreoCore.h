@@ -0,0 +1,263 @@
+#pragma once
+#include <inttypes.h>
+#include <cmath>
+#include <algorithm>
+#include "ClockTrigger.h"
+#include "CacheAligned.h"
+#include "Profiler.h"
+
+// Rack-independent DSP for Phoreo, used by both the module (Phoreo.cpp) and the offline
+// tools (see tools/)
+
+// derived from https://github.com/pingdynasty/ClockMultiplier/blob/master/ClockMultiplier.cpp
+class ClockDuration {
+public:
+	float period;
+	float fallMark;
+	float pos;
+	bool state;
+	float duration;
+
+	ClockDuration() {
+		reset();
+	}
+	inline void reset() {
+		period = fallMark = pos = 0;
+		off();
+	}
+	inline void rise() {
+		period = pos;
+		fallMark = period * duration;
+		pos = 0;
+		on();
+	}
+	inline void clock(float sampleTime) {
+		pos += sampleTime;
+		if (pos >= fallMark) {
+			off();
+		}
+	}
+	void on() {
+		state = true;
+	}
+	void off() {
+		state = false;
+	}
+	bool isOff() {
+		return !state;
+	}
+};
+
+
+class ClockMultiplier {
+public:
+	float fallMark;
+	float pos;
+	float counter;
+	float period;
+	bool state;
+	uint16_t mul;
+
+	ClockMultiplier() {
+		reset();
+	}
+	inline void reset() {
+		fallMark = pos = period = counter = 0;
+		off();
+	}
+	inline void rise(ClockDuration& dur) {
+		on();
+		period = counter / mul;
+		fallMark = period * dur.duration;
+
+		counter = 0;
+		pos = 0;
+	}
+	inline void clock(float sampleTime) {
+		pos += sampleTime;
+		if (pos >= fallMark && state) {
+			off();
+		}
+		// no period is measured until the first clock, so don't free-run before then
+		else if (period > 0 && pos >= period) {
+			on();
+			pos = 0;
+		}
+		counter += sampleTime;
+	}
+	void on() {
+		state = true;
+	}
+	void off() {
+		state = false;
+	}
+	bool isOff() {
+		return !state;
+	}
+};
+
+class ClockRepeater {
+public:
+	static const int maxReps = 16;
+
+	ClockRepeater() {
+		reset();
+	}
+	float period;
+	float fallMark;
+	uint8_t reps;
+	uint8_t times;
+	float pos;
+	bool running;
+	bool state;
+	uint16_t rep;
+	// each repeat is 2^-curve times as long as the one before (curve -1 to +1, positive accelerates)
+	float curve = 0.f;
+	// spacing of the repeats, filled on each rise() so clock() only has to load the next entry
+	float periods[maxReps];
+	float fallMarks[maxReps];
+	inline void stop() {
+		running = false;
+	}
+	inline void reset() {
+		stop();
+		off();
+	}
+	inline void rise(ClockDuration& dur, ClockMultiplier& mul) {
+		on();
+		times = 0;
+		reps = rep;
+		spaceRepeats(mul.period, dur.duration);
+		period = periods[0];
+		fallMark = fallMarks[0];
+		pos = 0;
+		running = true;
+	}
+	// geometric spacing, scaled so the repeats take as long as evenly spaced ones would (with no
+	// curve the ratio and gain are exactly 1, so the spacing is exactly the multiplied period)
+	void spaceRepeats(float evenPeriod, float duration) {
+		const float ratio = std::exp2(-curve);
+		float sum = 0.f;
+		float weight = 1.f;
+		for (int i = 0; i < reps; ++i) {
+			sum += weight;
+			weight *= ratio;
+		}
+		const float gain = evenPeriod * (reps / sum);
+		weight = 1.f;
+		for (int i = 0; i < reps; ++i) {
+			periods[i] = gain * weight;
+			fallMarks[i] = periods[i] * duration;
+			weight *= ratio;
+		}
+	}
+	inline void clock(float sampleTime) {
+		if (running) {
+			pos += sampleTime;
+			if (pos >= fallMark && state) {
+				off();
+			}
+			else if (pos >= period) {
+				if (++times >= reps) {
+					stop();
+				}
+				else {
+					period = periods[times];
+					fallMark = fallMarks[times];
+					on();
+				}
+				pos = 0;
+			}
+		}
+	}
+	void on() {
+		state = true;
+	}
+	void off() {
+		state = false;
+	}
+	bool isOff() {
+		return !state;
+	}
+};
+
+// end of imported/modifed hardware code
+
+
+struct alignas(cacheLineSize) PhoreoCore {
+	ClockDuration dur;
+	ClockMultiplier mul;
+	ClockRepeater rep;
+
+	ClockTrigger clockTriggers[3];
+
+	PhoreoCore() {
+		reset();
+	}
+
+	void reset() {
+		mul.reset();
+		dur.reset();
+		rep.reset();
+	}
+
+	// knob (in the param's own range) plus CV (attenuator 0 - 1, input -10V to +10V scaled to -1 to +1),
+	// where full CV is equivalent to fullScale added to the knob
+	static float paramWithCV(float knob, float attenuator, float cv, float fullScale) {
+		return knob + attenuator * std::min(std::max(cv, -10.f), +10.f) / 10.f * fullScale;
+	}
+
+	// pulse width in range 0 - 1
+	void setDuration(float duration) {
+		dur.duration = std::min(std::max(duration, 0.f), 1.f);
+	}
+	// range of 1 to 16
+	void setMultiplier(float multiplier) {
+		mul.mul = (uint16_t) std::round(std::min(std::max(multiplier, 1.f), 16.f));
+	}
+	// range 1 to 16
+	void setRepetitions(float repetitions) {
+		rep.rep = (uint16_t) std::round(std::min(std::max(repetitions, 1.f), 16.f));
+	}
+	// range -1 (repeats slow down) to +1 (repeats speed up), applied on the next repeat clock
+	void setCurve(float curve) {
+		rep.curve = std::min(std::max(curve, -1.f), 1.f);
+	}
+
+	// the three clocks are already normalled (the multiplier to the pulse width clock, the repeater to the multiplier)
+	void process(float durClock, float mulClock, float repClock, float sampleTime) {
+		PROFILE_ZONE("PhoreoCore");
+
+		PROFILE_PHASE("triggers");
+		if (clockTriggers[0].process(durClock, 0.1f, 2.f)) {
+			dur.rise();
+		}
+
+		if (clockTriggers[1].process(mulClock, 0.1f, 2.f)) {
+			mul.rise(dur);
+		}
+
+		if (clockTriggers[2].process(repClock, 0.1f, 2.f)) {
+			rep.rise(dur, mul);
+		}
+
+		PROFILE_PHASE("clock");
+		dur.clock(sampleTime);
+		mul.clock(sampleTime);
+		rep.clock(sampleTime);
+	}
+
+	// true if the outputs won't change until the next clock (the multiplier free-runs once it has
+	// measured a period, so is only quiescent before then)
+	bool isQuiescent() const {
+		return !dur.state && !mul.state && mul.period == 0 && !rep.state && !rep.running;
+	}
+
+	// account for time passed without processing (while quiescent), so the next measured
+	// periods are the same as if every sample had been processed
+	void skip(float time) {
+		dur.pos += time;
+		mul.pos += time;
+		mul.counter += time;
+	}
+};
@@ -0,0 +1,184 @@
+// Writer side of the profiling zones, see Profiler.h (built only with PROFILE=1)
+#ifdef REBELTECH_PROFILE
+
+#include "Profiler.h"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Zone {
+	const char* name;
+	int64_t start;
+	int64_t end;
+};
+
+// zones of one thread, which pushes them, drained by the writer thread
+struct ZoneBuffer {
+	static const size_t size = 1 << 19;
+
+	Zone zones[size];
+	std::atomic<size_t> head{0};
+	std::atomic<size_t> tail{0};
+	std::atomic<uint64_t> dropped{0};
+	// writer thread only
+	uint64_t droppedReported = 0;
+	int thread = 0;
+	bool named = false;
+
+	void push(const Zone& zone) {
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == size) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		zones[h & (size - 1)] = zone;
+		head.store(h + 1, std::memory_order_release);
+	}
+};
+
+// guards the list of buffers, taken by a recording thread only to register its buffer
+std::mutex buffersMutex;
+// never freed, as a thread may record until exit
+std::vector<ZoneBuffer*> buffers;
+thread_local ZoneBuffer* threadBuffer = nullptr;
+
+std::thread writer;
+std::atomic<bool> running{false};
+FILE* file = nullptr;
+bool firstEvent = true;
+// start of the trace, as a timestamp and in steady clock nanoseconds
+int64_t origin = 0;
+int64_t originNanos = 0;
+// calibrated against the steady clock at each drain
+double nanosPerTick = 1.;
+
+int64_t nanos() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void writeEvent(const char* format, ...) {
+	std::fputs(firstEvent ? "\n" : ",\n", file);
+	firstEvent = false;
+	va_list args;
+	va_start(args, format);
+	std::vfprintf(file, format, args);
+	va_end(args);
+}
+
+// trace timestamps are in microseconds from the start
+double micros(int64_t t) {
+	return (t - origin) * nanosPerTick * 1e-3;
+}
+
+// writes everything recorded so far
+void drain() {
+	const int64_t ticks = Profiler::now() - origin;
+	if (ticks > 0) {
+		nanosPerTick = (nanos() - originNanos) / (double) ticks;
+	}
+
+	std::vector<ZoneBuffer*> all;
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		all = buffers;
+	}
+	for (ZoneBuffer* buffer : all) {
+		if (!buffer->named) {
+			writeEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", buffer->thread, buffer->thread);
+			buffer->named = true;
+		}
+		size_t t = buffer->tail.load(std::memory_order_relaxed);
+		const size_t h = buffer->head.load(std::memory_order_acquire);
+		for (; t != h; ++t) {
+			const Zone& zone = buffer->zones[t & (ZoneBuffer::size - 1)];
+			writeEvent("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+			           zone.name, micros(zone.start), (zone.end - zone.start) * nanosPerTick * 1e-3, buffer->thread);
+		}
+		buffer->tail.store(t, std::memory_order_release);
+
+		// as a counter, so that lost zones show in the trace
+		const uint64_t dropped = buffer->dropped.load(std::memory_order_relaxed);
+		if (dropped != buffer->droppedReported) {
+			writeEvent("{\"name\":\"dropped zones\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"dropped\":%llu}}",
+			           micros(Profiler::now()), buffer->thread, (unsigned long long) dropped);
+			buffer->droppedReported = dropped;
+		}
+	}
+	std::fflush(file);
+}
+
+// sleeps for up to seconds, returning early once stopped
+void sleepWhileRunning(float seconds) {
+	const int64_t end = nanos() + (int64_t)(seconds * 1e9);
+	while (running.load() && nanos() < end) {
+		const int64_t left = (end - nanos()) / 1000000 + 1;
+		std::this_thread::sleep_for(std::chrono::milliseconds(std::min<int64_t>(left, 10)));
+	}
+}
+
+void run(Profiler::Settings settings) {
+	const bool continuous = settings.window >= settings.period;
+	while (running.load()) {
+		Profiler::capture.store(nanos() - originNanos < settings.duration * 1e9);
+		sleepWhileRunning(settings.window);
+		if (!continuous) {
+			Profiler::capture.store(false);
+		}
+		drain();
+		if (!continuous) {
+			sleepWhileRunning(settings.period - settings.window);
+		}
+	}
+}
+
+} // namespace
+
+std::atomic<bool> Profiler::capture{false};
+
+bool Profiler::start(const std::string& path, const Settings& settings) {
+	if (running.load()) {
+		return false;
+	}
+	file = std::fopen(path.c_str(), "w");
+	if (!file) {
+		return false;
+	}
+	std::fputs("[", file);
+	firstEvent = true;
+	origin = now();
+	originNanos = nanos();
+	running.store(true);
+	writer = std::thread(run, settings);
+	return true;
+}
+
+void Profiler::stop() {
+	if (!running.exchange(false)) {
+		return;
+	}
+	writer.join();
+	capture.store(false);
+	drain();
+	std::fputs("\n]\n", file);
+	std::fclose(file);
+	file = nullptr;
+}
+
+void Profiler::record(const char* name, int64_t start, int64_t end) {
+	ZoneBuffer* buffer = threadBuffer;
+	if (!buffer) {
+		buffer = new ZoneBuffer;
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffer->thread = buffers.size() + 1;
+		buffers.push_back(buffer);
+		threadBuffer = buffer;
+	}
+	buffer->push({name, start, end});
+}
+
+#endif
@@ -0,0 +1,112 @@
+#pragma once
+
+// Opt-in profiling of the per-sample hot paths, for finding where time goes in large patches.
+// Build with `make PROFILE=1` (which defines REBELTECH_PROFILE); otherwise the macros below
+// compile to nothing.
+//
+//   PROFILE_ZONE("Stoicheia");    times the rest of the enclosing scope (one zone per scope)
+//   PROFILE_PHASE("params");      starts a phase of that zone, ending the previous one
+//
+// Zones are recorded to a lock-free buffer per thread, which a background thread drains to a
+// Chrome trace (JSON array format, open in chrome://tracing or ui.perfetto.dev). So that traces
+// stay a manageable size, zones are only recorded during short capture windows (see
+// Profiler::Settings); outside them a zone costs one relaxed atomic load. The plugin writes
+// RebelTech-trace.json to the Rack user folder; tools/render has --trace.
+
+#ifdef REBELTECH_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <inttypes.h>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+class Profiler {
+public:
+	struct Settings {
+		// record for window seconds in every period (equal for continuous capture), for up to
+		// duration seconds in total: about 1M zones per engine thread in a large patch
+		float window = 0.002f;
+		float period = 1.f;
+		float duration = 10.f;
+	};
+
+	// starts the thread writing the trace to path; false if the file can't be written
+	static bool start(const std::string& path, const Settings& settings);
+	static bool start(const std::string& path) {
+		return start(path, Settings());
+	}
+	// records what is left, closes the trace and joins the writer thread
+	static void stop();
+
+	// set by the writer thread during capture windows
+	static std::atomic<bool> capture;
+
+	static bool capturing() {
+		return capture.load(std::memory_order_relaxed);
+	}
+
+	// timestamp in CPU counter ticks where there is a cheap counter (a few ns rather than tens
+	// for the steady clock), converted to time by the writer thread
+	static int64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#elif defined(__aarch64__)
+		int64_t ticks;
+		asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+		return ticks;
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	// adds a zone to this thread's buffer (registered with the writer on the thread's first zone),
+	// dropped if the buffer is full
+	static void record(const char* name, int64_t start, int64_t end);
+};
+
+class ProfileZone {
+public:
+	explicit ProfileZone(const char* name) : name(name), start(Profiler::capturing() ? Profiler::now() : -1) {}
+
+	~ProfileZone() {
+		if (start >= 0) {
+			const int64_t end = Profiler::now();
+			endPhase(end);
+			Profiler::record(name, start, end);
+		}
+	}
+
+	void phase(const char* phaseName) {
+		if (start >= 0) {
+			const int64_t now = Profiler::now();
+			endPhase(now);
+			phase_ = phaseName;
+			phaseStart = now;
+		}
+	}
+
+private:
+	const char* name;
+	int64_t start;
+	const char* phase_ = nullptr;
+	int64_t phaseStart = 0;
+
+	void endPhase(int64_t end) {
+		if (phase_) {
+			Profiler::record(phase_, phaseStart, end);
+		}
+	}
+};
+
+#define PROFILE_ZONE(name) ProfileZone profileZone(name)
+#define PROFILE_PHASE(name) profileZone.phase(name)
+
+#else
+
+#define PROFILE_ZONE(name)
+#define PROFILE_PHASE(name)
+
+#endif
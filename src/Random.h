@@ -0,0 +1,55 @@
+#pragma once
+#include <inttypes.h>
+
+// xoshiro128+ (Blackman and Vigna, https://prng.di.unimi.it/), a small and fast generator for
+// the audio thread. Its whole state is four words, so modules save it with the patch and a
+// render can be repeated exactly.
+struct Xoshiro128Plus {
+	uint32_t state[4];
+
+	explicit Xoshiro128Plus(uint64_t seed = 0) {
+		setSeed(seed);
+	}
+
+	// any seed (including 0) gives a valid state, via splitmix64
+	void setSeed(uint64_t seed) {
+		for (int i = 0; i < 4; i += 2) {
+			uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			z ^= z >> 31;
+			state[i] = (uint32_t) z;
+			state[i + 1] = (uint32_t)(z >> 32);
+		}
+	}
+
+	// restores a saved state, returns false (leaving the state as it was) if it is all zero,
+	// which xoshiro can't leave
+	bool setState(const uint32_t newState[4]) {
+		if (!(newState[0] | newState[1] | newState[2] | newState[3])) {
+			return false;
+		}
+		for (int i = 0; i < 4; ++i) {
+			state[i] = newState[i];
+		}
+		return true;
+	}
+
+	uint32_t next() {
+		const uint32_t result = state[0] + state[3];
+		const uint32_t t = state[1] << 9;
+		state[2] ^= state[0];
+		state[3] ^= state[1];
+		state[1] ^= state[2];
+		state[0] ^= state[3];
+		state[2] ^= t;
+		state[3] = (state[3] << 11) | (state[3] >> 21);
+		return result;
+	}
+
+	// true with probability p (0 - 1); uses the top 24 bits, as the lowest bits of xoshiro128+
+	// are the weakest
+	bool chance(float p) {
+		return (next() >> 8) * (1.f / 16777216.f) < p;
+	}
+};
@@ -1,8 +1,9 @@
 
 #include "plugin.hpp"
-#include "Sequence.h"
+#include "StoicheiaCore.h"
+#include "MidiExport.h"
 
-struct Stoicheia : Module {
+struct Stoicheia : Module, CacheAligned {
 	enum ParamIds {
 		START_A_PARAM,
 		START_B_PARAM,
@@ -13,6 +14,8 @@ struct Stoicheia : Module {
 		AB_MODE,
 		MODE_A_PARAM,
 		MODE_B_PARAM,
+		PROB_A_PARAM,
+		PROB_B_PARAM,
 		NUM_PARAMS
 	};
 	enum InputIds {
@@ -24,6 +27,7 @@ struct Stoicheia : Module {
 		OUT_A_OUTPUT,
 		OUT_B_OUTPUT,
 		CLOCK_THRU,
+		LOGIC_OUTPUT,
 		NUM_OUTPUTS
 	};
 	enum LightIds {
@@ -34,10 +38,8 @@ struct Stoicheia : Module {
 	};
 
 
-	enum ABMode {
-		INDEPENDENT,
-		ALTERNATING
-	};
+	typedef StoicheiaCore::ABMode ABMode;
+	typedef StoicheiaCore::SequenceMode SequenceMode;
 
 	struct FillParam : ParamQuantity {
 		// effective number of fills will depend on on the sequence length
@@ -120,35 +122,28 @@ struct Stoicheia : Module {
 	struct ABModeParam : ParamQuantity {
 		std::string getDisplayValueString() override {
 			switch (static_cast<ABMode>(getValue())) {
-				case INDEPENDENT: return "Independent A and B";
-				case ALTERNATING: return "Alternating A then B";
+				case StoicheiaCore::INDEPENDENT: return "Independent A and B";
+				case StoicheiaCore::ALTERNATING: return "Alternating A then B";
 				default: assert(false);
 			}
 		}
 	};
 
-	enum SequenceMode {
-		LATCHED,
-		MUTE,
-		NORMAL
-	};
-
-	struct SequenceParams {
-		int length = -1;
-		int fill = -1;
-		int start = -1;
-		SequenceMode mode;
-	};
-
-	// uint16_t for 16 steps
-	Sequence<uint16_t> seq[2];
-	dsp::SchmittTrigger triggers[NUM_INPUTS];
-	bool states[2] = {false};
-	int activeSequence = 0;
-	int combinedSequencePosition = 0;
-	SequenceParams oldA, currentA, oldB, currentB;
 	ModuleTheme theme = LIGHT_THEME;
 
+	StoicheiaCore core;
+	// with no cables patched the outputs only depend on the params, so processing can be skipped
+	IdleDetector idleDetector{NUM_PARAMS};
+	LightDivider<NUM_LIGHTS> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+	// copies of the core for MIDI export, see addMidiExportMenuItem()
+	std::shared_ptr<CoreCopy<StoicheiaCore>> coreCopy{new CoreCopy<StoicheiaCore>};
+	// patterns and playheads for the display
+	PatternPublisher patternPublisher;
+	// params of the sequences from expanders to the right (StoicheiaExpander.cpp)
+	StoicheiaChainParams chainMessages[2];
+
 	Stoicheia() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam<OffsetParam>(START_A_PARAM, 0.f, 1.f, 0.f, "Offset A");
@@ -161,9 +156,12 @@ struct Stoicheia : Module {
 
 		configParam<FillParam>(DENSITY_A_PARAM, 0.f, 1.f, 0.5f, "Fill density A");
 		configParam<FillParam>(DENSITY_B_PARAM, 0.f, 1.f, 0.5f, "Fill density B");
-		configParam<ABModeParam>(AB_MODE, INDEPENDENT, ALTERNATING, INDEPENDENT, "Sequence mode");
-		configSwitch(MODE_A_PARAM, LATCHED, NORMAL, NORMAL, "Mode A", {"Alternating", "Mute", "Trigger"});
-		configSwitch(MODE_B_PARAM, LATCHED, NORMAL, NORMAL, "Mode B", {"Alternating", "Mute", "Trigger"});
+		configParam<ABModeParam>(AB_MODE, StoicheiaCore::INDEPENDENT, StoicheiaCore::ALTERNATING, StoicheiaCore::INDEPENDENT, "Sequence mode");
+		configSwitch(MODE_A_PARAM, StoicheiaCore::LATCHED, StoicheiaCore::NORMAL, StoicheiaCore::NORMAL, "Mode A", {"Alternating", "Mute", "Trigger"});
+		configSwitch(MODE_B_PARAM, StoicheiaCore::LATCHED, StoicheiaCore::NORMAL, StoicheiaCore::NORMAL, "Mode B", {"Alternating", "Mute", "Trigger"});
+		// no panel controls, set from the context menu (with CV on the expander)
+		configParam(PROB_A_PARAM, 0.f, 1.f, 1.f, "Probability of each hit A", "%", 0.f, 100.f);
+		configParam(PROB_B_PARAM, 0.f, 1.f, 1.f, "Probability of each hit B", "%", 0.f, 100.f);
 
 		configInput(CLOCK_INPUT, "Clock");
 		configInput(RESET_INPUT, "Reset");
@@ -171,149 +169,126 @@ struct Stoicheia : Module {
 		configOutput(OUT_A_OUTPUT, "Sequence A");
 		configOutput(OUT_B_OUTPUT, "Sequence B");
 		configOutput(CLOCK_THRU, "Clock thru");
+		configOutput(LOGIC_OUTPUT, "A and B combined (logic mode in context menu)");
 
-		seq[0].offset = 0;
-		seq[0].calculate(12, 8);
-
-		seq[1].offset = 0;
-		seq[1].calculate(12, 8);
+		patternPublisher.pattern.numSequences = 2;
+		rightExpander.producerMessage = &chainMessages[0];
+		rightExpander.consumerMessage = &chainMessages[1];
+		// a different sequence of random choices for each instance, then saved with the patch
+		core.random.setSeed(random::u64());
 
 		theme = loadDefaultTheme();
 	}
 
 	void processBypass(const ProcessArgs& args) override {
-		triggers[CLOCK_INPUT].process(rescale(inputs[CLOCK_INPUT].getVoltage(), 0.1f, 2.f, 0.f, 1.f));
-		outputs[OUT_A_OUTPUT].setVoltage(triggers[CLOCK_INPUT].isHigh() * 10.f);
-		outputs[OUT_B_OUTPUT].setVoltage(triggers[CLOCK_INPUT].isHigh() * 10.f);
-		outputs[CLOCK_THRU].setVoltage(triggers[CLOCK_INPUT].isHigh() * 10.f);
+		core.clockTrigger.process(inputs[CLOCK_INPUT].getVoltage(), 0.1f, 2.f);
+		outputs[OUT_A_OUTPUT].setVoltage(core.clockTrigger.isHigh() * 10.f);
+		outputs[OUT_B_OUTPUT].setVoltage(core.clockTrigger.isHigh() * 10.f);
+		outputs[CLOCK_THRU].setVoltage(core.clockTrigger.isHigh() * 10.f);
+		outputs[LOGIC_OUTPUT].setVoltage(core.clockTrigger.isHigh() * 10.f);
 	}
 
 	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("Stoicheia");
 
-		if (triggers[RESET_INPUT].process(rescale(inputs[RESET_INPUT].getVoltage(), 0.1f, 2.f, 0.f, 1.f))) {
-			seq[0].reset();
-			seq[1].reset();
-			combinedSequencePosition = 0;
+		edgeCapture.process(this, args);
+		coreCopy->serve(core);
+		if (idleDetector.process(this)) {
+			return;
 		}
 
+		PROFILE_PHASE("params");
 		ABMode mode = static_cast<ABMode>(params[AB_MODE].getValue());
 
-		// update params of sequence A (if changed)
-		currentA.length = params[LENGTH_A_PARAM].getValue();
-		currentA.fill = paramToFill(params[DENSITY_A_PARAM].getValue(), currentA.length);
-		currentA.start = paramToOffset(params[START_A_PARAM].getValue(), currentA.length);
-		currentA.mode = static_cast<SequenceMode>(params[MODE_A_PARAM].getValue());
-		if (currentA.length != oldA.length || currentA.fill != oldA.fill) {
-			seq[0].calculate(currentA.length, currentA.fill);
-		}
-		if (currentA.start != oldA.start) {
-			seq[0].rotate(currentA.start);
-		}
-		// update params of sequence B (if changed)
-		currentB.length = params[LENGTH_B_PARAM].getValue();
-		currentB.fill = paramToFill(params[DENSITY_B_PARAM].getValue(), currentB.length);
-		currentB.start = paramToOffset(params[START_B_PARAM].getValue(), currentB.length);
-		currentB.mode = static_cast<SequenceMode>(params[MODE_B_PARAM].getValue());
-		if (currentB.length != oldB.length || currentB.fill != oldB.fill) {
-			seq[1].calculate(currentB.length, currentB.fill);
-		}
-		if (currentB.start != oldB.start) {
-			seq[1].rotate(currentB.start);
-		}
-
-		const bool risingEdge = triggers[CLOCK_INPUT].process(rescale(inputs[CLOCK_INPUT].getVoltage(), 0.1f, 2.f, 0.f, 1.f));
-		const float clockIn = 10.f * triggers[CLOCK_INPUT].isHigh();
-
-		float outA = 0.f, outB = 0.f;
-		if (mode == INDEPENDENT) {
-			if (risingEdge) {
-				states[0] = seq[0].next();
-				states[1] = seq[1].next();
-			}
-
-			if (currentA.mode == NORMAL) {
-				outA = states[0] * clockIn;
-			}
-			else if (currentA.mode == LATCHED) {
-				outA = states[0] * 10.f;
-			}
-			else {
-				outA = 0.f;
-			}
-
-			if (currentB.mode == NORMAL) {
-				outB = states[1] * clockIn;
-			}
-			else if (currentB.mode == LATCHED) {
-				outB = states[1] * 10.f;
-			}
-			else {
-				outB = 0.f;
+		// update params of sequence A
+		const int lengthA = params[LENGTH_A_PARAM].getValue();
+		core.setParams(0, lengthA,
+		               paramToFill(params[DENSITY_A_PARAM].getValue(), lengthA),
+		               paramToOffset(params[START_A_PARAM].getValue(), lengthA),
+		               static_cast<SequenceMode>(params[MODE_A_PARAM].getValue()));
+		// update params of sequence B
+		const int lengthB = params[LENGTH_B_PARAM].getValue();
+		core.setParams(1, lengthB,
+		               paramToFill(params[DENSITY_B_PARAM].getValue(), lengthB),
+		               paramToOffset(params[START_B_PARAM].getValue(), lengthB),
+		               static_cast<SequenceMode>(params[MODE_B_PARAM].getValue()));
+
+		// sequences C, D, ... and the probability CV of A and B from expanders
+		Module* expander = rightExpander.module;
+		const bool expanded = expander && expander->model == modelStoicheiaExpander;
+		core.numSequences = 2;
+		float probCV[2] = {0.f, 0.f};
+		if (expanded) {
+			const StoicheiaChainParams* chain = static_cast<const StoicheiaChainParams*>(rightExpander.consumerMessage);
+			for (int i = 0; i < chain->numSequences; ++i) {
+				const StoicheiaCore::SequenceParams& p = chain->params[i];
+				core.setParams(core.numSequences++, p.length, p.fill, p.start, p.mode);
 			}
-
+			probCV[0] = chain->probCV[0];
+			probCV[1] = chain->probCV[1];
 		}
-		else if (mode == ALTERNATING) {
 
-			if (risingEdge) {
+		// CV of +/-10V adds +/-100% to the menu setting
+		core.setProbability(0, params[PROB_A_PARAM].getValue() + probCV[0] / 10.f);
+		core.setProbability(1, params[PROB_B_PARAM].getValue() + probCV[1] / 10.f);
 
-				if (++combinedSequencePosition >= seq[0].length + seq[1].length) {
-					combinedSequencePosition = 0;
-				}
-				if (combinedSequencePosition < seq[0].length) {
-					activeSequence = 0;
-					states[activeSequence] = seq[activeSequence].next();
-				}
-				else {
-					activeSequence = 1;
-					states[activeSequence] = seq[activeSequence].next();
-				}
-			}
-
-			if (currentA.mode == NORMAL) {
-				outA = states[activeSequence] * clockIn;
-			}
-			else if (currentA.mode == LATCHED) {
-				outA = states[activeSequence] * 10.f;
-			}
-			else {
-				outA = 0.f;
-			}
-			if (currentB.mode == NORMAL) {
-				outB = states[activeSequence] * clockIn;
-			}
-			else if (currentB.mode == LATCHED) {
-				outB = states[activeSequence] * 10.f;
-			}
-			else {
-				outB = 0.f;
-			}
+		PROFILE_PHASE("core");
+		core.process(inputs[CLOCK_INPUT].getVoltage(), inputs[RESET_INPUT].getVoltage(), mode);
 
+		PROFILE_PHASE("outputs");
+		if (expanded) {
+			StoicheiaChainState* state = static_cast<StoicheiaChainState*>(expander->leftExpander.producerMessage);
+			state->first = 2;
+			state->set(core, mode);
+			expander->leftExpander.requestMessageFlip();
 		}
 
-		outputs[OUT_A_OUTPUT].setVoltage(outA);
-		lights[A_LIGHT].setBrightness(outA / 10.f);
-		oldA = currentA;
+		outputs[OUT_A_OUTPUT].setVoltage(core.outA);
+		outputs[OUT_B_OUTPUT].setVoltage(core.outB);
+		outputs[CLOCK_THRU].setVoltage(core.clockThru);
+		outputs[LOGIC_OUTPUT].setVoltage(core.outLogic);
 
-		outputs[OUT_B_OUTPUT].setVoltage(outB);
-		lights[B_LIGHT].setBrightness(outB / 10.f);
-		oldB = currentB;
+		// not || as every set() must run
+		if (patternPublisher.pattern.set(0, core.seq[0]) | patternPublisher.pattern.set(1, core.seq[1]) |
+		        patternPublisher.pattern.setActive(mode == StoicheiaCore::ALTERNATING ? core.activeSequence : -1)) {
+			patternPublisher.publish();
+		}
 
-		lights[A_AND_B_LIGHT].setBrightness(clockIn / 10.f);
-		outputs[CLOCK_THRU].setVoltage(triggers[CLOCK_INPUT].isHigh() * 10.f);
+		PROFILE_PHASE("lights");
+		lightDivider.accumulate(A_LIGHT, core.outA / 10.f);
+		lightDivider.accumulate(B_LIGHT, core.outB / 10.f);
+		lightDivider.accumulate(A_AND_B_LIGHT, core.clockThru / 10.f);
+		if (lightDivider.process()) {
+			lightDivider.setBrightness(lights[A_LIGHT], A_LIGHT);
+			lightDivider.setBrightness(lights[B_LIGHT], B_LIGHT);
+			lightDivider.setBrightness(lights[A_AND_B_LIGHT], A_AND_B_LIGHT);
+		}
 
+		if (idleDetector.update(this, true, args.sampleTime)) {
+			lightDivider.reset();
+		}
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
 		json_t* themeJ = json_object_get(rootJ, "theme");
 		if (themeJ) {
 			theme = (ModuleTheme) json_integer_value(themeJ);
 		}
+		json_t* logicModeJ = json_object_get(rootJ, "logicMode");
+		if (logicModeJ) {
+			core.logicMode = (StoicheiaCore::LogicMode) json_integer_value(logicModeJ);
+		}
+		randomStateFromJson(json_object_get(rootJ, "random"), core.random);
 	}
 
 	json_t* dataToJson() override {
 		json_t* rootJ = json_object();
 		json_object_set_new(rootJ, "theme", json_integer(theme));
+		json_object_set_new(rootJ, "logicMode", json_integer(core.logicMode));
+		json_object_set_new(rootJ, "random", randomStateToJson(core.random));
 
+		edgeCapture.toJson(rootJ);
 		return rootJ;
 	}
 };
@@ -350,10 +325,28 @@ struct StoicheiaWidget : RebelTechModuleWidget {
 		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(18.925, 108.712)), module, Stoicheia::OUT_A_OUTPUT));
 		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(31.625, 108.712)), module, Stoicheia::OUT_B_OUTPUT));
 		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(44.326, 108.712)), module, Stoicheia::CLOCK_THRU));
+		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(44.326, 96.026)), module, Stoicheia::LOGIC_OUTPUT));
 
 		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(25.275, 70.625)), module, Stoicheia::A_AND_B_LIGHT));
 		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(12.574, 83.308)), module, Stoicheia::A_LIGHT));
 		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(37.976, 83.326)), module, Stoicheia::B_LIGHT));
+
+		PatternDisplay* display = createWidget<PatternDisplay>(mm2px(Vec(22.225, 23.5)));
+		display->setSize(mm2px(Vec(6.1, 41.0)));
+		display->layout = PatternDisplay::COLUMNS;
+		if (module) {
+			display->buffer = &module->patternPublisher.buffer;
+		}
+		else {
+			Sequence<uint16_t> preview;
+			preview.offset = 0;
+			preview.calculate(16, 5);
+			display->snapshot.numSequences = 2;
+			display->snapshot.set(0, preview);
+			preview.calculate(12, 7);
+			display->snapshot.set(1, preview);
+		}
+		addChild(display);
 	}
 
 
@@ -369,6 +362,18 @@ struct StoicheiaWidget : RebelTechModuleWidget {
 		Stoicheia* module = dynamic_cast<Stoicheia*>(this->module);
 		assert(module);
 
+		menu->addChild(createSubmenuItem("Probability", "", [=](Menu* menu) {
+			for (int id : {Stoicheia::PROB_A_PARAM, Stoicheia::PROB_B_PARAM}) {
+				ui::Slider* slider = new ui::Slider();
+				slider->quantity = module->getParamQuantity(id);
+				slider->box.size.x = 200.f;
+				menu->addChild(slider);
+			}
+		}));
+		menu->addChild(createIndexPtrSubmenuItem("Logic output", {"A AND B", "A OR B", "A XOR B", "NOT A", "NOT B"}, &module->core.logicMode));
+		addMidiExportMenuItem(menu, module->coreCopy, "Stoicheia", &MidiExport::render);
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
 		addThemeMenuItems(menu, &module->theme);
 	}
 };
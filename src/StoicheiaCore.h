@@ -0,0 +1,284 @@
+#pragma once
+#include <algorithm>
+#include "Sequence.h"
+#include "ClockTrigger.h"
+#include "Random.h"
+#include "CacheAligned.h"
+#include "Profiler.h"
+
+// Rack-independent DSP for Stoicheia, used by both the module (Stoicheia.cpp) and the offline
+// tools (see tools/)
+
+struct alignas(cacheLineSize) StoicheiaCore {
+
+	// A and B, then up to 8 more from expanders (C, D, ...), which only join the chain of the
+	// alternating mode and play in trigger mode
+	static const int maxSequences = 10;
+
+	enum ABMode {
+		INDEPENDENT,
+		ALTERNATING
+	};
+
+	enum SequenceMode {
+		LATCHED,
+		MUTE,
+		NORMAL
+	};
+
+	// logic output, combining the latest step of A and B
+	enum LogicMode {
+		LOGIC_AND,
+		LOGIC_OR,
+		LOGIC_XOR,
+		LOGIC_NOT_A,
+		LOGIC_NOT_B,
+		LOGIC_MODE_LEN
+	};
+
+	struct SequenceParams {
+		int length = -1;
+		int fill = -1;
+		int start = -1;
+		SequenceMode mode;
+	};
+
+	// output voltages
+	float outA = 0.f;
+	float outB = 0.f;
+	float clockThru = 0.f;
+	float outLogic = 0.f;
+
+	// uint16_t for 16 steps
+	Sequence<uint16_t> seq[maxSequences];
+	int numSequences = 2;
+	ClockTrigger clockTrigger, resetTrigger;
+	bool states[maxSequences] = {false};
+	LogicMode logicMode = LOGIC_AND;
+	bool logicState = false;
+	int activeSequence = 0;
+	// position in the chain of all sequences (alternating mode), playing activeSequence
+	int combinedSequencePosition = 0;
+	SequenceParams oldParams[maxSequences], currentParams[maxSequences];
+	// each hit of sequence i fires with this probability, drawn from random (only on hits)
+	float probability[maxSequences] = {1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f, 1.f};
+	Xoshiro128Plus random;
+
+	// the per-sample work is done by one of 2 x 3 x 3 kernels, specialised at compile time on
+	// the AB mode and the mode of each sequence, and only re-selected when a switch changes
+	typedef void (StoicheiaCore::*Kernel)(bool risingEdge, float clockHigh);
+	Kernel kernel = nullptr;
+	ABMode kernelABMode = INDEPENDENT;
+	SequenceMode kernelModes[2] = {NORMAL, NORMAL};
+
+	StoicheiaCore() {
+		for (int i = 0; i < maxSequences; ++i) {
+			seq[i].offset = 0;
+			seq[i].calculate(12, 8);
+		}
+
+		selectKernel(kernelABMode, kernelModes[0], kernelModes[1]);
+	}
+
+	// set params for sequence A (0), B (1) or one from an expander, the pattern is recalculated in process() if changed
+	void setParams(int i, int length, int fill, int start, SequenceMode mode) {
+		currentParams[i].length = length;
+		currentParams[i].fill = fill;
+		currentParams[i].start = start;
+		currentParams[i].mode = mode;
+	}
+
+	// for sequence i, range 0 - 1, includes CV
+	void setProbability(int i, float p) {
+		probability[i] = std::min(std::max(p, 0.f), 1.f);
+	}
+
+	// truth table of a logic mode, bit (a + 2b) is the output for steps a and b
+	static uint8_t truthTable(LogicMode mode) {
+		switch (mode) {
+			case LOGIC_OR: return 0xe;
+			case LOGIC_XOR: return 0x6;
+			case LOGIC_NOT_A: return 0x5;
+			case LOGIC_NOT_B: return 0x3;
+			case LOGIC_AND:
+			default: return 0x8;
+		}
+	}
+
+	// evaluated once per clock, so the per-sample cost is the same as for A and B
+	bool logic(bool a, bool b) const {
+		return (truthTable(logicMode) >> (a | b << 1)) & 1;
+	}
+
+	// next step of sequence i, with hits dropped at random
+	bool nextStep(int i) {
+		return seq[i].next() && random.chance(probability[i]);
+	}
+
+	// number of steps in the chain of all sequences
+	int chainLength() const {
+		int total = 0;
+		for (int i = 0; i < numSequences; ++i) {
+			total += seq[i].length;
+		}
+		return total;
+	}
+
+	// the sequence playing the given position of the chain
+	int sequenceAt(int position) const {
+		int i = 0;
+		while (i < numSequences - 1 && position >= seq[i].length) {
+			position -= seq[i].length;
+			++i;
+		}
+		return i;
+	}
+
+	void process(float clockIn, float resetIn, ABMode mode) {
+		PROFILE_ZONE("StoicheiaCore");
+
+		PROFILE_PHASE("reset");
+		if (resetTrigger.process(resetIn, 0.1f, 2.f)) {
+			for (int i = 0; i < maxSequences; ++i) {
+				seq[i].reset();
+			}
+			combinedSequencePosition = 0;
+		}
+
+		// update params of all sequences (if changed)
+		PROFILE_PHASE("sequence");
+		for (int i = 0; i < numSequences; ++i) {
+			if (currentParams[i].length != oldParams[i].length || currentParams[i].fill != oldParams[i].fill) {
+				seq[i].calculate(currentParams[i].length, currentParams[i].fill);
+			}
+			if (currentParams[i].start != oldParams[i].start) {
+				seq[i].rotate(currentParams[i].start);
+			}
+		}
+
+		if (mode != kernelABMode || currentParams[0].mode != kernelModes[0] || currentParams[1].mode != kernelModes[1]) {
+			selectKernel(mode, currentParams[0].mode, currentParams[1].mode);
+		}
+
+		PROFILE_PHASE("clock");
+		const bool risingEdge = clockTrigger.process(clockIn, 0.1f, 2.f);
+		const float clockHigh = 10.f * clockTrigger.isHigh();
+
+		(this->*kernel)(risingEdge, clockHigh);
+
+		for (int i = 0; i < numSequences; ++i) {
+			oldParams[i] = currentParams[i];
+		}
+
+		clockThru = clockHigh;
+	}
+
+	void selectKernel(ABMode mode, SequenceMode modeA, SequenceMode modeB) {
+		kernelABMode = mode;
+		kernelModes[0] = modeA;
+		kernelModes[1] = modeB;
+		kernel = (mode == ALTERNATING) ? kernelForA<ALTERNATING>(modeA, modeB) : kernelForA<INDEPENDENT>(modeA, modeB);
+	}
+
+	template <ABMode AB, SequenceMode MODE_A>
+	static Kernel kernelForB(SequenceMode modeB) {
+		switch (modeB) {
+			case LATCHED: return &StoicheiaCore::kernelFor<AB, MODE_A, LATCHED>;
+			case MUTE: return &StoicheiaCore::kernelFor<AB, MODE_A, MUTE>;
+			case NORMAL:
+			default: return &StoicheiaCore::kernelFor<AB, MODE_A, NORMAL>;
+		}
+	}
+
+	template <ABMode AB>
+	static Kernel kernelForA(SequenceMode modeA, SequenceMode modeB) {
+		switch (modeA) {
+			case LATCHED: return kernelForB<AB, LATCHED>(modeB);
+			case MUTE: return kernelForB<AB, MUTE>(modeB);
+			case NORMAL:
+			default: return kernelForB<AB, NORMAL>(modeB);
+		}
+	}
+
+	// output for a sequence in the given mode (resolved at compile time)
+	template <SequenceMode MODE>
+	static float output(bool state, float clockHigh) {
+		switch (MODE) {
+			case NORMAL: return state * clockHigh;
+			case LATCHED: return state * 10.f;
+			case MUTE:
+			default: return 0.f;
+		}
+	}
+
+	template <ABMode AB, SequenceMode MODE_A, SequenceMode MODE_B>
+	void kernelFor(bool risingEdge, float clockHigh) {
+		if (AB == INDEPENDENT) {
+			if (risingEdge) {
+				states[0] = nextStep(0);
+				states[1] = nextStep(1);
+				for (int i = 2; i < numSequences; ++i) {
+					states[i] = nextStep(i);
+				}
+				logicState = logic(states[0], states[1]);
+			}
+
+			outA = output<MODE_A>(states[0], clockHigh);
+			outB = output<MODE_B>(states[1], clockHigh);
+		}
+		else {
+			if (risingEdge) {
+
+				if (++combinedSequencePosition >= chainLength()) {
+					combinedSequencePosition = 0;
+				}
+				activeSequence = sequenceAt(combinedSequencePosition);
+				states[activeSequence] = nextStep(activeSequence);
+				// only the sequence being clocked has a step, the other counts as a rest, and the
+				// logic output stays low while the chain is on an expander's sequences
+				logicState = (activeSequence < 2) && logic(activeSequence == 0 && states[0], activeSequence == 1 && states[1]);
+			}
+
+			// A and B play the whole chain, expanders only their own sequences
+			outA = output<MODE_A>(states[activeSequence], clockHigh);
+			outB = output<MODE_B>(states[activeSequence], clockHigh);
+		}
+
+		outLogic = logicState * clockHigh;
+	}
+};
+
+// Messages between Stoicheia and its expanders (StoicheiaExpander.cpp), which sit to its right,
+// each adding two sequences. Params are passed leftwards: each expander sends its own sequences
+// followed by those received from its right. The state of the chain is passed rightwards, each
+// expander forwarding it with `first` moved on past its own sequences.
+struct StoicheiaChainParams {
+	static const int maxSequences = StoicheiaCore::maxSequences - 2;
+
+	int numSequences = 0;
+	StoicheiaCore::SequenceParams params[maxSequences];
+	// probability CV (V) of A and B, from the expander next to Stoicheia
+	float probCV[2] = {0.f, 0.f};
+};
+
+struct StoicheiaChainState {
+	// index in the chain of the receiving expander's first sequence
+	int first = 2;
+	// the sequence being clocked (alternating mode), -1 if all are
+	int active = -1;
+	bool states[StoicheiaCore::maxSequences] = {false};
+	float clockHigh = 0.f;
+
+	void set(const StoicheiaCore& core, StoicheiaCore::ABMode mode) {
+		active = (mode == StoicheiaCore::ALTERNATING) ? core.activeSequence : -1;
+		for (int i = 0; i < core.numSequences; ++i) {
+			states[i] = core.states[i];
+		}
+		clockHigh = core.clockThru;
+	}
+
+	// trigger output for sequence i of the chain
+	float output(int i) const {
+		return (states[i] && (active < 0 || active == i)) * clockHigh;
+	}
+};
@@ -0,0 +1,269 @@
+#include "plugin.hpp"
+#include "StoicheiaCore.h"
+
+// Adds two sequences to Stoicheia: C and D when placed directly to its right, then E and F for
+// a second expander to the right of the first, and so on (up to 4 expanders). In alternating mode
+// Stoicheia plays A, B, C, D, ... as one chain; in independent mode each sequence is clocked on
+// every step. Nothing is patched between the modules: params and pattern state are exchanged
+// through expander messages (see StoicheiaChainParams / StoicheiaChainState). The expander next
+// to Stoicheia also takes the probability CV of A and B, for which Stoicheia has no room. Placed
+// directly to the right of Klasmata instead, it only passes on PROB A, as Klasmata's probability CV.
+struct StoicheiaExpander : Module, CacheAligned {
+	enum ParamIds {
+		START_C_PARAM,
+		START_D_PARAM,
+		LENGTH_C_PARAM,
+		LENGTH_D_PARAM,
+		DENSITY_C_PARAM,
+		DENSITY_D_PARAM,
+		NUM_PARAMS
+	};
+	enum InputIds {
+		PROB_A_INPUT,
+		PROB_B_INPUT,
+		NUM_INPUTS
+	};
+	enum OutputIds {
+		OUT_C_OUTPUT,
+		OUT_D_OUTPUT,
+		NUM_OUTPUTS
+	};
+	enum LightIds {
+		CHAIN_LIGHT,
+		C_LIGHT,
+		D_LIGHT,
+		NUM_LIGHTS
+	};
+
+	struct FillParam : ParamQuantity {
+		// effective number of fills will depend on on the sequence length
+		std::string getDisplayValueString() override {
+			if (module != nullptr) {
+				const int length = module->params[LENGTH_C_PARAM + paramId - DENSITY_C_PARAM].getValue();
+				return std::to_string(paramToFill(getValue(), length));
+			}
+			else {
+				return "";
+			}
+		}
+
+		void setDisplayValueString(std::string s) override {
+			float fill = std::atof(s.c_str());
+			if (module != nullptr) {
+				const int length = module->params[LENGTH_C_PARAM + paramId - DENSITY_C_PARAM].getValue();
+				ParamQuantity::setValue(fillToParam(fill, length));
+			}
+		}
+	};
+
+	struct OffsetParam : ParamQuantity {
+		// effective offset will depend on on the sequence length
+		std::string getDisplayValueString() override {
+			if (module != nullptr) {
+				const int length = module->params[LENGTH_C_PARAM + paramId - START_C_PARAM].getValue();
+				return std::to_string(paramToOffset(getValue(), length));
+			}
+			else {
+				return "";
+			}
+		}
+
+		void setDisplayValueString(std::string s) override {
+			float offset = std::atof(s.c_str());
+			if (module != nullptr) {
+				const int length = module->params[LENGTH_C_PARAM + paramId - START_C_PARAM].getValue();
+				ParamQuantity::setValue(offsetToParam(offset, length));
+			}
+		}
+	};
+
+	ModuleTheme theme = LIGHT_THEME;
+
+	// message buffers, owned by the receiving module: chain state from the left, params from the right
+	StoicheiaChainState stateMessages[2];
+	StoicheiaChainParams paramsMessages[2];
+	LightDivider<NUM_LIGHTS> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+
+	StoicheiaExpander() {
+		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+		configParam<OffsetParam>(START_C_PARAM, 0.f, 1.f, 0.f, "Offset C");
+		configParam<OffsetParam>(START_D_PARAM, 0.f, 1.f, 0.f, "Offset D");
+
+		auto lengthC = configParam(LENGTH_C_PARAM, 1.f, 16.f, 1.f, "Length C");
+		lengthC->snapEnabled = true;
+		auto lengthD = configParam(LENGTH_D_PARAM, 1.f, 16.f, 1.f, "Length D");
+		lengthD->snapEnabled = true;
+
+		configParam<FillParam>(DENSITY_C_PARAM, 0.f, 1.f, 0.5f, "Fill density C");
+		configParam<FillParam>(DENSITY_D_PARAM, 0.f, 1.f, 0.5f, "Fill density D");
+
+		configInput(PROB_A_INPUT, "Probability A CV (Stoicheia A, or Klasmata, when next to it)");
+		configInput(PROB_B_INPUT, "Probability B CV (Stoicheia B, when next to it)");
+
+		configOutput(OUT_C_OUTPUT, "Sequence C (while it is playing)");
+		configOutput(OUT_D_OUTPUT, "Sequence D (while it is playing)");
+
+		configLight(CHAIN_LIGHT, "Connected to Stoicheia (or Klasmata)");
+
+		leftExpander.producerMessage = &stateMessages[0];
+		leftExpander.consumerMessage = &stateMessages[1];
+		rightExpander.producerMessage = &paramsMessages[0];
+		rightExpander.consumerMessage = &paramsMessages[1];
+
+		theme = loadDefaultTheme();
+	}
+
+	static bool isChainModule(Module* module) {
+		return module && (module->model == modelStoicheia || module->model == modelStoicheiaExpander);
+	}
+
+	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("StoicheiaExpander");
+
+		edgeCapture.process(this, args);
+
+		PROFILE_PHASE("params");
+		Module* left = leftExpander.module;
+		Module* right = rightExpander.module;
+		const bool chained = isChainModule(left);
+		const bool extended = right && right->model == modelStoicheiaExpander;
+		const bool klasmata = left && left->model == modelKlasmata;
+
+		// params of this expander's sequences, followed by those from the right, go to the left
+		if (chained) {
+			StoicheiaChainParams* toLeft = static_cast<StoicheiaChainParams*>(left->rightExpander.producerMessage);
+			for (int i = 0; i < 2; ++i) {
+				const int length = params[LENGTH_C_PARAM + i].getValue();
+				toLeft->params[i].length = length;
+				toLeft->params[i].fill = paramToFill(params[DENSITY_C_PARAM + i].getValue(), length);
+				toLeft->params[i].start = paramToOffset(params[START_C_PARAM + i].getValue(), length);
+				toLeft->params[i].mode = StoicheiaCore::NORMAL;
+			}
+			int numSequences = 2;
+			if (extended) {
+				const StoicheiaChainParams* fromRight = static_cast<const StoicheiaChainParams*>(rightExpander.consumerMessage);
+				for (int i = 0; i < fromRight->numSequences && numSequences < StoicheiaChainParams::maxSequences; ++i) {
+					toLeft->params[numSequences++] = fromRight->params[i];
+				}
+			}
+			toLeft->numSequences = numSequences;
+			// only read by Stoicheia, from the expander next to it
+			toLeft->probCV[0] = inputs[PROB_A_INPUT].getVoltage();
+			toLeft->probCV[1] = inputs[PROB_B_INPUT].getVoltage();
+			left->rightExpander.requestMessageFlip();
+		}
+		else if (klasmata) {
+			// only the probability CV, Klasmata has no chain
+			StoicheiaChainParams* toLeft = static_cast<StoicheiaChainParams*>(left->rightExpander.producerMessage);
+			toLeft->probCV[0] = inputs[PROB_A_INPUT].getVoltage();
+			left->rightExpander.requestMessageFlip();
+		}
+
+		// state of the chain, or of none if this expander isn't part of one
+		PROFILE_PHASE("outputs");
+		StoicheiaChainState state;
+		if (chained) {
+			state = *static_cast<const StoicheiaChainState*>(leftExpander.consumerMessage);
+		}
+		else {
+			state.first = StoicheiaCore::maxSequences;
+		}
+		// sequences after the 10th are dropped
+		const bool inChain = state.first + 2 <= StoicheiaCore::maxSequences;
+
+		for (int i = 0; i < 2; ++i) {
+			const float out = inChain ? state.output(state.first + i) : 0.f;
+			outputs[OUT_C_OUTPUT + i].setVoltage(out);
+			lightDivider.accumulate(C_LIGHT + i, out / 10.f);
+		}
+		lightDivider.accumulate(CHAIN_LIGHT, inChain || klasmata);
+
+		if (extended) {
+			StoicheiaChainState* toRight = static_cast<StoicheiaChainState*>(right->leftExpander.producerMessage);
+			*toRight = state;
+			toRight->first = state.first + 2;
+			right->leftExpander.requestMessageFlip();
+		}
+
+		PROFILE_PHASE("lights");
+		if (lightDivider.process()) {
+			lightDivider.setBrightness(lights[CHAIN_LIGHT], CHAIN_LIGHT);
+			lightDivider.setBrightness(lights[C_LIGHT], C_LIGHT);
+			lightDivider.setBrightness(lights[D_LIGHT], D_LIGHT);
+		}
+	}
+
+	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
+		json_t* themeJ = json_object_get(rootJ, "theme");
+		if (themeJ) {
+			theme = (ModuleTheme) json_integer_value(themeJ);
+		}
+	}
+
+	json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "theme", json_integer(theme));
+
+		edgeCapture.toJson(rootJ);
+		return rootJ;
+	}
+};
+
+
+
+struct StoicheiaExpanderWidget : RebelTechModuleWidget {
+
+	StoicheiaExpanderWidget(StoicheiaExpander* module) : RebelTechModuleWidget("res/panels/StoicheiaExpander.svg", "res/panels/StoicheiaExpander_drk.svg") {
+		setModule(module);
+		setPanel(lightSvg);
+
+		screws.push_back(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
+		screws.push_back(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, 0)));
+		screws.push_back(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+		screws.push_back(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
+		for (auto screw : screws) {
+			addChild(screw);
+		}
+
+		addParam(createParamCentered<RebelTechSmallPot>(mm2px(Vec(8.0, 26.174)), module, StoicheiaExpander::START_C_PARAM));
+		addParam(createParamCentered<RebelTechSmallPot>(mm2px(Vec(22.48, 26.174)), module, StoicheiaExpander::START_D_PARAM));
+		addParam(createParamCentered<RebelTechSmallPot>(mm2px(Vec(8.0, 45.374)), module, StoicheiaExpander::LENGTH_C_PARAM));
+		addParam(createParamCentered<RebelTechSmallPot>(mm2px(Vec(22.48, 45.374)), module, StoicheiaExpander::LENGTH_D_PARAM));
+		addParam(createParamCentered<RebelTechSmallPot>(mm2px(Vec(8.0, 64.574)), module, StoicheiaExpander::DENSITY_C_PARAM));
+		addParam(createParamCentered<RebelTechSmallPot>(mm2px(Vec(22.48, 64.574)), module, StoicheiaExpander::DENSITY_D_PARAM));
+
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(8.0, 91.0)), module, StoicheiaExpander::PROB_A_INPUT));
+		addInput(createInputCentered<BefacoInputPort>(mm2px(Vec(22.48, 91.0)), module, StoicheiaExpander::PROB_B_INPUT));
+
+		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(8.0, 108.712)), module, StoicheiaExpander::OUT_C_OUTPUT));
+		addOutput(createOutputCentered<BefacoOutputPort>(mm2px(Vec(22.48, 108.712)), module, StoicheiaExpander::OUT_D_OUTPUT));
+
+		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(15.24, 74.5)), module, StoicheiaExpander::CHAIN_LIGHT));
+		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(8.0, 100.5)), module, StoicheiaExpander::C_LIGHT));
+		addChild(createLightCentered<MediumLight<YellowLight>>(mm2px(Vec(22.48, 100.5)), module, StoicheiaExpander::D_LIGHT));
+	}
+
+
+	void draw(const DrawArgs& args) override {
+
+		StoicheiaExpander* module = dynamic_cast<StoicheiaExpander*>(this->module);
+		updateComponentsForTheme<StoicheiaExpander>(module, this, theme);
+		ModuleWidget::draw(args);
+	}
+
+
+	void appendContextMenu(Menu* menu) override {
+		StoicheiaExpander* module = dynamic_cast<StoicheiaExpander*>(this->module);
+		assert(module);
+
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
+		addThemeMenuItems(menu, &module->theme);
+	}
+};
+
+
+Model* modelStoicheiaExpander = createModel<StoicheiaExpander, StoicheiaExpanderWidget>("StoicheiaExpander");
@@ -2,7 +2,7 @@
 
 using namespace simd;
 
-struct Tonic : Module {
+struct Tonic : Module, CacheAligned {
 	enum ParamIds {
 		SCALE_PARAM,
 		ENUMS(BUTTON, 6),
@@ -22,12 +22,18 @@ struct Tonic : Module {
 		NUM_LIGHTS
 	};
 
-	SchmittTrigger4 triggers[6][4];
 	static constexpr float semitone = 1.f / 12.f;    // one semitone is a 1/12 volt
 
 	const int numSemitones[6] = {0, 16, 8, 4, 2, -1};
 	ModuleTheme theme = LIGHT_THEME;
 
+	// per-sample state, on its own cache lines
+	alignas(cacheLineSize) SchmittTrigger4 triggers[6][4];
+	// one accumulator per button/gate (not per RGB channel), summed over polyphony blocks
+	LightDivider<6, float_4> lightDivider;
+	// "Record edges" flight recorder, off unless enabled from the menu
+	EdgeCapture edgeCapture;
+
 	Tonic() {
 		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
 		configParam(SCALE_PARAM, -6.f, 12.f, 0.f, "Custom offset", " semitones");
@@ -47,7 +53,11 @@ struct Tonic : Module {
 	}
 
 	void process(const ProcessArgs& args) override {
+		PROFILE_ZONE("Tonic");
+
+		edgeCapture.process(this, args);
 
+		PROFILE_PHASE("params");
 		int numPolyphonyEngines = 1;
 		for (int i = 0; i < ParamIds::BUTTON_LAST; ++i) {
 			numPolyphonyEngines = std::max(numPolyphonyEngines, inputs[i].getChannels());
@@ -58,7 +68,6 @@ struct Tonic : Module {
 
 		for (int i = 0; i < ParamIds::BUTTON_LAST; ++i) {
 
-			float stateForLight = 0.f;
 			// process polyphony in blocks of 4 channels (simd)
 			for (int c = 0; c < numPolyphonyEngines; c += 4) {
 
@@ -77,28 +86,33 @@ struct Tonic : Module {
 
 				globalState[c / 4] = ifelse(globalState[c / 4], globalState[c / 4], state);
 
-				// SSE3 simd: put sum in all elements, https://stackoverflow.com/a/6996992/251715
-				state.v = _mm_hadd_ps(state.v, state.v);
-				state.v = _mm_hadd_ps(state.v, state.v);
-				stateForLight += state[0];
+				// lanes are summed (and averaged over channels) when the lights are written
+				lightDivider.accumulate(i, state);
 			}
-			stateForLight /= numPolyphonyEngines;
+		}
 
-			if (numPolyphonyEngines == 1) {
-				// mono is yellow (like the hardware)
-				lights[LED + 3 * i + 0].setBrightness(stateForLight);
-				lights[LED + 3 * i + 1].setBrightness(stateForLight * 0.839);
-				lights[LED + 3 * i + 2].setBrightness(stateForLight * 0.0781);
-			}
-			else {
-				// poly is blue
-				lights[LED + 3 * i + 0].setBrightness(0);
-				lights[LED + 3 * i + 1].setBrightness(0);
-				lights[LED + 3 * i + 2].setBrightness(stateForLight);
+		PROFILE_PHASE("lights");
+		if (lightDivider.process()) {
+			for (int i = 0; i < ParamIds::BUTTON_LAST; ++i) {
+				const float stateForLight = lightDivider.mean(i) / numPolyphonyEngines;
+
+				if (numPolyphonyEngines == 1) {
+					// mono is yellow (like the hardware)
+					lights[LED + 3 * i + 0].setBrightness(stateForLight);
+					lights[LED + 3 * i + 1].setBrightness(stateForLight * 0.839);
+					lights[LED + 3 * i + 2].setBrightness(stateForLight * 0.0781);
+				}
+				else {
+					// poly is blue
+					lights[LED + 3 * i + 0].setBrightness(0);
+					lights[LED + 3 * i + 1].setBrightness(0);
+					lights[LED + 3 * i + 2].setBrightness(stateForLight);
+				}
 			}
 		}
 
 		// set outputs
+		PROFILE_PHASE("outputs");
 		for (int c = 0; c < numPolyphonyEngines; c += 4) {
 			outputs[CV_OUTPUT].setVoltageSimd<float_4>(voltage[c / 4], c);
 			outputs[GATE_OUTPUT].setVoltageSimd<float_4>(10.f * globalState[c / 4], c);
@@ -108,6 +122,7 @@ struct Tonic : Module {
 	}
 
 	void dataFromJson(json_t* rootJ) override {
+		edgeCapture.fromJson(this, rootJ);
 		json_t* themeJ = json_object_get(rootJ, "theme");
 		if (themeJ) {
 			theme = (ModuleTheme) json_integer_value(themeJ);
@@ -118,6 +133,7 @@ struct Tonic : Module {
 		json_t* rootJ = json_object();
 		json_object_set_new(rootJ, "theme", json_integer(theme));
 
+		edgeCapture.toJson(rootJ);
 		return rootJ;
 	}
 };
@@ -179,6 +195,8 @@ struct TonicWidget : RebelTechModuleWidget {
 		Tonic* module = dynamic_cast<Tonic*>(this->module);
 		assert(module);
 
+		menu->addChild(new MenuSeparator());
+		addEdgeCaptureMenuItem(menu, module, &module->edgeCapture);
 		addThemeMenuItems(menu, &module->theme);
 	}
 };
@@ -1,4 +1,5 @@
 #include "plugin.hpp"
+#include <osdialog.h>
 
 
 Plugin* pluginInstance;
@@ -10,6 +11,10 @@ void init(Plugin* p) {
 
 	readDefaultTheme();
 
+#ifdef REBELTECH_PROFILE
+	Profiler::start(asset::user("RebelTech-trace.json"));
+#endif
+
 	// Add modules here
 	p->addModel(modelStoicheia);
 	p->addModel(modelTonic);
@@ -17,6 +22,8 @@ void init(Plugin* p) {
 	p->addModel(modelCLK);
 	p->addModel(modelLogoi);
 	p->addModel(modelPhoreo);
+	p->addModel(modelStoicheiaExpander);
+	p->addModel(modelCLKExpander);
 }
 
 // write to disk
@@ -88,4 +95,19 @@ void addThemeMenuItems(Menu* menu, ModuleTheme* themePtr) {
 			[=]() { return loadDefaultTheme(); },
 			[=](int mode) { saveDefaultTheme((ModuleTheme) mode); *themePtr = (ModuleTheme) mode; }
 	));
+}
+
+std::string chooseMidiExportPath(const std::string& defaultName) {
+	osdialog_filters* filters = osdialog_filters_parse("MIDI file (.mid):mid");
+	char* pathC = osdialog_file(OSDIALOG_SAVE, NULL, defaultName.c_str(), filters);
+	osdialog_filters_free(filters);
+	if (!pathC) {
+		return "";
+	}
+	std::string path = pathC;
+	std::free(pathC);
+	if (system::getExtension(path) != ".mid") {
+		path += ".mid";
+	}
+	return path;
 }
\ No newline at end of file
@@ -1,5 +1,12 @@
 #pragma once
 #include <rack.hpp>
+#include "CacheAligned.h"
+#include "CoreCopy.h"
+#include "EdgeRecorder.h"
+#include "MidiFile.h"
+#include "Profiler.h"
+#include "PatternSnapshot.h"
+#include "Random.h"
 
 using namespace rack;
 
@@ -13,6 +20,8 @@ extern Model* modelKlasmata;
 extern Model* modelCLK;
 extern Model* modelLogoi;
 extern Model* modelPhoreo;
+extern Model* modelStoicheiaExpander;
+extern Model* modelCLKExpander;
 
 enum ModuleTheme {
 	INVALID_THEME = -1,
@@ -168,12 +177,378 @@ void updateComponentsForTheme(M* module, RebelTechModuleWidget* moduleWidget, Mo
 
 void addThemeMenuItems(Menu* menu, ModuleTheme* themePtr);
 
+// save dialog for a MIDI export, "" if cancelled
+std::string chooseMidiExportPath(const std::string& defaultName);
+
+// "Export MIDI file" submenu, by length in bars. Once a file is chosen a worker thread takes a copy
+// of the core from the audio thread (the module calls copy->serve() in process()), renders it
+// (e.g. with MidiExport::render, see MidiExport.h) and writes the file; failures are logged.
+template <typename T>
+void addMidiExportMenuItem(Menu* menu, std::shared_ptr<CoreCopy<T>> copy, const std::string& name, MidiFile (*render)(const T&, int)) {
+	menu->addChild(createSubmenuItem("Export MIDI file", "", [=](Menu* menu) {
+		for (int bars : {1, 2, 4, 8, 16, 32, 64}) {
+			menu->addChild(createMenuItem(string::f("%d %s...", bars, bars > 1 ? "bars" : "bar"), "", [=]() {
+				const std::string path = chooseMidiExportPath(name + ".mid");
+				if (path.empty()) {
+					return;
+				}
+				if (!copy->request()) {
+					WARN("MIDI export from %s already in progress", name.c_str());
+					return;
+				}
+				std::thread([=]() {
+					T core;
+					if (!copy->take(core, 1.f)) {
+						WARN("MIDI export from %s failed, the module isn't running", name.c_str());
+						return;
+					}
+					if (!render(core, bars).write(path)) {
+						WARN("Could not write MIDI file %s", path.c_str());
+					}
+				}).detach();
+			}));
+		}
+	}));
+}
+
+// Flight recorder of a module's ports: while "Record edges" is ticked in the context menu (saved
+// with the patch), every rising and falling edge of every input and output channel goes to the
+// edge log, RebelTech-edges.rtel in the Rack user folder (see EdgeLog.h, decoded by tools/edgedump),
+// at the cost of a few comparisons per port each sample. The module calls process() at the top of
+// its process(), so that inputs are seen as they arrive and outputs as last written.
+struct EdgeCapture {
+	std::atomic<bool> enabled{false};
+	// created when first enabled, then kept (and registered) until the module is deleted
+	std::unique_ptr<EdgeRing> ring;
+	// audio thread
+	bool wasEnabled = false;
+	float sampleRate = 0.f;
+
+	~EdgeCapture() {
+		if (ring) {
+			EdgeRecorder::remove(ring.get());
+		}
+	}
+
+	void process(Module* module, const Module::ProcessArgs& args) {
+		if (!enabled.load(std::memory_order_acquire)) {
+			wasEnabled = false;
+			return;
+		}
+		// just enabled: take the gate states without recording the differences as edges
+		const bool prime = !wasEnabled;
+		wasEnabled = true;
+		if (args.sampleRate != sampleRate) {
+			sampleRate = args.sampleRate;
+			ring->sampleRate.store(sampleRate, std::memory_order_relaxed);
+		}
+		for (size_t i = 0; i < module->outputs.size(); ++i) {
+			Output& output = module->outputs[i];
+			ring->detect(args.frame - 1, true, i, output.getVoltages(), output.getChannels(), prime);
+		}
+		for (size_t i = 0; i < module->inputs.size(); ++i) {
+			Input& input = module->inputs[i];
+			ring->detect(args.frame, false, i, input.getVoltages(), input.getChannels(), prime);
+		}
+	}
+
+	// UI thread
+	void setEnabled(Module* module, bool enable) {
+		if (enable && !ring) {
+			if (!EdgeRecorder::start(asset::user("RebelTech-edges.rtel"))) {
+				WARN("Could not write the edge log");
+				return;
+			}
+			EdgeLog::Module description;
+			description.slug = module->model ? module->model->slug : "";
+			description.id = module->id;
+			for (PortInfo* info : module->inputInfos) {
+				description.inputs.push_back(info->getName());
+			}
+			for (PortInfo* info : module->outputInfos) {
+				description.outputs.push_back(info->getName());
+			}
+			ring.reset(new EdgeRing(module->inputs.size(), module->outputs.size()));
+			EdgeRecorder::add(ring.get(), description);
+		}
+		enabled.store(enable, std::memory_order_release);
+	}
+
+	void toJson(json_t* rootJ) {
+		json_object_set_new(rootJ, "recordEdges", json_boolean(enabled.load()));
+	}
+
+	void fromJson(Module* module, json_t* rootJ) {
+		json_t* recordEdgesJ = json_object_get(rootJ, "recordEdges");
+		if (recordEdgesJ) {
+			setEnabled(module, json_boolean_value(recordEdgesJ));
+		}
+	}
+};
+
+inline void addEdgeCaptureMenuItem(Menu* menu, Module* module, EdgeCapture* capture) {
+	menu->addChild(createBoolMenuItem("Record edges", "",
+	[=]() {
+		return capture->enabled.load();
+	},
+	[=](bool enable) {
+		capture->setEnabled(module, enable);
+	}));
+}
+
 struct Davies1900hWhiteKnobSnap : Davies1900hWhiteKnob {
 	Davies1900hWhiteKnobSnap() {
 		snap = true;
 	}
 };
 
+// Lets a module skip process() while it is parked: idle is entered once none of its inputs are
+// patched and the module has reported being quiescent (outputs won't change without input) for
+// settleTime, and is left as soon as a cable is connected or a param changes.
+struct IdleDetector {
+	static constexpr float settleTime = 0.25f;
+
+	bool idle = false;
+	float settledTime = 0.f;
+	int64_t skippedFrames = 0;
+	std::vector<float> paramValues;
+
+	explicit IdleDetector(int numParams) : paramValues(numParams) {}
+
+	static bool anyInputConnected(Module* module) {
+		for (Input& input : module->inputs) {
+			if (input.isConnected()) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// call at the start of process(), returns true if the rest of process() can be skipped
+	bool process(Module* module) {
+		if (!idle) {
+			return false;
+		}
+		bool paramsChanged = false;
+		for (size_t i = 0; i < paramValues.size(); ++i) {
+			paramsChanged |= (paramValues[i] != module->params[i].getValue());
+		}
+		if (paramsChanged || anyInputConnected(module)) {
+			wake();
+			return false;
+		}
+		skippedFrames++;
+		return true;
+	}
+
+	// leave idle, e.g. for a change that isn't a param or input
+	void wake() {
+		idle = false;
+		settledTime = 0.f;
+	}
+
+	// call at the end of process(), returns true if the module has just gone idle (e.g. so lights
+	// can be snapped to their final brightness)
+	bool update(Module* module, bool quiescent, float sampleTime) {
+		if (!quiescent || anyInputConnected(module)) {
+			settledTime = 0.f;
+			return false;
+		}
+		settledTime += sampleTime;
+		if (settledTime < settleTime) {
+			return false;
+		}
+		for (size_t i = 0; i < paramValues.size(); ++i) {
+			paramValues[i] = module->params[i].getValue();
+		}
+		idle = true;
+		return true;
+	}
+
+	// number of frames skipped while idle (since last call), for modules whose cores track time
+	int64_t takeSkippedFrames() {
+		const int64_t frames = skippedFrames;
+		skippedFrames = 0;
+		return frames;
+	}
+};
+
+// Lights are only drawn at the UI frame rate, so rather than writing every light every sample,
+// modules accumulate brightness each sample and write the lights once per block of `division`
+// samples, when process() returns true (like dsp::ClockDivider). Plain lights show the mean over
+// the block, smoothed lights rise to the block's peak (so a single sample trigger still flashes)
+// and decay with the block's time step. T can be simd::float_4, in which case lanes are summed.
+template <int N, typename T = float>
+struct LightDivider {
+	static const uint32_t division = 32;
+
+	dsp::ClockDivider divider;
+	T sum[N];
+	T peak[N];
+
+	LightDivider() {
+		divider.setDivision(division);
+		reset();
+	}
+
+	void reset() {
+		divider.reset();
+		for (int i = 0; i < N; ++i) {
+			sum[i] = peak[i] = 0.f;
+		}
+	}
+
+	void accumulate(int i, T brightness) {
+		sum[i] += brightness;
+		peak[i] = simd::fmax(peak[i], brightness);
+	}
+
+	// returns true once per block, when the lights should be written
+	bool process() {
+		return divider.process();
+	}
+
+	// mean brightness over the block, then clears the accumulator
+	float mean(int i) {
+		const float value = horizontalSum(sum[i]) / division;
+		sum[i] = peak[i] = 0.f;
+		return value;
+	}
+
+	void setBrightness(Light& light, int i) {
+		light.setBrightness(mean(i));
+	}
+
+	void setBrightnessSmooth(Light& light, int i, float sampleTime) {
+		light.setBrightnessSmooth(horizontalMax(peak[i]), sampleTime * division);
+		sum[i] = peak[i] = 0.f;
+	}
+
+	static float horizontalSum(float x) {
+		return x;
+	}
+	static float horizontalSum(simd::float_4 x) {
+		return x[0] + x[1] + x[2] + x[3];
+	}
+	static float horizontalMax(float x) {
+		return x;
+	}
+	static float horizontalMax(simd::float_4 x) {
+		return std::max(std::max(x[0], x[1]), std::max(x[2], x[3]));
+	}
+};
+
+// Shows the patterns and playheads published by a module (see PatternPublisher), either as a
+// ring of steps starting at the top (one sequence) or as a column of steps per sequence. The
+// framebuffer is only redrawn when a new snapshot version is taken, i.e. when a pattern changes
+// or a playhead moves, so a stopped sequencer costs nothing to display.
+struct PatternDisplay : widget::FramebufferWidget {
+	enum Layout {
+		RING,
+		COLUMNS
+	};
+
+	struct Drawing : widget::Widget {
+		PatternDisplay* display = nullptr;
+
+		void draw(const DrawArgs& args) override {
+			display->drawPattern(args.vg, box.size);
+		}
+	};
+
+	// nullptr in the module browser, where the snapshot is a fixed preview
+	TripleBuffer<PatternSnapshot>* buffer = nullptr;
+	PatternSnapshot snapshot;
+	Layout layout = RING;
+	// steps per column in the COLUMNS layout
+	int rows = 16;
+	Drawing* drawing;
+
+	PatternDisplay() {
+		drawing = new Drawing;
+		drawing->display = this;
+		addChild(drawing);
+	}
+
+	void step() override {
+		drawing->box.size = box.size;
+		if (buffer && buffer->update() && buffer->read().version != snapshot.version) {
+			snapshot = buffer->read();
+			setDirty();
+		}
+		FramebufferWidget::step();
+	}
+
+	void drawPattern(NVGcontext* vg, Vec size) {
+		nvgBeginPath(vg);
+		nvgRoundedRect(vg, 0.f, 0.f, size.x, size.y, std::min(size.x, size.y) / 2.f);
+		nvgFillColor(vg, nvgRGB(0x17, 0x17, 0x17));
+		nvgFill(vg);
+
+		if (layout == RING) {
+			const int length = snapshot.length[0];
+			const float radius = std::min(size.x, size.y) / 2.f;
+			const float ringRadius = 0.75f * radius;
+			const float dotRadius = std::min(0.8f * ringRadius * float(M_PI) / length, 0.15f * radius);
+			for (int k = 0; k < length; ++k) {
+				const float angle = 2.f * M_PI * k / length - M_PI / 2.f;
+				drawStep(vg, size.x / 2.f + ringRadius * std::cos(angle), size.y / 2.f + ringRadius * std::sin(angle), dotRadius, 0, k);
+			}
+		}
+		else {
+			const float columnWidth = size.x / snapshot.numSequences;
+			const float rowHeight = (size.y - columnWidth) / rows;
+			const float dotRadius = 0.35f * std::min(columnWidth, rowHeight);
+			for (int i = 0; i < snapshot.numSequences; ++i) {
+				for (int k = 0; k < snapshot.length[i]; ++k) {
+					drawStep(vg, (i + 0.5f) * columnWidth, (columnWidth + rowHeight) / 2.f + k * rowHeight, dotRadius, i, k);
+				}
+			}
+		}
+	}
+
+	// step k (in playing order) of sequence i: hits are filled, rests outlined, and the step
+	// last played is white (unless another sequence is being clocked)
+	void drawStep(NVGcontext* vg, float x, float y, float radius, int i, int k) {
+		const bool hit = snapshot.isHit(i, snapshot.stepAt(i, k));
+		const bool playing = (k == snapshot.playhead(i)) && (snapshot.active < 0 || snapshot.active == i);
+		const NVGcolor color = playing ? SCHEME_WHITE : hit ? SCHEME_YELLOW : nvgRGB(0x60, 0x60, 0x60);
+
+		nvgBeginPath(vg);
+		nvgCircle(vg, x, y, hit ? radius : 0.75f * radius);
+		if (hit) {
+			nvgFillColor(vg, color);
+			nvgFill(vg);
+		}
+		else {
+			nvgStrokeColor(vg, color);
+			nvgStrokeWidth(vg, 0.25f * radius);
+			nvgStroke(vg);
+		}
+	}
+};
+
+// a module's random generator is saved with the patch, so that a render replays the same choices
+inline json_t* randomStateToJson(const Xoshiro128Plus& random) {
+	json_t* stateJ = json_array();
+	for (int i = 0; i < 4; ++i) {
+		json_array_append_new(stateJ, json_integer(random.state[i]));
+	}
+	return stateJ;
+}
+
+// leaves the generator as it was if the state is missing or invalid
+inline void randomStateFromJson(json_t* stateJ, Xoshiro128Plus& random) {
+	if (!stateJ || json_array_size(stateJ) != 4) {
+		return;
+	}
+	uint32_t state[4];
+	for (int i = 0; i < 4; ++i) {
+		state[i] = json_integer_value(json_array_get(stateJ, i));
+	}
+	random.setState(state);
+}
+
 // given offset (in range 0-1), return the offset (based on current length)
 inline int paramToOffset(float param, int length) {
 	return std::round((length - 1) * param);
@@ -0,0 +1,300 @@
+#pragma once
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A small JSON reader for the tools' patch files (see render.cpp): enough of RFC 8259 for
+// hand written files (objects, arrays, strings with the usual escapes, numbers, true/false/null),
+// reporting the line of the first error. Objects keep their keys in file order.
+
+struct JsonValue {
+	enum Type {
+		NULL_VALUE,
+		BOOL,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT
+	};
+
+	Type type = NULL_VALUE;
+	bool boolean = false;
+	double number = 0.;
+	std::string string;
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object;
+
+	bool isNumber() const {
+		return type == NUMBER;
+	}
+	bool isString() const {
+		return type == STRING;
+	}
+	bool isArray() const {
+		return type == ARRAY;
+	}
+	bool isObject() const {
+		return type == OBJECT;
+	}
+
+	// member of an object, nullptr if missing (or not an object)
+	const JsonValue* get(const std::string& key) const {
+		for (const auto& member : object) {
+			if (member.first == key) {
+				return &member.second;
+			}
+		}
+		return nullptr;
+	}
+};
+
+class JsonParser {
+public:
+	// returns false, with a message in error, if text isn't valid JSON
+	static bool parse(const std::string& text, JsonValue& value, std::string& error) {
+		JsonParser parser(text);
+		if (!parser.parseValue(value, 0) || !parser.expectEnd()) {
+			error = "line " + std::to_string(parser.line) + ": " + parser.error;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static const int maxDepth = 64;
+
+	const std::string& text;
+	size_t pos = 0;
+	int line = 1;
+	std::string error;
+
+	explicit JsonParser(const std::string& text) : text(text) {}
+
+	bool fail(const std::string& message) {
+		error = message;
+		return false;
+	}
+
+	void skipSpace() {
+		while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+			line += text[pos] == '\n';
+			++pos;
+		}
+	}
+
+	bool consume(const char* word) {
+		const size_t n = std::char_traits<char>::length(word);
+		if (text.compare(pos, n, word) != 0) {
+			return false;
+		}
+		pos += n;
+		return true;
+	}
+
+	bool expectEnd() {
+		skipSpace();
+		return pos == text.size() || fail("unexpected text after the end");
+	}
+
+	bool parseValue(JsonValue& value, int depth) {
+		if (depth > maxDepth) {
+			return fail("nested too deeply");
+		}
+		skipSpace();
+		if (pos >= text.size()) {
+			return fail("unexpected end of file");
+		}
+		const char c = text[pos];
+		if (c == '{') {
+			return parseObject(value, depth);
+		}
+		if (c == '[') {
+			return parseArray(value, depth);
+		}
+		if (c == '"') {
+			value.type = JsonValue::STRING;
+			return parseString(value.string);
+		}
+		if (c == '-' || (c >= '0' && c <= '9')) {
+			return parseNumber(value);
+		}
+		if (consume("true")) {
+			value.type = JsonValue::BOOL;
+			value.boolean = true;
+			return true;
+		}
+		if (consume("false")) {
+			value.type = JsonValue::BOOL;
+			return true;
+		}
+		if (consume("null")) {
+			value.type = JsonValue::NULL_VALUE;
+			return true;
+		}
+		return fail(std::string("unexpected '") + c + "'");
+	}
+
+	bool parseObject(JsonValue& value, int depth) {
+		value.type = JsonValue::OBJECT;
+		++pos;
+		skipSpace();
+		if (pos < text.size() && text[pos] == '}') {
+			++pos;
+			return true;
+		}
+		while (true) {
+			skipSpace();
+			if (pos >= text.size() || text[pos] != '"') {
+				return fail("expected a key string");
+			}
+			std::string key;
+			if (!parseString(key)) {
+				return false;
+			}
+			skipSpace();
+			if (pos >= text.size() || text[pos] != ':') {
+				return fail("expected ':' after \"" + key + "\"");
+			}
+			++pos;
+			value.object.emplace_back(key, JsonValue());
+			if (!parseValue(value.object.back().second, depth + 1)) {
+				return false;
+			}
+			skipSpace();
+			if (pos < text.size() && text[pos] == ',') {
+				++pos;
+				continue;
+			}
+			if (pos < text.size() && text[pos] == '}') {
+				++pos;
+				return true;
+			}
+			return fail("expected ',' or '}'");
+		}
+	}
+
+	bool parseArray(JsonValue& value, int depth) {
+		value.type = JsonValue::ARRAY;
+		++pos;
+		skipSpace();
+		if (pos < text.size() && text[pos] == ']') {
+			++pos;
+			return true;
+		}
+		while (true) {
+			value.array.emplace_back();
+			if (!parseValue(value.array.back(), depth + 1)) {
+				return false;
+			}
+			skipSpace();
+			if (pos < text.size() && text[pos] == ',') {
+				++pos;
+				continue;
+			}
+			if (pos < text.size() && text[pos] == ']') {
+				++pos;
+				return true;
+			}
+			return fail("expected ',' or ']'");
+		}
+	}
+
+	bool parseNumber(JsonValue& value) {
+		const char* start = text.c_str() + pos;
+		char* end = nullptr;
+		value.type = JsonValue::NUMBER;
+		value.number = std::strtod(start, &end);
+		if (end == start) {
+			return fail("invalid number");
+		}
+		pos += end - start;
+		return true;
+	}
+
+	static void appendUtf8(std::string& out, unsigned code) {
+		if (code < 0x80) {
+			out += (char) code;
+		}
+		else if (code < 0x800) {
+			out += (char)(0xc0 | (code >> 6));
+			out += (char)(0x80 | (code & 0x3f));
+		}
+		else if (code < 0x10000) {
+			out += (char)(0xe0 | (code >> 12));
+			out += (char)(0x80 | ((code >> 6) & 0x3f));
+			out += (char)(0x80 | (code & 0x3f));
+		}
+		else {
+			out += (char)(0xf0 | (code >> 18));
+			out += (char)(0x80 | ((code >> 12) & 0x3f));
+			out += (char)(0x80 | ((code >> 6) & 0x3f));
+			out += (char)(0x80 | (code & 0x3f));
+		}
+	}
+
+	bool parseHex4(unsigned& code) {
+		if (pos + 4 > text.size()) {
+			return fail("invalid \\u escape");
+		}
+		code = 0;
+		for (int i = 0; i < 4; ++i) {
+			const char h = text[pos++];
+			code <<= 4;
+			if (h >= '0' && h <= '9') code |= h - '0';
+			else if (h >= 'a' && h <= 'f') code |= h - 'a' + 10;
+			else if (h >= 'A' && h <= 'F') code |= h - 'A' + 10;
+			else return fail("invalid \\u escape");
+		}
+		return true;
+	}
+
+	bool parseString(std::string& out) {
+		++pos;
+		while (pos < text.size()) {
+			const char c = text[pos++];
+			if (c == '"') {
+				return true;
+			}
+			if (c == '\n') {
+				return fail("unterminated string");
+			}
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (pos >= text.size()) {
+				break;
+			}
+			const char e = text[pos++];
+			switch (e) {
+				case '"': out += '"'; break;
+				case '\\': out += '\\'; break;
+				case '/': out += '/'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'n': out += '\n'; break;
+				case 'r': out += '\r'; break;
+				case 't': out += '\t'; break;
+				case 'u': {
+					unsigned code;
+					if (!parseHex4(code)) {
+						return false;
+					}
+					// surrogate pair
+					if (code >= 0xd800 && code < 0xdc00 && consume("\\u")) {
+						unsigned low;
+						if (!parseHex4(low)) {
+							return false;
+						}
+						code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+					}
+					appendUtf8(out, code);
+					break;
+				}
+				default: return fail(std::string("invalid escape '\\") + e + "'");
+			}
+		}
+		return fail("unterminated string");
+	}
+};
@@ -0,0 +1,478 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "CLKCore.h"
+#include "KlasmataCore.h"
+#include "LogoiCore.h"
+#include "PhoreoCore.h"
+#include "StoicheiaCore.h"
+
+// Minimal Rack-like wrappers around the module cores (src/*Core.h), so that the offline tools
+// can patch modules together without Rack. Each node mirrors the process() of its module:
+// params use the same ranges and defaults, and ports are addressed by short lowercase names.
+
+struct Node : CacheAligned {
+	std::string slug;
+	std::vector<std::string> paramNames, inputNames, outputNames;
+	std::vector<float> params, inputs, outputs;
+	std::vector<bool> connected;	// used for normalled inputs
+
+	virtual ~Node() {}
+	virtual void process(float sampleTime) = 0;
+
+	static int find(const std::vector<std::string>& names, const std::string& name) {
+		for (size_t i = 0; i < names.size(); ++i) {
+			if (names[i] == name) {
+				return i;
+			}
+		}
+		return -1;
+	}
+	int paramIndex(const std::string& name) const {
+		return find(paramNames, name);
+	}
+	int inputIndex(const std::string& name) const {
+		return find(inputNames, name);
+	}
+	int outputIndex(const std::string& name) const {
+		return find(outputNames, name);
+	}
+
+protected:
+	void configParam(const std::string& name, float defaultValue) {
+		paramNames.push_back(name);
+		params.push_back(defaultValue);
+	}
+	void configInput(const std::string& name) {
+		inputNames.push_back(name);
+		inputs.push_back(0.f);
+		connected.push_back(false);
+	}
+	void configOutput(const std::string& name) {
+		outputNames.push_back(name);
+		outputs.push_back(0.f);
+	}
+};
+
+
+struct CLKNode : Node {
+	enum ParamId { BPM_PARAM, SCALE_8_PARAM, SCALE_24_PARAM, MULTIPLIER_PARAM, TRIGGER_MODE_PARAM, SUBCLOCK_MODE_PARAM, POLY_CHANNELS_PARAM, POLY_SPREAD_PARAM, EXTERNAL_PPQN_PARAM, EDGE_MODE_PARAM, OVERSAMPLING_PARAM, SWING_PARAM, SWING_8_PARAM, SWING_24_PARAM };
+	enum InputId { SCALE_8_CV_INPUT, SCALE_24_CV_INPUT, EXT_CLOCK_INPUT, RUN_INPUT, RESET_INPUT, TAP_INPUT, BPM_CV_INPUT };
+	enum OutputId { MAIN_OUTPUT, CLOCK_8_OUTPUT, CLOCK_24_OUTPUT };
+
+	CLKCore core;
+
+	CLKNode() {
+		slug = "CLK";
+		configParam("bpm", 120.f);
+		configParam("scale8", 5.f);
+		configParam("scale24", 5.f);
+		// context menu options
+		configParam("multiplier", 0.f);
+		configParam("mode", CLKCore::ORIGINAL_MODE);
+		configParam("subclock_mode", CLKCore::TABLE_MODE);
+		// outputs carry channel 0 only
+		configParam("poly_channels", 1.f);
+		configParam("poly_spread", CLKCore::SPREAD_MULTIPLES);
+		configParam("ppqn", 1.f);
+		configParam("edges", CLKCore::NAIVE_EDGES);
+		configParam("oversampling", 1.f);
+		// %, 50 is straight
+		configParam("swing", 50.f);
+		configParam("swing8", 50.f);
+		configParam("swing24", 50.f);
+		// on the CLK Expander in the plugin, without its one sample delay
+		configInput("scale8_cv");
+		configInput("scale24_cv");
+		configInput("ext");
+		configInput("run");
+		configInput("reset");
+		configInput("tap");
+		configInput("bpm_cv");
+		configOutput("main");
+		configOutput("clock8");
+		configOutput("clock24");
+	}
+
+	void process(float sampleTime) override {
+		core.outputMultiplier = params[MULTIPLIER_PARAM];
+		core.triggerMode = (CLKCore::TriggerMode) params[TRIGGER_MODE_PARAM];
+		core.subClockMode = (CLKCore::SubClockMode) params[SUBCLOCK_MODE_PARAM];
+		core.polyChannels = params[POLY_CHANNELS_PARAM];
+		core.polySpread = (CLKCore::PolySpread) params[POLY_SPREAD_PARAM];
+		core.externalPPQN = params[EXTERNAL_PPQN_PARAM];
+		core.edgeMode = (CLKCore::EdgeMode) params[EDGE_MODE_PARAM];
+		core.oversampling = params[OVERSAMPLING_PARAM];
+		core.swingA = params[SWING_PARAM] / 50.f - 1.f;
+		core.swingB = params[SWING_8_PARAM] / 50.f - 1.f;
+		core.swingC = params[SWING_24_PARAM] / 50.f - 1.f;
+		if (core.useBanks()) {
+			core.setSubClockRatios(0, core.baseRatioValue(0, params[SCALE_8_PARAM]), &inputs[SCALE_8_CV_INPUT], 1);
+			core.setSubClockRatios(1, core.baseRatioValue(1, params[SCALE_24_PARAM]), &inputs[SCALE_24_CV_INPUT], 1);
+		}
+		CLKCore::Inputs in;
+		in.externalConnected = connected[EXT_CLOCK_INPUT];
+		in.external = inputs[EXT_CLOCK_INPUT];
+		in.runConnected = connected[RUN_INPUT];
+		in.run = inputs[RUN_INPUT];
+		in.reset = inputs[RESET_INPUT];
+		in.tap = inputs[TAP_INPUT];
+		in.bpmCV = inputs[BPM_CV_INPUT];
+		core.process(params[BPM_PARAM], params[SCALE_8_PARAM], params[SCALE_24_PARAM], sampleTime, in);
+
+		outputs[MAIN_OUTPUT] = 10.f * core.outA;
+		outputs[CLOCK_8_OUTPUT] = 10.f * core.outB[0];
+		outputs[CLOCK_24_OUTPUT] = 10.f * core.outC[0];
+	}
+};
+
+struct KlasmataNode : Node {
+	enum ParamId { OFFSET_PARAM, LENGTH_PARAM, SWITCH_PARAM, DENSITY_PARAM, LENGTH_CV_PARAM, DENSITY_CV_PARAM, PROB_PARAM, SEED_PARAM };
+	enum InputId { RESET_INPUT, LENGTH_CV_INPUT, DENSITY_CV_INPUT, CLOCK_INPUT, PROB_CV_INPUT };
+	enum OutputId { OUT_OUTPUT };
+
+	KlasmataCore core;
+	bool seeded = false;
+
+	KlasmataNode() {
+		slug = "Klasmata";
+		configParam("offset", 0.f);
+		configParam("length", 1.f);
+		configParam("mode", KlasmataCore::NORMAL);
+		configParam("density", 0.5f);
+		configParam("length_cv", 0.f);
+		configParam("density_cv", 0.f);
+		configParam("probability", 1.f);
+		// seeds the random generator (read once, at the first sample)
+		configParam("seed", 0.f);
+		configInput("reset");
+		configInput("length_cv");
+		configInput("density_cv");
+		configInput("clock");
+		// PROB A of a Stoicheia Expander next to Klasmata in the plugin
+		configInput("probability_cv");
+		configOutput("out");
+	}
+
+	void process(float sampleTime) override {
+		const float lengthCV = KlasmataCore::scaledCV(inputs[LENGTH_CV_INPUT], params[LENGTH_CV_PARAM]);
+		const float fillCV = KlasmataCore::scaledCV(inputs[DENSITY_CV_INPUT], params[DENSITY_CV_PARAM]);
+		core.setParams(params[LENGTH_PARAM] + lengthCV * 31, params[DENSITY_PARAM] + fillCV, params[OFFSET_PARAM],
+		               (KlasmataCore::SequenceMode) params[SWITCH_PARAM]);
+		core.setProbability(params[PROB_PARAM] + inputs[PROB_CV_INPUT] / 10.f);
+		if (!seeded) {
+			core.random.setSeed(params[SEED_PARAM]);
+			seeded = true;
+		}
+		core.process(inputs[CLOCK_INPUT], inputs[RESET_INPUT]);
+
+		outputs[OUT_OUTPUT] = core.out;
+	}
+};
+
+struct LogoiNode : Node {
+	enum ParamId { DIVISION_PARAM, COUNT_OR_DELAY_PARAM, DIVISION_CV_PARAM, COUNT_OR_DELAY_CV_PARAM, MODE_PARAM, DELAY_SYNC_PARAM, RANGE_PARAM, POSITION_SOURCE_PARAM, POSITION_SCALE_PARAM };
+	enum InputId { DIVISION_CV_INPUT, COUNT_OR_DELAY_CV_INPUT, RESET_INPUT, CLOCK_INPUT };
+	enum OutputId { DIVISION_OUTPUT, ADDITION_DELAY_OUTPUT, COMBINED_OUTPUT, CLOCK_THRU_OUTPUT, POSITION_OUTPUT };
+
+	LogoiCore core;
+
+	LogoiNode() {
+		slug = "Logoi";
+		configParam("division", 0.f);
+		configParam("count", 0.f);
+		configParam("division_cv", 0.f);
+		configParam("count_cv", 0.f);
+		configParam("mode", LogoiCore::COUNT_MODE);
+		// context menu options
+		configParam("delay_sync", LogoiCore::FREE_DELAY);
+		configParam("range", LogoiCore::ORIGINAL_RANGE);
+		// the position output carries channel 0 only, i.e. the divider when showing both
+		configParam("position_source", LogoiCore::POSITION_DIVIDER);
+		configParam("position_scale", LogoiCore::POSITION_CYCLE);
+		configInput("division_cv");
+		configInput("count_cv");
+		configInput("reset");
+		configInput("clock");
+		configOutput("division");
+		configOutput("count");
+		configOutput("combined");
+		configOutput("thru");
+		configOutput("position");
+	}
+
+	void process(float sampleTime) override {
+		core.delaySync = (LogoiCore::DelaySync) params[DELAY_SYNC_PARAM];
+		core.range = (LogoiCore::Range) params[RANGE_PARAM];
+		core.setDivision(LogoiCore::paramWithCV(params[DIVISION_PARAM], params[DIVISION_CV_PARAM], inputs[DIVISION_CV_INPUT]));
+		core.setCountOrDelay(LogoiCore::paramWithCV(params[COUNT_OR_DELAY_PARAM], params[COUNT_OR_DELAY_CV_PARAM],
+		                                            inputs[COUNT_OR_DELAY_CV_INPUT]), sampleTime);
+		core.process(inputs[CLOCK_INPUT], inputs[RESET_INPUT], (int) params[MODE_PARAM]);
+
+		outputs[DIVISION_OUTPUT] = core.divisionOutput;
+		outputs[ADDITION_DELAY_OUTPUT] = core.countOrDelayOutput;
+		outputs[COMBINED_OUTPUT] = core.combinedOutput;
+		outputs[CLOCK_THRU_OUTPUT] = core.clockThruOutput;
+
+		const int mode = params[MODE_PARAM];
+		const LogoiCore::PositionScale scale = (LogoiCore::PositionScale) params[POSITION_SCALE_PARAM];
+		float position = 0.f;
+		if (params[POSITION_SOURCE_PARAM] == LogoiCore::POSITION_COUNTER) {
+			if (mode == LogoiCore::COUNT_MODE) {
+				position = LogoiCore::positionVoltage(core.counterStep(), core.counterSteps(), scale);
+			}
+		}
+		else if (mode != LogoiCore::DISABLED_MODE) {
+			position = LogoiCore::positionVoltage(core.dividerStep(), core.dividerSteps(), scale);
+		}
+		outputs[POSITION_OUTPUT] = position;
+	}
+};
+
+struct PhoreoNode : Node {
+	enum ParamId { MOD_PARAM, MOD_CV_PARAM, MUL_PARAM, MUL_CV_PARAM, REP_PARAM, REP_CV_PARAM, CURVE_PARAM };
+	enum InputId { MOD_TRIG_INPUT, MOD_CV_INPUT, MUL_TRIG_INPUT, MUL_CV_INPUT, REP_TRIG_INPUT, REP_CV_INPUT };
+	enum OutputId { MOD_OUTPUT, MULT_OUTPUT, REP_OUTPUT };
+
+	PhoreoCore core;
+
+	PhoreoNode() {
+		slug = "Phoreo";
+		configParam("mod", 50.f);
+		configParam("mod_cv", 0.f);
+		configParam("mul", 1.f);
+		configParam("mul_cv", 0.f);
+		configParam("rep", 1.f);
+		configParam("rep_cv", 0.f);
+		configParam("curve", 0.f);
+		configInput("mod");
+		configInput("mod_cv");
+		configInput("mul");
+		configInput("mul_cv");
+		configInput("rep");
+		configInput("rep_cv");
+		configOutput("mod");
+		configOutput("mul");
+		configOutput("rep");
+	}
+
+	void process(float sampleTime) override {
+		core.setDuration(PhoreoCore::paramWithCV(params[MOD_PARAM] / 100.f, params[MOD_CV_PARAM], inputs[MOD_CV_INPUT], 1.f));
+		core.setMultiplier(PhoreoCore::paramWithCV(params[MUL_PARAM], params[MUL_CV_PARAM], inputs[MUL_CV_INPUT], 16.f));
+		core.setRepetitions(PhoreoCore::paramWithCV(params[REP_PARAM], params[REP_CV_PARAM], inputs[REP_CV_INPUT], 16.f));
+		core.setCurve(params[CURVE_PARAM] / 100.f);
+
+		const float durClock = inputs[MOD_TRIG_INPUT];
+		const float mulClock = connected[MUL_TRIG_INPUT] ? inputs[MUL_TRIG_INPUT] : durClock;
+		const float repClock = connected[REP_TRIG_INPUT] ? inputs[REP_TRIG_INPUT] : mulClock;
+		core.process(durClock, mulClock, repClock, sampleTime);
+
+		outputs[MOD_OUTPUT] = 10.f * !core.dur.isOff();
+		outputs[MULT_OUTPUT] = 10.f * !core.mul.isOff();
+		outputs[REP_OUTPUT] = 10.f * !core.rep.isOff();
+	}
+};
+
+struct StoicheiaNode : Node {
+	enum ParamId { START_A_PARAM, START_B_PARAM, LENGTH_A_PARAM, LENGTH_B_PARAM, DENSITY_A_PARAM, DENSITY_B_PARAM, AB_MODE, MODE_A_PARAM, MODE_B_PARAM, PROB_A_PARAM, PROB_B_PARAM, SEED_PARAM, LOGIC_PARAM,
+		EXPANDER_PARAM, START_C_PARAM, START_D_PARAM, LENGTH_C_PARAM, LENGTH_D_PARAM, DENSITY_C_PARAM, DENSITY_D_PARAM };
+	enum InputId { RESET_INPUT, CLOCK_INPUT, PROB_A_INPUT, PROB_B_INPUT };
+	enum OutputId { OUT_A_OUTPUT, OUT_B_OUTPUT, CLOCK_THRU, LOGIC_OUTPUT, OUT_C_OUTPUT, OUT_D_OUTPUT };
+
+	StoicheiaCore core;
+	bool seeded = false;
+
+	StoicheiaNode() {
+		slug = "Stoicheia";
+		configParam("start_a", 0.f);
+		configParam("start_b", 0.f);
+		configParam("length_a", 1.f);
+		configParam("length_b", 1.f);
+		configParam("density_a", 0.5f);
+		configParam("density_b", 0.5f);
+		configParam("ab_mode", StoicheiaCore::INDEPENDENT);
+		configParam("mode_a", StoicheiaCore::NORMAL);
+		configParam("mode_b", StoicheiaCore::NORMAL);
+		configParam("probability_a", 1.f);
+		configParam("probability_b", 1.f);
+		// seeds the random generator (read once, at the first sample)
+		configParam("seed", 0.f);
+		// context menu option
+		configParam("logic", StoicheiaCore::LOGIC_AND);
+		// 1 for an expander (sequences C and D) to the right, without the message latency
+		configParam("expander", 0.f);
+		configParam("start_c", 0.f);
+		configParam("start_d", 0.f);
+		configParam("length_c", 1.f);
+		configParam("length_d", 1.f);
+		configParam("density_c", 0.5f);
+		configParam("density_d", 0.5f);
+		configInput("reset");
+		configInput("clock");
+		// on the Stoicheia Expander in the plugin
+		configInput("probability_a");
+		configInput("probability_b");
+		configOutput("a");
+		configOutput("b");
+		configOutput("thru");
+		configOutput("logic");
+		configOutput("c");
+		configOutput("d");
+	}
+
+	void process(float sampleTime) override {
+		core.logicMode = (StoicheiaCore::LogicMode) params[LOGIC_PARAM];
+		for (int i = 0; i < 2; ++i) {
+			const int length = params[LENGTH_A_PARAM + i];
+			core.setParams(i, length,
+			               1 + std::round((length - 1) * params[DENSITY_A_PARAM + i]),
+			               std::round((length - 1) * params[START_A_PARAM + i]),
+			               (StoicheiaCore::SequenceMode) params[MODE_A_PARAM + i]);
+			core.setProbability(i, params[PROB_A_PARAM + i] + inputs[PROB_A_INPUT + i] / 10.f);
+		}
+		core.numSequences = params[EXPANDER_PARAM] ? 4 : 2;
+		for (int i = 2; i < core.numSequences; ++i) {
+			const int length = params[LENGTH_C_PARAM + i - 2];
+			core.setParams(i, length,
+			               1 + std::round((length - 1) * params[DENSITY_C_PARAM + i - 2]),
+			               std::round((length - 1) * params[START_C_PARAM + i - 2]),
+			               StoicheiaCore::NORMAL);
+		}
+		if (!seeded) {
+			core.random.setSeed(params[SEED_PARAM]);
+			seeded = true;
+		}
+		core.process(inputs[CLOCK_INPUT], inputs[RESET_INPUT], (StoicheiaCore::ABMode) params[AB_MODE]);
+
+		outputs[OUT_A_OUTPUT] = core.outA;
+		outputs[OUT_B_OUTPUT] = core.outB;
+		outputs[CLOCK_THRU] = core.clockThru;
+		outputs[LOGIC_OUTPUT] = core.outLogic;
+
+		if (params[EXPANDER_PARAM]) {
+			StoicheiaChainState state;
+			state.set(core, (StoicheiaCore::ABMode) params[AB_MODE]);
+			outputs[OUT_C_OUTPUT] = state.output(2);
+			outputs[OUT_D_OUTPUT] = state.output(3);
+		}
+	}
+};
+
+// synthetic clock source with optional swing and jitter (not a Rebel Tech module), used to
+// drive patches offline; swing is the position of every second pulse within a pair of
+// periods (50% is straight) and jitter moves each edge by up to +/- the given time
+struct ClockSourceNode : Node {
+	enum ParamId { BPM_PARAM, WIDTH_PARAM, SWING_PARAM, JITTER_PARAM, SEED_PARAM };
+	enum OutputId { OUT_OUTPUT };
+
+	double time = 0.;
+	double riseTime = 0., fallTime = 0.;
+	int64_t pulse = -1;
+	uint32_t rng = 0;
+
+	ClockSourceNode() {
+		slug = "Clock";
+		configParam("bpm", 120.f);
+		configParam("width", 50.f);
+		configParam("swing", 50.f);
+		configParam("jitter", 0.f);
+		configParam("seed", 1.f);
+		configOutput("out");
+	}
+
+	// uniform in [-1, 1)
+	float random() {
+		// xorshift32
+		rng ^= rng << 13;
+		rng ^= rng >> 17;
+		rng ^= rng << 5;
+		return rng / 2147483648.f - 1.f;
+	}
+
+	void schedule() {
+		++pulse;
+		const double period = 60. / params[BPM_PARAM];
+		const double swing = (pulse % 2) ? (2. * params[SWING_PARAM] / 100. - 1.) * period : 0.;
+		const double jitter = params[JITTER_PARAM] * 1e-3;
+		// the first pulse starts half a period in, so inputs see the clock low first
+		riseTime = (pulse + 0.5) * period + swing + jitter * random();
+		fallTime = riseTime + period * params[WIDTH_PARAM] / 100. + jitter * random();
+		fallTime = std::max(fallTime, riseTime);
+	}
+
+	void process(float sampleTime) override {
+		if (pulse < 0) {
+			rng = std::max<uint32_t>(1, params[SEED_PARAM]);
+			schedule();
+		}
+		if (time >= fallTime) {
+			outputs[OUT_OUTPUT] = 0.f;
+			schedule();
+		}
+		if (time >= riseTime && time < fallTime) {
+			outputs[OUT_OUTPUT] = 10.f;
+		}
+		time += sampleTime;
+	}
+};
+
+// returns nullptr for unknown slugs
+inline Node* createNode(const std::string& slug) {
+	if (slug == "Clock") return new ClockSourceNode;
+	if (slug == "CLK") return new CLKNode;
+	if (slug == "Klasmata") return new KlasmataNode;
+	if (slug == "Logoi") return new LogoiNode;
+	if (slug == "Phoreo") return new PhoreoNode;
+	if (slug == "Stoicheia") return new StoicheiaNode;
+	return nullptr;
+}
+
+
+// a set of nodes plus cables between them; as in Rack, each cable delays its signal by one sample
+struct Patch {
+	struct Cable {
+		Node* from;
+		int output;
+		Node* to;
+		int input;
+	};
+
+	std::vector<Node*> nodes;
+	std::vector<Cable> cables;
+
+	~Patch() {
+		for (Node* node : nodes) {
+			delete node;
+		}
+	}
+
+	// takes ownership
+	Node* add(Node* node) {
+		nodes.push_back(node);
+		return node;
+	}
+
+	// returns false if either port doesn't exist
+	bool connect(Node* from, const std::string& output, Node* to, const std::string& input) {
+		const int o = from->outputIndex(output);
+		const int i = to->inputIndex(input);
+		if (o < 0 || i < 0) {
+			return false;
+		}
+		to->connected[i] = true;
+		cables.push_back({from, o, to, i});
+		return true;
+	}
+
+	void process(float sampleTime) {
+		for (const Cable& cable : cables) {
+			cable.to->inputs[cable.input] = cable.from->outputs[cable.output];
+		}
+		for (Node* node : nodes) {
+			node->process(sampleTime);
+		}
+	}
+};
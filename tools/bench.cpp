@@ -0,0 +1,414 @@
+// Multi-thread scaling benchmark: runs N instances of each module core (via tools/Nodes.h) the
+// way Rack's engine does, i.e. every sample the worker threads take modules from a shared
+// atomic index and then meet at a barrier, and reports throughput and scaling efficiency for
+// 1 to 16 threads. Single thread results can be saved as JSON (--json) and compared against a
+// saved baseline (--compare), failing on regressions: see make bench-compare and README.md. The
+// comparison is of each module's time relative to a fixed reference loop timed alongside it, so
+// that the baseline holds up to the machine being busier or clocked differently later on.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Json.h"
+#include "Nodes.h"
+
+struct Options {
+	float sampleRate = 48000.f;
+	float bpm = 480.f;		// fast enough that the sequencers do some work
+	float seconds = 0.1f;	// audio processed per run
+	int instances = 256;
+	int maxThreads = 16;
+	std::string modules = "CLK,Klasmata,Logoi,Phoreo,Stoicheia,mix";
+	// runs per thread count, of which the median is reported
+	int repeat = 1;
+	std::string jsonPath;
+	std::string comparePath;
+	// % slower than the baseline that fails --compare
+	float threshold = 10.f;
+};
+
+// heap allocations made by worker threads while processing, which should stay at none (the
+// audio thread mustn't allocate)
+static std::atomic<uint64_t> allocations{0};
+static thread_local bool countAllocations = false;
+
+void* operator new(std::size_t size) {
+	if (countAllocations) {
+		allocations.fetch_add(1, std::memory_order_relaxed);
+	}
+	void* p = std::malloc(size ? size : 1);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+// like Rack's engine barrier: spin briefly, then yield so oversubscribed threads still progress
+struct SpinBarrier {
+	const int count;
+	std::atomic<int> waiting{0};
+	std::atomic<int> generation{0};
+
+	explicit SpinBarrier(int count) : count(count) {}
+
+	void wait() {
+		const int gen = generation.load(std::memory_order_acquire);
+		if (waiting.fetch_add(1, std::memory_order_acq_rel) + 1 == count) {
+			waiting.store(0, std::memory_order_relaxed);
+			generation.fetch_add(1, std::memory_order_release);
+			return;
+		}
+		for (int spins = 0; generation.load(std::memory_order_acquire) == gen; ++spins) {
+			if (spins > 1000) {
+				std::this_thread::yield();
+			}
+		}
+	}
+};
+
+struct Instance {
+	Node* node;
+	int clockInput;		// -1 if the module has no clock input (CLK)
+};
+
+static const char* const SLUGS[] = {"CLK", "Klasmata", "Logoi", "Phoreo", "Stoicheia"};
+
+// "mix" cycles through every module, as in a large patch
+static std::vector<Instance> createInstances(const std::string& module, int count) {
+	std::vector<Instance> instances;
+	for (int i = 0; i < count; ++i) {
+		const std::string slug = (module == "mix") ? SLUGS[i % 5] : module;
+		Node* node = createNode(slug);
+		if (!node) {
+			return instances;
+		}
+		// Phoreo's clock is its top (pulse width) input, the others are normalled from it
+		int clockInput = node->inputIndex(slug == "Phoreo" ? "mod" : "clock");
+		if (clockInput >= 0) {
+			node->connected[clockInput] = true;
+		}
+		instances.push_back({node, clockInput});
+	}
+	return instances;
+}
+
+// returns wall clock seconds
+static double run(std::vector<Instance>& instances, const std::vector<float>& clock, int numThreads, float sampleTime) {
+	if (numThreads == 1) {
+		// a plain loop, so the single thread time (the one compared with the baseline) has no
+		// queue or barrier overhead in it
+		countAllocations = true;
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t frame = 0; frame < clock.size(); ++frame) {
+			for (Instance& instance : instances) {
+				if (instance.clockInput >= 0) {
+					instance.node->inputs[instance.clockInput] = clock[frame];
+				}
+				instance.node->process(sampleTime);
+			}
+		}
+		const auto end = std::chrono::steady_clock::now();
+		countAllocations = false;
+		return std::chrono::duration<double>(end - start).count();
+	}
+
+	std::atomic<size_t> next{0};
+	SpinBarrier barrier(numThreads);
+
+	auto worker = [&](int id) {
+		countAllocations = true;
+		for (size_t frame = 0; frame < clock.size(); ++frame) {
+			size_t i;
+			while ((i = next.fetch_add(1, std::memory_order_relaxed)) < instances.size()) {
+				Instance& instance = instances[i];
+				if (instance.clockInput >= 0) {
+					instance.node->inputs[instance.clockInput] = clock[frame];
+				}
+				instance.node->process(sampleTime);
+			}
+			barrier.wait();
+			if (id == 0) {
+				next.store(0, std::memory_order_relaxed);
+			}
+			barrier.wait();
+		}
+		countAllocations = false;
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (int id = 1; id < numThreads; ++id) {
+		threads.emplace_back(worker, id);
+	}
+	worker(0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	const size_t n = values.size();
+	return (n % 2) ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+}
+
+// a fixed amount of scalar float and integer work standing in for the machine's speed, returns ns
+// per iteration. It runs just before each single thread run, and each run is divided by it, so
+// that a machine which is busier or clocked differently for a while slows both alike
+static double referenceLoop() {
+	static volatile float sink = 0.f;
+	const int iterations = 1 << 23;
+	uint32_t state = 1;
+	float phase = 0.f, filter = 0.f;
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; ++i) {
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		phase += 0.001f + (state >> 24) * 1e-6f;
+		phase -= (phase >= 1.f) ? 1.f : 0.f;
+		filter += 0.05f * ((phase < 0.5f ? 10.f : 0.f) - filter);
+	}
+	const auto end = std::chrono::steady_clock::now();
+	sink = sink + filter;
+	return std::chrono::duration<double>(end - start).count() * 1e9 / iterations;
+}
+
+struct Result {
+	std::string module;
+	double nsPerSample;		// per instance, single thread
+	double allocsPerSample;	// across all instances
+	double relative;		// median of each run's ns per sample / the reference loop's ns, compared
+};
+
+static bool writeResults(const std::string& path, const Options& o, const std::vector<Result>& results) {
+	FILE* file = fopen(path.c_str(), "w");
+	if (!file) {
+		return false;
+	}
+	fprintf(file, "{\n\t\"instances\": %d,\n\t\"sampleRate\": %.0f,\n\t\"bpm\": %g,\n\t\"modules\": {", o.instances, o.sampleRate, o.bpm);
+	for (size_t i = 0; i < results.size(); ++i) {
+		fprintf(file, "%s\n\t\t\"%s\": {\"nsPerSample\": %.2f, \"relative\": %.4f, \"allocsPerSample\": %g}", i ? "," : "",
+		        results[i].module.c_str(), results[i].nsPerSample, results[i].relative, results[i].allocsPerSample);
+	}
+	fprintf(file, "\n\t}\n}\n");
+	return fclose(file) == 0;
+}
+
+// prints a table of the changes from the baseline file, returns the number of regressions (or -1
+// if the baseline can't be read): more than threshold % slower, or allocating more
+static int compareResults(const std::string& path, const Options& o, const std::vector<Result>& results) {
+	std::ifstream in(path);
+	std::stringstream text;
+	text << in.rdbuf();
+	JsonValue baseline;
+	std::string error;
+	if (!in || !JsonParser::parse(text.str(), baseline, error)) {
+		fprintf(stderr, "%s: %s\n", path.c_str(), in ? error.c_str() : "can't read file");
+		return -1;
+	}
+	const JsonValue* modules = baseline.get("modules");
+	if (!modules || !modules->isObject()) {
+		fprintf(stderr, "%s: no modules\n", path.c_str());
+		return -1;
+	}
+	const JsonValue* instances = baseline.get("instances");
+	if (instances && instances->isNumber() && (int) instances->number != o.instances) {
+		printf("note: baseline ran %d instances\n", (int) instances->number);
+	}
+
+	printf("\ncompared with %s (threshold %.1f%%), times as multiples of the reference loop\n", path.c_str(), o.threshold);
+	printf("%-10s | %14s %14s %8s | %15s  %s\n", "module", "baseline", "current", "change", "allocs/sample", "status");
+	int regressions = 0;
+	for (const Result& result : results) {
+		const JsonValue* entry = modules->get(result.module);
+		const JsonValue* relative = entry ? entry->get("relative") : nullptr;
+		if (!relative || !relative->isNumber() || relative->number <= 0.) {
+			printf("%-10s | %14s %14.2f %8s | %15g  %s\n", result.module.c_str(), "-", result.relative, "-", result.allocsPerSample, "new");
+			continue;
+		}
+		const JsonValue* allocs = entry->get("allocsPerSample");
+		const double baselineAllocs = (allocs && allocs->isNumber()) ? allocs->number : 0.;
+		const double change = 100. * (result.relative / relative->number - 1.);
+		const char* status = "ok";
+		if (change > o.threshold) {
+			status = "SLOWER";
+		}
+		else if (result.allocsPerSample > baselineAllocs) {
+			status = "ALLOCATES";
+		}
+		else if (change < -o.threshold) {
+			status = "faster";
+		}
+		if (status[0] == 'S' || status[0] == 'A') {
+			++regressions;
+		}
+		printf("%-10s | %14.2f %14.2f %+7.1f%% | %6g -> %-6g  %s\n", result.module.c_str(), relative->number, result.relative, change,
+		       baselineAllocs, result.allocsPerSample, status);
+	}
+	return regressions;
+}
+
+static void usage() {
+	printf("usage: bench [options]\n"
+	       "  --instances N      module instances per run (default 256)\n"
+	       "  --threads N        maximum number of threads, runs 1, 2, 4, ... up to N (default 16)\n"
+	       "  --modules LIST     comma separated slugs, \"mix\" cycles through all (default CLK,Klasmata,Logoi,Phoreo,Stoicheia,mix)\n"
+	       "  --seconds S        audio processed per run (default 0.1)\n"
+	       "  --sample-rate HZ   engine sample rate (default 48000)\n"
+	       "  --bpm BPM          tempo of the clock fed to each instance (default 480)\n"
+	       "  --repeat N         runs per thread count, reporting the median (default 1)\n"
+	       "  --json PATH        writes the single thread results to PATH\n"
+	       "  --compare PATH     compares the single thread results with a file written by --json, exits\n"
+	       "                     with status 2 if any module regressed\n"
+	       "  --threshold PCT    percentage slower than the baseline that is a regression (default 10)\n"
+	       "efficiency is the speedup over one thread divided by the number of threads, allocs are heap\n"
+	       "allocations while processing (any more than the baseline is a regression); one thread runs\n"
+	       "the instances in a plain loop, without the queue and barrier\n");
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "--help" || arg == "-h") {
+			usage();
+			return 0;
+		}
+		else if (!hasValue) {
+			usage();
+			return 1;
+		}
+		else if (arg == "--instances") o.instances = atoi(argv[++i]);
+		else if (arg == "--threads") o.maxThreads = atoi(argv[++i]);
+		else if (arg == "--modules") o.modules = argv[++i];
+		else if (arg == "--seconds") o.seconds = atof(argv[++i]);
+		else if (arg == "--sample-rate") o.sampleRate = atof(argv[++i]);
+		else if (arg == "--bpm") o.bpm = atof(argv[++i]);
+		else if (arg == "--repeat") o.repeat = atoi(argv[++i]);
+		else if (arg == "--json") o.jsonPath = argv[++i];
+		else if (arg == "--compare") o.comparePath = argv[++i];
+		else if (arg == "--threshold") o.threshold = atof(argv[++i]);
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (o.instances < 1 || o.maxThreads < 1 || o.repeat < 1) {
+		usage();
+		return 1;
+	}
+
+	// 50% duty square wave clock
+	const int64_t frames = o.seconds * o.sampleRate;
+	const double period = 60. * o.sampleRate / o.bpm;
+	std::vector<float> clock(frames);
+	for (int64_t frame = 0; frame < frames; ++frame) {
+		clock[frame] = (std::fmod(frame, period) < period / 2) ? 10.f : 0.f;
+	}
+
+	printf("%d instances, %lld samples per run at %.0f Hz, %u hardware threads\n",
+	       o.instances, (long long) frames, o.sampleRate, std::thread::hardware_concurrency());
+	printf("%-10s %7s | %10s %12s %8s %10s %8s\n", "module", "threads", "time (ms)", "ns/instance", "speedup", "efficiency", "allocs");
+
+	std::vector<Result> results;
+	// every module's instances are created up front, so that the single thread runs can take turns
+	std::vector<std::string> modules;
+	std::vector<std::vector<Instance>> instances;
+	std::string::size_type begin = 0;
+	while (begin < o.modules.size()) {
+		std::string::size_type end = o.modules.find(',', begin);
+		if (end == std::string::npos) {
+			end = o.modules.size();
+		}
+		modules.push_back(o.modules.substr(begin, end - begin));
+		begin = end + 1;
+
+		instances.push_back(createInstances(modules.back(), o.instances));
+		if ((int) instances.back().size() != o.instances) {
+			fprintf(stderr, "unknown module %s\n", modules.back().c_str());
+			return 1;
+		}
+	}
+
+	// single thread runs (the ones compared with the baseline) go round the modules in turn, each
+	// just after a reference loop, so a stretch of the machine being busy costs every module a run
+	// rather than one module most of its runs
+	const size_t numModules = modules.size();
+	const double samples = (double) frames * o.instances;
+	std::vector<std::vector<double>> singleTimes(numModules), ratios(numModules);
+	std::vector<uint64_t> singleAllocated(numModules, 0);
+	for (int r = 0; r < o.repeat; ++r) {
+		for (size_t m = 0; m < numModules; ++m) {
+			const double referenceNs = referenceLoop();
+			const uint64_t before = allocations.load();
+			const double seconds = run(instances[m], clock, 1, 1.f / o.sampleRate);
+			singleAllocated[m] = std::max(singleAllocated[m], allocations.load() - before);
+			singleTimes[m].push_back(seconds);
+			ratios[m].push_back(seconds * 1e9 / samples / referenceNs);
+		}
+	}
+
+	for (size_t m = 0; m < numModules; ++m) {
+		double baseline = 0.;
+		for (int numThreads = 1; numThreads <= o.maxThreads; numThreads *= 2) {
+			std::vector<double> times = singleTimes[m];
+			uint64_t allocated = singleAllocated[m];
+			if (numThreads > 1) {
+				times.clear();
+				allocated = 0;
+				for (int r = 0; r < o.repeat; ++r) {
+					const uint64_t before = allocations.load();
+					times.push_back(run(instances[m], clock, numThreads, 1.f / o.sampleRate));
+					allocated = std::max(allocated, allocations.load() - before);
+				}
+			}
+			const double seconds = median(times);
+			if (numThreads == 1) {
+				baseline = seconds;
+				results.push_back({modules[m], seconds * 1e9 / samples, (double) allocated / frames, median(ratios[m])});
+			}
+			const double speedup = baseline / seconds;
+			printf("%-10s %7d | %10.2f %12.2f %8.2f %9.0f%% %8llu\n", modules[m].c_str(), numThreads, seconds * 1e3,
+			       seconds * 1e9 / samples, speedup, 100. * speedup / numThreads, (unsigned long long) allocated);
+		}
+
+		for (Instance& instance : instances[m]) {
+			delete instance.node;
+		}
+	}
+
+	if (!o.jsonPath.empty()) {
+		if (!writeResults(o.jsonPath, o, results)) {
+			fprintf(stderr, "can't write %s\n", o.jsonPath.c_str());
+			return 1;
+		}
+		printf("wrote %s\n", o.jsonPath.c_str());
+	}
+	if (!o.comparePath.empty()) {
+		const int regressions = compareResults(o.comparePath, o, results);
+		if (regressions < 0) {
+			return 1;
+		}
+		if (regressions > 0) {
+			printf("%d module%s regressed\n", regressions, regressions > 1 ? "s" : "");
+			return 2;
+		}
+	}
+	return 0;
+}
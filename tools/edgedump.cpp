@@ -0,0 +1,209 @@
+// Decodes the edge log written by modules with "Record edges" ticked, see src/EdgeLog.h for the
+// file format and README.md for usage.
+//
+//   edgedump LOG              every edge, one per line, with notes of modules added and removed
+//                             and of edges dropped
+//   edgedump LOG --summary    per port and channel: edge counts, and the shortest, mean and
+//                             longest time between rising edges
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "EdgeLog.h"
+
+struct Options {
+	std::string path;
+	bool summary = false;
+	bool csv = false;
+	// slug, index or Rack id, all modules if empty
+	std::string module;
+};
+
+// module 3 is shown as Stoicheia#3
+static std::string label(const EdgeLogReader& reader, int index) {
+	return reader.modules[index].slug + "#" + std::to_string(index);
+}
+
+static bool selected(const Options& o, const EdgeLogReader& reader, int index) {
+	const EdgeLog::Module& module = reader.modules[index];
+	return o.module.empty() || o.module == module.slug || o.module == std::to_string(index) || o.module == std::to_string(module.id);
+}
+
+static const std::string& portName(const EdgeLog::Module& module, const EdgeEvent& event) {
+	return (event.bits & EdgeEvent::OUTPUT) ? module.outputs[event.port] : module.inputs[event.port];
+}
+
+struct PortStats {
+	int64_t rises = 0;
+	int64_t falls = 0;
+	int64_t lastRise = -1;
+	int64_t minPeriod = 0;
+	int64_t maxPeriod = 0;
+	int64_t sumPeriods = 0;
+	int64_t periods = 0;
+
+	void add(const EdgeEvent& event) {
+		if (!(event.bits & EdgeEvent::RISING)) {
+			falls++;
+			return;
+		}
+		rises++;
+		if (lastRise >= 0) {
+			const int64_t period = event.frame - lastRise;
+			minPeriod = periods ? std::min(minPeriod, period) : period;
+			maxPeriod = periods ? std::max(maxPeriod, period) : period;
+			sumPeriods += period;
+			periods++;
+		}
+		lastRise = event.frame;
+	}
+};
+
+static void usage() {
+	printf("usage: edgedump LOG [options]\n"
+	       "  --summary          edge counts and periods per port instead of every edge\n"
+	       "  --csv              comma separated, with a header line\n"
+	       "  --module M         only the module with slug, number (as in Stoicheia#3) or Rack id M\n"
+	       "times are seconds from the start of the engine (frame / sample rate); outputs are stamped\n"
+	       "with the frame they were written in, one before a cable delivers them\n");
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			usage();
+			return 0;
+		}
+		else if (arg == "--summary") o.summary = true;
+		else if (arg == "--csv") o.csv = true;
+		else if (arg == "--module" && i + 1 < argc) o.module = argv[++i];
+		else if (o.path.empty() && arg[0] != '-') o.path = arg;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (o.path.empty()) {
+		usage();
+		return 1;
+	}
+
+	std::ifstream in(o.path, std::ios::binary);
+	if (!in) {
+		fprintf(stderr, "can't read %s\n", o.path.c_str());
+		return 1;
+	}
+	const std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	EdgeLogReader reader(data);
+	if (!reader.readHeader()) {
+		fprintf(stderr, "%s: %s\n", o.path.c_str(), reader.getError().c_str());
+		return 1;
+	}
+
+	const time_t start = reader.startTime;
+	char startText[64];
+	strftime(startText, sizeof(startText), "%Y-%m-%d %H:%M:%S", localtime(&start));
+	if (o.csv && !o.summary) {
+		printf("time,frame,module,port,channel,edge\n");
+	}
+	else if (!o.csv) {
+		printf("# edge log started %s\n", startText);
+	}
+
+	// per module: sample rate, dropped edges, and stats per (output, port, channel)
+	std::map<int, float> sampleRates;
+	std::map<int, uint64_t> dropped;
+	std::map<std::tuple<int, bool, int, int>, PortStats> stats;
+	auto seconds = [&](int module, int64_t frame) {
+		const float sampleRate = sampleRates[module];
+		return sampleRate > 0.f ? frame / (double) sampleRate : 0.;
+	};
+
+	EdgeLogReader::Record record;
+	while (reader.next(record)) {
+		if (!selected(o, reader, record.module)) {
+			continue;
+		}
+		const EdgeLog::Module& module = reader.modules[record.module];
+		switch (record.tag) {
+			case EdgeLog::MODULE:
+				if (!o.csv && !o.summary) {
+					printf("# %s: Rack module id %lld, %d inputs, %d outputs\n", label(reader, record.module).c_str(),
+					       (long long) module.id, (int) module.inputs.size(), (int) module.outputs.size());
+				}
+				break;
+			case EdgeLog::RATE:
+				sampleRates[record.module] = record.value;
+				break;
+			case EdgeLog::DROPPED:
+				dropped[record.module] += record.value;
+				if (!o.csv && !o.summary) {
+					printf("# %s: %llu edges dropped\n", label(reader, record.module).c_str(), (unsigned long long) record.value);
+				}
+				break;
+			case EdgeLog::REMOVED:
+				if (!o.csv && !o.summary) {
+					printf("# %s: removed\n", label(reader, record.module).c_str());
+				}
+				break;
+			case EdgeLog::EDGES:
+				for (const EdgeEvent& event : record.events) {
+					const bool output = event.bits & EdgeEvent::OUTPUT;
+					const int channel = event.bits & 0xf;
+					if (o.summary) {
+						stats[std::make_tuple(record.module, output, (int) event.port, channel)].add(event);
+						continue;
+					}
+					const std::string port = (output ? "out " : "in ") + portName(module, event);
+					printf(o.csv ? "%.6f,%lld,%s,%s,%d,%s\n" : "%12.6f %12lld  %-16s %-24s %2d  %s\n", seconds(record.module, event.frame),
+					       (long long) event.frame, label(reader, record.module).c_str(), port.c_str(), channel + 1,
+					       (event.bits & EdgeEvent::RISING) ? "rise" : "fall");
+				}
+				break;
+		}
+	}
+
+	if (o.summary) {
+		if (o.csv) {
+			printf("module,port,channel,rises,falls,min period (ms),mean period (ms),max period (ms)\n");
+		}
+		else {
+			printf("%-16s %-24s %7s | %8s %8s | %12s %12s %12s\n", "module", "port", "channel", "rises", "falls", "min (ms)", "mean (ms)", "max (ms)");
+		}
+		for (const auto& entry : stats) {
+			const int index = std::get<0>(entry.first);
+			const bool output = std::get<1>(entry.first);
+			const EdgeLog::Module& module = reader.modules[index];
+			const std::vector<std::string>& names = output ? module.outputs : module.inputs;
+			const std::string port = (output ? "out " : "in ") + names[std::get<2>(entry.first)];
+			const PortStats& s = entry.second;
+			const double ms = 1e3 * seconds(index, 1);
+			const double mean = s.periods ? (double) s.sumPeriods / s.periods : 0.;
+			printf(o.csv ? "%s,%s,%d,%lld,%lld,%.3f,%.3f,%.3f\n" : "%-16s %-24s %7d | %8lld %8lld | %12.3f %12.3f %12.3f\n",
+			       label(reader, index).c_str(), port.c_str(), std::get<3>(entry.first) + 1, (long long) s.rises, (long long) s.falls,
+			       s.minPeriod * ms, mean * ms, s.maxPeriod * ms);
+		}
+		for (const auto& entry : dropped) {
+			if (entry.second) {
+				printf("%s%s: %llu edges dropped\n", o.csv ? "# " : "", label(reader, entry.first).c_str(), (unsigned long long) entry.second);
+			}
+		}
+	}
+
+	if (!reader.getError().empty()) {
+		// a log still being written, or cut short by a crash, may end part way through a record
+		fprintf(stderr, "%s: %s at byte %zu\n", o.path.c_str(), reader.getError().c_str(), reader.offset());
+		return reader.getError() == "truncated record" ? 0 : 1;
+	}
+	return 0;
+}
@@ -0,0 +1,150 @@
+// Builds and inspects pattern banks (.rtpb) for Klasmata's pattern bank mode, see
+// src/PatternBank.h for the file format and README.md for usage.
+//
+//   patternbank euclid OUT         every Euclidean pattern: lengths 1 - 32, all fills and rotations
+//   patternbank build IN OUT       patterns from a text file, one per line as x (hit) and . (rest)
+//   patternbank dump IN            list a bank's patterns, read back through PatternBank
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "PatternBank.h"
+#include "Sequence.h"
+
+static void put16(std::vector<uint8_t>& out, uint16_t value) {
+	out.push_back(value & 0xff);
+	out.push_back(value >> 8);
+}
+
+static void put32(std::vector<uint8_t>& out, uint32_t value) {
+	put16(out, value & 0xffff);
+	put16(out, value >> 16);
+}
+
+static bool write(const std::string& path, const std::vector<BankPattern>& patterns) {
+	std::vector<uint8_t> out;
+	out.insert(out.end(), {'R', 'T', 'P', 'B'});
+	put16(out, PatternBank::version);
+	put16(out, 0);
+	put32(out, patterns.size());
+	put32(out, 0);
+	for (const BankPattern& pattern : patterns) {
+		put32(out, pattern.bits);
+		out.push_back(pattern.length);
+		out.insert(out.end(), 3, 0);
+	}
+	// written next to the bank and renamed over it, so a bank Rack has loaded is replaced by a
+	// new file rather than changed under it
+	const std::string tempPath = path + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "can't write %s\n", tempPath.c_str());
+		return false;
+	}
+	const bool written = fwrite(out.data(), 1, out.size(), file) == out.size();
+	if (fclose(file) != 0 || !written || rename(tempPath.c_str(), path.c_str()) != 0) {
+		fprintf(stderr, "can't write %s\n", path.c_str());
+		remove(tempPath.c_str());
+		return false;
+	}
+	printf("%s: %zu patterns, %zu bytes\n", path.c_str(), patterns.size(), out.size());
+	return true;
+}
+
+// ordered by length, then fill, then rotation, so that Klasmata's length knob (which steps
+// through the bank in 32 pages) moves roughly with the pattern length
+static std::vector<BankPattern> euclid() {
+	std::vector<BankPattern> patterns;
+	for (int length = 1; length <= 32; ++length) {
+		for (int fill = 1; fill <= length; ++fill) {
+			Sequence<uint32_t> seq;
+			seq.calculate(length, fill);
+			for (int rotation = 0; rotation < length; ++rotation) {
+				const uint64_t bits = seq.bits;
+				const uint64_t rotated = ((bits >> rotation) | (bits << (length - rotation))) & ((1ULL << length) - 1);
+				patterns.push_back({(uint32_t) rotated, (uint8_t) length});
+			}
+		}
+	}
+	return patterns;
+}
+
+// one pattern per line, e.g. "x..x..x." (anything after the steps, or a line starting with #,
+// is a comment)
+static bool parse(const std::string& path, std::vector<BankPattern>& patterns) {
+	std::ifstream in(path);
+	if (!in) {
+		fprintf(stderr, "can't read %s\n", path.c_str());
+		return false;
+	}
+	std::string line;
+	for (int lineNumber = 1; std::getline(in, line); ++lineNumber) {
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+		BankPattern pattern = {0, 0};
+		size_t i = 0;
+		for (; i < line.size() && (line[i] == 'x' || line[i] == 'X' || line[i] == '.'); ++i) {
+			if (pattern.length == 32) {
+				fprintf(stderr, "%s:%d: more than 32 steps\n", path.c_str(), lineNumber);
+				return false;
+			}
+			if (line[i] != '.') {
+				pattern.bits |= 1UL << pattern.length;
+			}
+			pattern.length++;
+		}
+		if (pattern.length == 0) {
+			fprintf(stderr, "%s:%d: expected steps (x or .)\n", path.c_str(), lineNumber);
+			return false;
+		}
+		patterns.push_back(pattern);
+	}
+	return true;
+}
+
+static int dump(const std::string& path) {
+	std::string error;
+	const PatternBank* bank = PatternBank::load(path, &error);
+	if (!bank) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+	printf("%s: %zu patterns\n", path.c_str(), bank->size());
+	for (size_t i = 0; i < bank->size(); ++i) {
+		const BankPattern pattern = bank->get(i);
+		char steps[33];
+		for (int step = 0; step < pattern.length; ++step) {
+			steps[step] = (pattern.bits >> step) & 1 ? 'x' : '.';
+		}
+		steps[pattern.length] = 0;
+		printf("%6zu  %2d  %s\n", i + 1, pattern.length, steps);
+	}
+	return 0;
+}
+
+static void usage() {
+	printf("usage: patternbank euclid OUT\n"
+	       "       patternbank build IN OUT\n"
+	       "       patternbank dump IN\n");
+}
+
+int main(int argc, char** argv) {
+	const std::string command = argc > 1 ? argv[1] : "";
+	if (command == "euclid" && argc == 3) {
+		return write(argv[2], euclid()) ? 0 : 1;
+	}
+	if (command == "build" && argc == 4) {
+		std::vector<BankPattern> patterns;
+		return parse(argv[2], patterns) && write(argv[3], patterns) ? 0 : 1;
+	}
+	if (command == "dump" && argc == 3) {
+		return dump(argv[2]);
+	}
+	usage();
+	return 1;
+}
@@ -0,0 +1,492 @@
+// Offline renderer: builds a patch of module cores (src/*Core.h, wrapped by Nodes.h) from a JSON
+// description, and renders its outputs as fast as the CPU allows to a WAV file, a CSV of every
+// sample or a list of edges. See README.md, and tools/patches/ for example patches.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Json.h"
+#include "Nodes.h"
+
+enum Format {
+	WAV,
+	CSV,
+	EDGES
+};
+
+struct Options {
+	std::string patchPath;
+	std::string outPath = "-";
+	Format format = EDGES;
+	bool formatSet = false;
+	// overrides of the patch file, if >= 0
+	float sampleRate = -1.f;
+	float seconds = -1.f;
+	// id.param=value
+	std::vector<std::string> sets;
+	bool quiet = false;
+	// Chrome trace of the cores' profiling zones (PROFILE=1 builds only)
+	std::string tracePath;
+};
+
+struct Channel {
+	std::string name;
+	Node* node;
+	int output;
+};
+
+struct RenderPatch {
+	Patch patch;
+	std::map<std::string, Node*> modules;
+	std::vector<Channel> channels;
+	float sampleRate = 48000.f;
+	float seconds = 10.f;
+};
+
+static std::string joined(const std::vector<std::string>& names) {
+	std::string text;
+	for (const std::string& name : names) {
+		text += (text.empty() ? "" : ", ") + name;
+	}
+	return text;
+}
+
+// splits "id.port" and finds the module, false (with a message in error) if there's no such module
+static bool findModule(const RenderPatch& p, const std::string& ref, Node*& node, std::string& port, std::string& error) {
+	const size_t dot = ref.find('.');
+	if (dot == std::string::npos) {
+		error = "expected module.port, got \"" + ref + "\"";
+		return false;
+	}
+	auto it = p.modules.find(ref.substr(0, dot));
+	if (it == p.modules.end()) {
+		error = "unknown module \"" + ref.substr(0, dot) + "\"";
+		return false;
+	}
+	node = it->second;
+	port = ref.substr(dot + 1);
+	return true;
+}
+
+static bool setParam(Node* node, const std::string& id, const std::string& name, float value, std::string& error) {
+	const int index = node->paramIndex(name);
+	if (index < 0) {
+		error = "unknown param \"" + name + "\" on " + id + " (" + node->slug + " params: " + joined(node->paramNames) + ")";
+		return false;
+	}
+	node->params[index] = value;
+	return true;
+}
+
+static bool buildPatch(const JsonValue& root, RenderPatch& p, std::string& error) {
+	if (!root.isObject()) {
+		error = "the patch should be a JSON object";
+		return false;
+	}
+	if (const JsonValue* sampleRate = root.get("sampleRate")) {
+		p.sampleRate = sampleRate->number;
+	}
+	if (const JsonValue* seconds = root.get("seconds")) {
+		p.seconds = seconds->number;
+	}
+
+	// "modules": {"id": {"slug": "...", "params": {"name": value, ...}}, ...}
+	const JsonValue* modules = root.get("modules");
+	if (!modules || !modules->isObject()) {
+		error = "expected a \"modules\" object";
+		return false;
+	}
+	for (const auto& module : modules->object) {
+		const std::string& id = module.first;
+		const JsonValue* slug = module.second.get("slug");
+		if (!slug || !slug->isString()) {
+			error = "module \"" + id + "\" has no \"slug\"";
+			return false;
+		}
+		Node* node = createNode(slug->string);
+		if (!node) {
+			error = "unknown slug \"" + slug->string + "\" for module \"" + id + "\" (Clock, CLK, Klasmata, Logoi, Phoreo or Stoicheia)";
+			return false;
+		}
+		p.patch.add(node);
+		p.modules[id] = node;
+		if (const JsonValue* params = module.second.get("params")) {
+			for (const auto& param : params->object) {
+				if (!param.second.isNumber()) {
+					error = "param \"" + param.first + "\" of \"" + id + "\" should be a number";
+					return false;
+				}
+				if (!setParam(node, id, param.first, param.second.number, error)) {
+					return false;
+				}
+			}
+		}
+	}
+
+	// "cables": [["id.output", "id.input"], ...]
+	if (const JsonValue* cables = root.get("cables")) {
+		for (const JsonValue& cable : cables->array) {
+			if (!cable.isArray() || cable.array.size() != 2 || !cable.array[0].isString() || !cable.array[1].isString()) {
+				error = "each cable should be [\"module.output\", \"module.input\"]";
+				return false;
+			}
+			Node* from;
+			Node* to;
+			std::string output, input;
+			if (!findModule(p, cable.array[0].string, from, output, error) || !findModule(p, cable.array[1].string, to, input, error)) {
+				return false;
+			}
+			if (!p.patch.connect(from, output, to, input)) {
+				error = "can't connect " + cable.array[0].string + " to " + cable.array[1].string + " (" +
+				        from->slug + " outputs: " + joined(from->outputNames) + "; " + to->slug + " inputs: " + joined(to->inputNames) + ")";
+				return false;
+			}
+		}
+	}
+
+	// "outputs": ["id.output", ...], rendered in this order
+	const JsonValue* outputs = root.get("outputs");
+	if (!outputs || !outputs->isArray() || outputs->array.empty()) {
+		error = "expected an \"outputs\" array of module.output";
+		return false;
+	}
+	for (const JsonValue& output : outputs->array) {
+		Node* node;
+		std::string name;
+		if (!output.isString() || !findModule(p, output.string, node, name, error)) {
+			if (!output.isString()) {
+				error = "outputs should be strings";
+			}
+			return false;
+		}
+		const int index = node->outputIndex(name);
+		if (index < 0) {
+			error = "unknown output " + output.string + " (" + node->slug + " outputs: " + joined(node->outputNames) + ")";
+			return false;
+		}
+		p.channels.push_back({output.string, node, index});
+	}
+	return true;
+}
+
+// --set id.param=value
+static bool applySet(RenderPatch& p, const std::string& set, std::string& error) {
+	const size_t equals = set.find('=');
+	Node* node;
+	std::string name;
+	if (equals == std::string::npos || !findModule(p, set.substr(0, equals), node, name, error)) {
+		if (equals == std::string::npos) {
+			error = "expected --set module.param=value, got \"" + set + "\"";
+		}
+		return false;
+	}
+	return setParam(node, set.substr(0, set.find('.')), name, std::atof(set.c_str() + equals + 1), error);
+}
+
+// Each writer takes one frame (all channels, in volts) at a time.
+struct Writer {
+	FILE* file = nullptr;
+
+	virtual ~Writer() {}
+	virtual bool begin(const RenderPatch& p, int64_t frames) = 0;
+	virtual void write(int64_t frame, const float* values) = 0;
+	virtual bool end() {
+		return !ferror(file);
+	}
+};
+
+// 32-bit float WAV, one channel per output, scaled so that 10V is 1.0
+struct WavWriter : Writer {
+	static const int blockFrames = 4096;
+	std::vector<float> block;
+	size_t channels = 0;
+
+	static void put16(std::string& out, uint16_t value) {
+		out += (char)(value & 0xff);
+		out += (char)(value >> 8);
+	}
+	static void put32(std::string& out, uint32_t value) {
+		put16(out, value & 0xffff);
+		put16(out, value >> 16);
+	}
+
+	bool begin(const RenderPatch& p, int64_t frames) override {
+		channels = p.channels.size();
+		const uint64_t dataSize = (uint64_t) frames * channels * sizeof(float);
+		if (dataSize > 0xffffffffULL - 50) {
+			fprintf(stderr, "too long for a WAV file (4 GB), render fewer seconds or outputs\n");
+			return false;
+		}
+		// RIFF header with a WAVE_FORMAT_IEEE_FLOAT fmt chunk (plus the fact chunk it requires)
+		std::string header = "RIFF";
+		put32(header, 4 + 26 + 12 + 8 + dataSize);
+		header += "WAVEfmt ";
+		put32(header, 18);
+		put16(header, 3);
+		put16(header, channels);
+		put32(header, (uint32_t) p.sampleRate);
+		put32(header, (uint32_t) p.sampleRate * channels * sizeof(float));
+		put16(header, channels * sizeof(float));
+		put16(header, 32);
+		put16(header, 0);
+		header += "fact";
+		put32(header, 4);
+		put32(header, frames);
+		header += "data";
+		put32(header, dataSize);
+		fwrite(header.data(), 1, header.size(), file);
+		block.reserve(blockFrames * channels);
+		return true;
+	}
+
+	void write(int64_t frame, const float* values) override {
+		for (size_t c = 0; c < channels; ++c) {
+			block.push_back(values[c] / 10.f);
+		}
+		if (block.size() >= blockFrames * channels) {
+			flush();
+		}
+	}
+
+	void flush() {
+		fwrite(block.data(), sizeof(float), block.size(), file);
+		block.clear();
+	}
+
+	bool end() override {
+		flush();
+		return Writer::end();
+	}
+};
+
+// every sample: frame, then one column of volts per output
+struct CsvWriter : Writer {
+	size_t channels = 0;
+
+	bool begin(const RenderPatch& p, int64_t frames) override {
+		channels = p.channels.size();
+		fprintf(file, "sample");
+		for (const Channel& channel : p.channels) {
+			fprintf(file, ",%s", channel.name.c_str());
+		}
+		fprintf(file, "\n");
+		return true;
+	}
+
+	void write(int64_t frame, const float* values) override {
+		fprintf(file, "%lld", (long long) frame);
+		for (size_t c = 0; c < channels; ++c) {
+			fprintf(file, ",%g", values[c]);
+		}
+		fprintf(file, "\n");
+	}
+};
+
+// one row per rising or falling edge, with the thresholds of the timing tool (GateDetector)
+struct EdgesWriter : Writer {
+	std::vector<std::string> names;
+	std::vector<GateDetector> gates;
+	double sampleRate = 48000.;
+
+	bool begin(const RenderPatch& p, int64_t frames) override {
+		for (const Channel& channel : p.channels) {
+			names.push_back(channel.name);
+		}
+		gates.resize(names.size());
+		sampleRate = p.sampleRate;
+		fprintf(file, "output,sample,seconds,edge\n");
+		return true;
+	}
+
+	void write(int64_t frame, const float* values) override {
+		for (size_t c = 0; c < gates.size(); ++c) {
+			const int edge = gates[c].process(values[c]);
+			if (edge) {
+				fprintf(file, "%s,%lld,%.6f,%s\n", names[c].c_str(), (long long) frame, frame / sampleRate, edge > 0 ? "rise" : "fall");
+			}
+		}
+	}
+};
+
+static bool readFile(const std::string& path, std::string& text) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		return false;
+	}
+	std::stringstream buffer;
+	buffer << in.rdbuf();
+	text = buffer.str();
+	return true;
+}
+
+static void usage() {
+	printf("usage: render PATCH.json [options]\n"
+	       "  --out PATH         output file, - for stdout (default -, not for WAV)\n"
+	       "  --format FORMAT    wav, csv (every sample) or edges (default: from the --out extension, else edges)\n"
+	       "  --seconds S        length to render (default: \"seconds\" in the patch, else 10)\n"
+	       "  --sample-rate HZ   (default: \"sampleRate\" in the patch, else 48000)\n"
+	       "  --set ID.PARAM=V   set a param, overriding the patch (repeatable)\n"
+	       "  --trace PATH       write a Chrome trace of the profiling zones (needs make PROFILE=1)\n"
+	       "  --quiet            don't report the render speed\n");
+}
+
+static bool parseFormat(const std::string& name, Format& format) {
+	if (name == "wav") format = WAV;
+	else if (name == "csv") format = CSV;
+	else if (name == "edges") format = EDGES;
+	else return false;
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		if (arg == "--help" || arg == "-h") {
+			usage();
+			return 0;
+		}
+		if (arg == "--quiet") {
+			o.quiet = true;
+			continue;
+		}
+		if (arg[0] != '-') {
+			o.patchPath = arg;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+		const std::string value = argv[++i];
+		if (arg == "--out") o.outPath = value;
+		else if (arg == "--format") {
+			if (!parseFormat(value, o.format)) {
+				fprintf(stderr, "unknown format %s\n", value.c_str());
+				return 1;
+			}
+			o.formatSet = true;
+		}
+		else if (arg == "--seconds") o.seconds = atof(value.c_str());
+		else if (arg == "--sample-rate") o.sampleRate = atof(value.c_str());
+		else if (arg == "--set") o.sets.push_back(value);
+		else if (arg == "--trace") o.tracePath = value;
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (o.patchPath.empty()) {
+		usage();
+		return 1;
+	}
+	if (!o.formatSet) {
+		const size_t dot = o.outPath.rfind('.');
+		const std::string extension = dot == std::string::npos ? "" : o.outPath.substr(dot + 1);
+		o.formatSet = parseFormat(extension, o.format);
+	}
+
+	std::string text, error;
+	JsonValue root;
+	if (!readFile(o.patchPath, text)) {
+		fprintf(stderr, "can't read %s\n", o.patchPath.c_str());
+		return 1;
+	}
+	RenderPatch p;
+	if (!JsonParser::parse(text, root, error) || !buildPatch(root, p, error)) {
+		fprintf(stderr, "%s: %s\n", o.patchPath.c_str(), error.c_str());
+		return 1;
+	}
+	for (const std::string& set : o.sets) {
+		if (!applySet(p, set, error)) {
+			fprintf(stderr, "%s\n", error.c_str());
+			return 1;
+		}
+	}
+	if (o.sampleRate > 0.f) {
+		p.sampleRate = o.sampleRate;
+	}
+	if (o.seconds >= 0.f) {
+		p.seconds = o.seconds;
+	}
+	if (!(p.sampleRate > 0.f)) {
+		fprintf(stderr, "invalid sample rate\n");
+		return 1;
+	}
+
+	std::unique_ptr<Writer> writer;
+	switch (o.format) {
+		case WAV: writer.reset(new WavWriter); break;
+		case CSV: writer.reset(new CsvWriter); break;
+		case EDGES:
+		default: writer.reset(new EdgesWriter); break;
+	}
+	const bool toStdout = (o.outPath == "-");
+	if (toStdout && o.format == WAV) {
+		fprintf(stderr, "WAV output needs --out\n");
+		return 1;
+	}
+	writer->file = toStdout ? stdout : fopen(o.outPath.c_str(), "wb");
+	if (!writer->file) {
+		fprintf(stderr, "can't write %s\n", o.outPath.c_str());
+		return 1;
+	}
+
+	if (!o.tracePath.empty()) {
+#ifdef REBELTECH_PROFILE
+		// rendering runs far faster than realtime, so capture windows are short and frequent (the
+		// gaps let the writer keep up)
+		Profiler::Settings settings;
+		settings.window = 0.005f;
+		settings.period = 0.05f;
+		settings.duration = 1e6f;
+		if (!Profiler::start(o.tracePath, settings)) {
+			fprintf(stderr, "can't write %s\n", o.tracePath.c_str());
+			return 1;
+		}
+#else
+		fprintf(stderr, "--trace needs a profiling build (make PROFILE=1)\n");
+		return 1;
+#endif
+	}
+
+	const int64_t frames = (int64_t)((double) p.seconds * p.sampleRate);
+	const float sampleTime = 1.f / p.sampleRate;
+	std::vector<float> values(p.channels.size());
+	bool ok = writer->begin(p, frames);
+
+	const auto start = std::chrono::steady_clock::now();
+	for (int64_t frame = 0; ok && frame < frames; ++frame) {
+		p.patch.process(sampleTime);
+		for (size_t c = 0; c < p.channels.size(); ++c) {
+			values[c] = p.channels[c].node->outputs[p.channels[c].output];
+		}
+		writer->write(frame, values.data());
+	}
+	const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#ifdef REBELTECH_PROFILE
+	Profiler::stop();
+#endif
+
+	ok = ok && writer->end();
+	if (!toStdout) {
+		ok = (fclose(writer->file) == 0) && ok;
+	}
+	if (!ok) {
+		fprintf(stderr, "error writing %s\n", o.outPath.c_str());
+		return 1;
+	}
+	if (!o.quiet) {
+		fprintf(stderr, "rendered %.1f s (%lld samples, %zu outputs) in %.3f s, %.0fx realtime\n", p.seconds,
+		        (long long) frames, p.channels.size(), elapsed, elapsed > 0. ? p.seconds / elapsed : 0.);
+	}
+	return 0;
+}
@@ -0,0 +1,612 @@
+// Offline timing harness: drives the module cores (src/*Core.h) with a synthetic clock, records
+// every edge on the probed outputs and reports input-to-output latency, output period jitter
+// and pulse width error, for single modules and for chains of modules. With --check it also tests
+// the lock of clocks locked to a reference (CLK's external clock), and fails if it is slow or
+// loose (see checkLock()). See README.md.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Nodes.h"
+
+struct Options {
+	float sampleRate = 48000.f;
+	float bpm = 120.f;
+	float width = 50.f;		// % of period
+	float swing = 50.f;		// %, 50 is straight
+	float jitter = 0.f;		// ms
+	float seconds = 60.f;
+	float warmup = -1.f;	// s, edges before this are ignored (default: four input periods)
+	int seed = 1;
+	std::string only;		// only run scenarios whose name contains this
+	std::string edgesPath;	// if set, write every recorded edge as CSV
+	bool check = false;		// exit with status 2 if a locked clock fails checkLock()
+};
+
+struct Edges {
+	std::vector<int64_t> rises, falls;
+	GateDetector gate;
+
+	void record(int64_t frame, float voltage) {
+		const int edge = gate.process(voltage);
+		if (edge > 0) {
+			rises.push_back(frame);
+		}
+		else if (edge < 0) {
+			falls.push_back(frame);
+		}
+	}
+};
+
+struct Probe {
+	std::string label;
+	Node* node;
+	int output;
+	// expected period/pulse width in samples, 0 if not meaningful
+	double nominalPeriod;
+	double nominalWidth;
+	Edges edges;
+};
+
+struct Scenario {
+	std::string name;
+	Patch patch;
+	// probe whose rising edges count as the "input" for latency (-1 if none)
+	int reference = -1;
+	// probe of a clock locked to the reference, for which lock time and phase are reported (-1 if none)
+	int locked = -1;
+	std::vector<Probe> probes;
+
+	void probe(const std::string& label, Node* node, const std::string& output, double nominalPeriod = 0., double nominalWidth = 0.) {
+		const int index = node->outputIndex(output);
+		if (index < 0) {
+			fprintf(stderr, "unknown output %s on %s\n", output.c_str(), node->slug.c_str());
+			exit(1);
+		}
+		probes.push_back({label, node, index, nominalPeriod, nominalWidth, Edges()});
+	}
+
+	void connect(Node* from, const std::string& output, Node* to, const std::string& input) {
+		if (!patch.connect(from, output, to, input)) {
+			fprintf(stderr, "can't connect %s.%s to %s.%s\n", from->slug.c_str(), output.c_str(), to->slug.c_str(), input.c_str());
+			exit(1);
+		}
+	}
+
+	template <class T>
+	T* add(const std::vector<std::pair<std::string, float>>& params = {}) {
+		T* node = new T;
+		for (const auto& param : params) {
+			node->params[node->paramIndex(param.first)] = param.second;
+		}
+		patch.add(node);
+		return node;
+	}
+};
+
+struct Stats {
+	double min = 0., max = 0., mean = 0., rms = 0.;
+	size_t count = 0;
+
+	explicit Stats(const std::vector<double>& values) {
+		count = values.size();
+		if (!count) {
+			return;
+		}
+		min = max = values[0];
+		double sum = 0.;
+		for (double v : values) {
+			min = std::min(min, v);
+			max = std::max(max, v);
+			sum += v;
+		}
+		mean = sum / count;
+		double sumSq = 0.;
+		for (double v : values) {
+			sumSq += (v - mean) * (v - mean);
+		}
+		rms = std::sqrt(sumSq / count);
+	}
+};
+
+static ClockSourceNode* addClock(Scenario* s, const Options& o) {
+	return s->add<ClockSourceNode>({{"bpm", o.bpm}, {"width", o.width}, {"swing", o.swing}, {"jitter", o.jitter}, {"seed", (float) o.seed}});
+}
+
+// clock at a multiple of the tempo, e.g. for an external clock with several pulses per beat
+static ClockSourceNode* addClock(Scenario* s, const Options& o, int ppqn) {
+	return s->add<ClockSourceNode>({{"bpm", o.bpm * ppqn}, {"width", o.width}, {"swing", o.swing}, {"jitter", o.jitter}, {"seed", (float) o.seed}});
+}
+
+static std::vector<std::unique_ptr<Scenario>> buildScenarios(const Options& o) {
+	std::vector<std::unique_ptr<Scenario>> scenarios;
+	// input clock period and pulse width, in samples
+	const double P = 60. / o.bpm * o.sampleRate;
+	const double W = P * o.width / 100.;
+
+	{
+		Scenario* s = new Scenario;
+		s->name = "CLK (x1, x2, /2, original trigger mode)";
+		CLKNode* clk = s->add<CLKNode>({{"bpm", o.bpm}, {"scale8", 6}, {"scale24", 4}});
+		s->probe("clk.main", clk, "main", P, P / 2);
+		s->probe("clk.clock8", clk, "clock8", P / 2, P / 4);
+		s->probe("clk.clock24", clk, "clock24", P * 2, P / 2);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "CLK ratio mode (5/7, 13/8, original trigger mode)";
+		CLKNode* clk = s->add<CLKNode>({{"bpm", o.bpm}, {"subclock_mode", CLKCore::RATIO_MODE},
+			{"scale8", CLKCore::paramFromRatio({5, 7})}, {"scale24", CLKCore::paramFromRatio({13, 8})}});
+		s->probe("clk.main", clk, "main", P, P / 2);
+		s->probe("clk.clock8", clk, "clock8", P * 7 / 5, P / 2);
+		s->probe("clk.clock24", clk, "clock24", P * 8 / 13, P * 4 / 13);
+		scenarios.emplace_back(s);
+	}
+	{
+		// odd pulses late by 24, 5 and 31 master clock ticks
+		Scenario* s = new Scenario;
+		s->name = "CLK swing (main 75%, x2 60%, /2 66%)";
+		CLKNode* clk = s->add<CLKNode>({{"bpm", o.bpm}, {"scale8", 6}, {"scale24", 4},
+			{"swing", 75.f}, {"swing8", 60.f}, {"swing24", 66.f}});
+		s->probe("clk.main", clk, "main", P, P / 4);
+		s->probe("clk.clock8", clk, "clock8", P / 2, P * 9 / 48);
+		s->probe("clk.clock24", clk, "clock24", P * 2, P * 2 / 3);
+		scenarios.emplace_back(s);
+	}
+	for (int ppqn : {1, 24}) {
+		// CLK's own tempo starts 20% slow, so that it has to lock to the input
+		Scenario* s = new Scenario;
+		s->name = "CLK external clock (" + std::to_string(ppqn) + " PPQN, x2, /2)";
+		ClockSourceNode* clock = addClock(s, o, ppqn);
+		CLKNode* clk = s->add<CLKNode>({{"bpm", o.bpm * 0.8f}, {"scale8", 6}, {"scale24", 4}, {"ppqn", (float) ppqn}});
+		s->connect(clock, "out", clk, "ext");
+		s->reference = 0;
+		s->locked = 1;
+		s->probe("clock", clock, "out", P / ppqn, W / ppqn);
+		s->probe("clk.main", clk, "main", P, P / 2);
+		s->probe("clk.clock8", clk, "clock8", P / 2, P / 4);
+		s->probe("clk.clock24", clk, "clock24", P * 2, P / 2);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Chain: CLK (x2 multiplier) > CLK (external clock, 2 PPQN)";
+		CLKNode* master = s->add<CLKNode>({{"bpm", o.bpm}, {"multiplier", 1}});
+		CLKNode* clk = s->add<CLKNode>({{"bpm", o.bpm * 0.8f}, {"ppqn", 2}});
+		s->connect(master, "main", clk, "ext");
+		s->reference = 0;
+		s->locked = 1;
+		s->probe("master.main", master, "main", P / 2, P / 4);
+		s->probe("clk.main", clk, "main", P, P / 2);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Stoicheia (length 1, fill 1)";
+		ClockSourceNode* clock = addClock(s, o);
+		StoicheiaNode* stoicheia = s->add<StoicheiaNode>({{"density_a", 1.f}, {"density_b", 1.f}});
+		s->connect(clock, "out", stoicheia, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("stoicheia.a", stoicheia, "a", P, W);
+		s->probe("stoicheia.thru", stoicheia, "thru", P, W);
+		scenarios.emplace_back(s);
+	}
+	{
+		// A hits on odd steps of 2, B on every step; the XOR fires on the even steps
+		Scenario* s = new Scenario;
+		s->name = "Stoicheia logic (A 2/1, B 1/1, XOR)";
+		ClockSourceNode* clock = addClock(s, o);
+		StoicheiaNode* stoicheia = s->add<StoicheiaNode>({{"length_a", 2.f}, {"density_a", 0.f}, {"density_b", 1.f},
+			{"logic", StoicheiaCore::LOGIC_XOR}});
+		s->connect(clock, "out", stoicheia, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("stoicheia.a", stoicheia, "a", 2 * P, W);
+		s->probe("stoicheia.logic", stoicheia, "logic", 2 * P, W);
+		scenarios.emplace_back(s);
+	}
+	{
+		// alternating chain of A (2 steps), B (1), C (3) and D (1), all hits: output A plays the
+		// whole chain, C and D only their own steps (3 and 1 of every 7 clocks)
+		Scenario* s = new Scenario;
+		s->name = "Stoicheia chain (A 2, B 1, C 3, D 1, alternating)";
+		ClockSourceNode* clock = addClock(s, o);
+		StoicheiaNode* stoicheia = s->add<StoicheiaNode>({{"ab_mode", StoicheiaCore::ALTERNATING},
+			{"length_a", 2.f}, {"density_a", 1.f}, {"density_b", 1.f},
+			{"expander", 1.f}, {"length_c", 3.f}, {"density_c", 1.f}, {"density_d", 1.f}});
+		s->connect(clock, "out", stoicheia, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("stoicheia.a", stoicheia, "a");
+		s->probe("stoicheia.c", stoicheia, "c");
+		s->probe("stoicheia.d", stoicheia, "d", 7 * P, W);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Klasmata (length 1, fill 1)";
+		ClockSourceNode* clock = addClock(s, o);
+		KlasmataNode* klasmata = s->add<KlasmataNode>({{"density", 1.f}});
+		s->connect(clock, "out", klasmata, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("klasmata.out", klasmata, "out", P, W);
+		scenarios.emplace_back(s);
+	}
+	{
+		// hits dropped at random, so there is no single nominal period; the edge count is about
+		// half the clock's, and the same for the same --seed
+		Scenario* s = new Scenario;
+		s->name = "Klasmata/Stoicheia (length 1, fill 1, probability 50%)";
+		ClockSourceNode* clock = addClock(s, o);
+		KlasmataNode* klasmata = s->add<KlasmataNode>({{"density", 1.f}, {"probability", 0.5f}, {"seed", (float) o.seed}});
+		StoicheiaNode* stoicheia = s->add<StoicheiaNode>({{"density_a", 1.f}, {"density_b", 1.f},
+			{"probability_a", 0.5f}, {"probability_b", 0.5f}, {"seed", (float) o.seed}});
+		s->connect(clock, "out", klasmata, "clock");
+		s->connect(clock, "out", stoicheia, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("klasmata.out", klasmata, "out");
+		s->probe("stoicheia.a", stoicheia, "a");
+		s->probe("stoicheia.b", stoicheia, "b");
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Logoi (count mode, /2, count 2)";
+		ClockSourceNode* clock = addClock(s, o);
+		LogoiNode* logoi = s->add<LogoiNode>({{"division", LogoiCore::paramFromDivisionUser(2, LogoiCore::ORIGINAL_RANGE)},
+			{"count", LogoiCore::paramFromCountUser(2, LogoiCore::ORIGINAL_RANGE)}, {"mode", LogoiCore::COUNT_MODE}});
+		s->connect(clock, "out", logoi, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("logoi.division", logoi, "division", 2 * P, P);
+		s->probe("logoi.count", logoi, "count", 2 * P, W);
+		s->probe("logoi.combined", logoi, "combined");
+		s->probe("logoi.thru", logoi, "thru", P, W);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Logoi (delay mode, 10 ms)";
+		ClockSourceNode* clock = addClock(s, o);
+		LogoiNode* logoi = s->add<LogoiNode>({{"division", LogoiCore::paramFromDivisionUser(2, LogoiCore::ORIGINAL_RANGE)},
+			{"count", LogoiCore::paramFromDelayUser(10.f)}, {"mode", LogoiCore::DELAY_MODE}});
+		s->connect(clock, "out", logoi, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("logoi.delay", logoi, "count", P, W);
+		s->probe("logoi.combined", logoi, "combined");
+		scenarios.emplace_back(s);
+	}
+	{
+		// 3/16 bar is three quarters of the input clock period (as quarter notes)
+		Scenario* s = new Scenario;
+		s->name = "Logoi (tempo-synced delay, 3/16 bar and 2 bars)";
+		ClockSourceNode* clock = addClock(s, o);
+		LogoiNode* shortDelay = s->add<LogoiNode>({{"count", LogoiCore::paramFromSyncedDelayIndex(2)},
+			{"mode", LogoiCore::DELAY_MODE}, {"delay_sync", LogoiCore::SYNCED_DELAY}});
+		LogoiNode* longDelay = s->add<LogoiNode>({{"count", LogoiCore::paramFromSyncedDelayIndex(8)},
+			{"mode", LogoiCore::DELAY_MODE}, {"delay_sync", LogoiCore::SYNCED_DELAY}});
+		s->connect(clock, "out", shortDelay, "clock");
+		s->connect(clock, "out", longDelay, "clock");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("logoi.3/16", shortDelay, "count", P, W);
+		s->probe("logoi.2bars", longDelay, "count", P, W);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Phoreo (50%, x2, 3 repeats)";
+		ClockSourceNode* clock = addClock(s, o);
+		PhoreoNode* phoreo = s->add<PhoreoNode>({{"mod", 50.f}, {"mul", 2.f}, {"rep", 3.f}});
+		s->connect(clock, "out", phoreo, "mod");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("phoreo.mod", phoreo, "mod", P, P / 2);
+		s->probe("phoreo.mul", phoreo, "mul", P / 2, P / 4);
+		s->probe("phoreo.rep", phoreo, "rep", P / 2, P / 4);
+		scenarios.emplace_back(s);
+	}
+	{
+		// bursts of 4 repeats filling each clock period, each repeat 2^-0.5 (accelerating) or
+		// 2^0.5 (decelerating) times as long as the one before, so no single nominal period
+		Scenario* s = new Scenario;
+		s->name = "Phoreo (50%, x4, 4 repeats, curve +50% and -50%)";
+		ClockSourceNode* clock = addClock(s, o);
+		PhoreoNode* faster = s->add<PhoreoNode>({{"mod", 50.f}, {"mul", 4.f}, {"rep", 4.f}, {"curve", 50.f}});
+		PhoreoNode* slower = s->add<PhoreoNode>({{"mod", 50.f}, {"mul", 4.f}, {"rep", 4.f}, {"curve", -50.f}});
+		s->connect(clock, "out", faster, "mod");
+		s->connect(clock, "out", slower, "mod");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("phoreo.rep (+50%)", faster, "rep");
+		s->probe("phoreo.rep (-50%)", slower, "rep");
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Chain: CLK > Logoi (/2) > Phoreo (50%, x2)";
+		CLKNode* clk = s->add<CLKNode>({{"bpm", o.bpm}});
+		LogoiNode* logoi = s->add<LogoiNode>({{"division", LogoiCore::paramFromDivisionUser(2, LogoiCore::ORIGINAL_RANGE)}});
+		PhoreoNode* phoreo = s->add<PhoreoNode>({{"mod", 50.f}, {"mul", 2.f}});
+		s->connect(clk, "main", logoi, "clock");
+		s->connect(logoi, "division", phoreo, "mod");
+		s->reference = 0;
+		s->probe("clk.main", clk, "main", P, P / 2);
+		s->probe("logoi.division", logoi, "division", 2 * P, P);
+		s->probe("phoreo.mod", phoreo, "mod", 2 * P, P);
+		s->probe("phoreo.mul", phoreo, "mul", P, P / 2);
+		scenarios.emplace_back(s);
+	}
+	{
+		Scenario* s = new Scenario;
+		s->name = "Chain: clock > Stoicheia > Klasmata > Phoreo (50%)";
+		ClockSourceNode* clock = addClock(s, o);
+		StoicheiaNode* stoicheia = s->add<StoicheiaNode>({{"density_a", 1.f}});
+		KlasmataNode* klasmata = s->add<KlasmataNode>({{"density", 1.f}});
+		PhoreoNode* phoreo = s->add<PhoreoNode>({{"mod", 50.f}});
+		s->connect(clock, "out", stoicheia, "clock");
+		s->connect(stoicheia, "a", klasmata, "clock");
+		s->connect(klasmata, "out", phoreo, "mod");
+		s->reference = 0;
+		s->probe("clock", clock, "out", P, W);
+		s->probe("stoicheia.a", stoicheia, "a", P, W);
+		s->probe("klasmata.out", klasmata, "out", P, W);
+		s->probe("phoreo.mod", phoreo, "mod", P, P / 2);
+		scenarios.emplace_back(s);
+	}
+
+	return scenarios;
+}
+
+static void run(Scenario& s, const Options& o) {
+	const float sampleTime = 1.f / o.sampleRate;
+	const int64_t frames = (int64_t)(o.seconds * o.sampleRate);
+	for (int64_t frame = 0; frame < frames; ++frame) {
+		s.patch.process(sampleTime);
+		for (Probe& probe : s.probes) {
+			probe.edges.record(frame, probe.node->outputs[probe.output]);
+		}
+	}
+}
+
+// for a clock locked to the reference (e.g. CLK's external clock), the phase of each output
+// rise relative to the nearest reference rise; lock is the first rise after which all are
+// within a sample of the reference rise or of its arrival through the cable (plus twice any
+// input jitter)
+// limits for --check: lock within maxLockPulses reference pulses, then a phase (in samples) with
+// a peak to peak and rms within these, plus 4 and 1 times the input jitter
+static const size_t maxLockPulses = 4;
+static const double maxPhasePeakToPeak = 2.;
+static const double maxPhaseRms = 1.;
+
+// returns false if --check is given and the lock is outside the limits above
+static bool reportLock(const std::vector<int64_t>& rises, const std::vector<int64_t>& reference, const Options& o) {
+	const double jitterSamples = o.jitter * 1e-3 * o.sampleRate;
+	const double tolerance = 1.5 + 2. * jitterSamples;
+	std::vector<double> offsets;
+	for (int64_t rise : rises) {
+		auto it = std::lower_bound(reference.begin(), reference.end(), rise);
+		int64_t nearest = (it == reference.end()) ? reference.back() : *it;
+		if (it != reference.begin() && (it == reference.end() || rise - *(it - 1) < *it - rise)) {
+			nearest = *(it - 1);
+		}
+		offsets.push_back(rise - nearest);
+	}
+	size_t lock = offsets.size();
+	while (lock > 0 && std::fabs(offsets[lock - 1] - 0.5) <= tolerance) {
+		--lock;
+	}
+	if (lock == offsets.size()) {
+		printf("%-16s %6s   (never locked to the reference)\n", "", "");
+		if (o.check) {
+			printf("%-16s %6s   FAIL: no lock\n", "", "");
+		}
+		return !o.check;
+	}
+	const Stats phase(std::vector<double>(offsets.begin() + lock, offsets.end()));
+	const size_t pulses = std::upper_bound(reference.begin(), reference.end(), rises[lock]) - reference.begin();
+	printf("%-16s %6s   (locked after %zu reference pulses, %.1f ms; phase %.2f rms %.3f p-p %.0f samples)\n", "", "",
+	       pulses, 1e3 * (rises[lock] - reference.front()) / o.sampleRate, phase.mean, phase.rms, phase.max - phase.min);
+	if (!o.check) {
+		return true;
+	}
+	const double maxPeakToPeak = maxPhasePeakToPeak + 4. * jitterSamples;
+	const double maxRms = maxPhaseRms + jitterSamples;
+	bool ok = true;
+	if (pulses > maxLockPulses) {
+		printf("%-16s %6s   FAIL: lock took more than %zu reference pulses\n", "", "", maxLockPulses);
+		ok = false;
+	}
+	if (phase.max - phase.min > maxPeakToPeak) {
+		printf("%-16s %6s   FAIL: phase p-p over %.1f samples\n", "", "", maxPeakToPeak);
+		ok = false;
+	}
+	if (phase.rms > maxRms) {
+		printf("%-16s %6s   FAIL: phase rms over %.2f samples\n", "", "", maxRms);
+		ok = false;
+	}
+	return ok;
+}
+
+// returns false if a lock check failed (see reportLock())
+static bool report(const Scenario& s, const Options& o, int64_t warmupFrames, FILE* edgesFile) {
+	bool ok = true;
+	printf("\n== %s ==\n", s.name.c_str());
+	printf("%-16s %6s | %27s | %10s %10s %10s | %10s %10s %10s\n", "probe", "edges", "latency min/mean/max",
+	       "period", "jitter rms", "p-p", "width", "width rms", "width err");
+
+	const std::vector<int64_t>* reference = (s.reference >= 0) ? &s.probes[s.reference].edges.rises : nullptr;
+
+	for (size_t p = 0; p < s.probes.size(); ++p) {
+		const Probe& probe = s.probes[p];
+		const Edges& edges = probe.edges;
+
+		// latency from the most recent reference rising edge to each output rising edge
+		std::vector<double> latencies;
+		if (reference && (int) p != s.reference) {
+			for (int64_t rise : edges.rises) {
+				if (rise < warmupFrames) {
+					continue;
+				}
+				auto it = std::upper_bound(reference->begin(), reference->end(), rise);
+				if (it != reference->begin()) {
+					latencies.push_back(rise - *(it - 1));
+				}
+			}
+		}
+
+		std::vector<double> periods;
+		for (size_t i = 1; i < edges.rises.size(); ++i) {
+			if (edges.rises[i - 1] < warmupFrames) {
+				continue;
+			}
+			periods.push_back(edges.rises[i] - edges.rises[i - 1]);
+		}
+
+		// widths, and absolute error relative to the nominal width
+		std::vector<double> widths, widthErrors;
+		size_t fall = 0;
+		for (int64_t rise : edges.rises) {
+			if (rise < warmupFrames) {
+				continue;
+			}
+			while (fall < edges.falls.size() && edges.falls[fall] <= rise) {
+				++fall;
+			}
+			if (fall == edges.falls.size()) {
+				break;
+			}
+			widths.push_back(edges.falls[fall] - rise);
+			widthErrors.push_back(std::fabs(widths.back() - probe.nominalWidth));
+		}
+
+		const Stats latency(latencies), period(periods), width(widths), widthError(widthErrors);
+		const size_t count = edges.rises.end() - std::lower_bound(edges.rises.begin(), edges.rises.end(), warmupFrames);
+
+		char latencyText[64] = "-";
+		if (latency.count) {
+			snprintf(latencyText, sizeof(latencyText), "%.0f / %.2f / %.0f", latency.min, latency.mean, latency.max);
+		}
+		char widthErrorText[32] = "-";
+		if (widthError.count && probe.nominalWidth > 0.) {
+			snprintf(widthErrorText, sizeof(widthErrorText), "%.2f", widthError.mean);
+		}
+		printf("%-16s %6zu | %27s | %10.2f %10.3f %10.0f | %10.2f %10.3f %10s\n", probe.label.c_str(), count,
+		       latencyText, period.mean, period.rms, period.max - period.min, width.mean, width.rms, widthErrorText);
+		if (probe.nominalPeriod > 0. && period.count) {
+			printf("%-16s %6s   (nominal period %.2f, mean drift %+.4f samples/period)\n", "", "", probe.nominalPeriod,
+			       period.mean - probe.nominalPeriod);
+		}
+
+		if ((int) p == s.locked && reference && !reference->empty()) {
+			ok &= reportLock(edges.rises, *reference, o);
+		}
+
+		if (edgesFile) {
+			for (int64_t rise : edges.rises) {
+				fprintf(edgesFile, "%s,%s,%lld,rise\n", s.name.c_str(), probe.label.c_str(), (long long) rise);
+			}
+			for (int64_t f : edges.falls) {
+				fprintf(edgesFile, "%s,%s,%lld,fall\n", s.name.c_str(), probe.label.c_str(), (long long) f);
+			}
+		}
+	}
+	return ok;
+}
+
+static void usage() {
+	printf("usage: timing [options]\n"
+	       "  --sample-rate HZ   engine sample rate (default 48000)\n"
+	       "  --bpm BPM          tempo of the input clock and of CLK (default 120)\n"
+	       "  --width PCT        input clock pulse width, %% of period (default 50)\n"
+	       "  --swing PCT        position of every second input pulse within a pair, 50 is straight (default 50)\n"
+	       "  --jitter MS        random jitter applied to each input edge, +/- MS (default 0)\n"
+	       "  --seconds S        length of each run (default 60)\n"
+	       "  --warmup S         ignore edges in the first S seconds (default four input clock periods)\n"
+	       "  --seed N           seed for the jitter (default 1)\n"
+	       "  --only TEXT        only run scenarios whose name contains TEXT\n"
+	       "  --edges FILE       write every recorded edge to FILE as CSV\n"
+	       "  --check            test the lock of clocks locked to a reference (CLK's external clock):\n"
+	       "                     exits with status 2 if one takes over 4 reference pulses to lock, or\n"
+	       "                     its phase is over 2 samples p-p or 1 sample rms (plus 4 and 1 times the\n"
+	       "                     jitter)\n"
+	       "all times are reported in samples; each cable adds one sample of latency, as in Rack\n");
+}
+
+int main(int argc, char** argv) {
+	Options o;
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (arg == "--help" || arg == "-h") {
+			usage();
+			return 0;
+		}
+		else if (arg == "--check") o.check = true;
+		else if (!hasValue) {
+			usage();
+			return 1;
+		}
+		else if (arg == "--sample-rate") o.sampleRate = atof(argv[++i]);
+		else if (arg == "--bpm") o.bpm = atof(argv[++i]);
+		else if (arg == "--width") o.width = atof(argv[++i]);
+		else if (arg == "--swing") o.swing = atof(argv[++i]);
+		else if (arg == "--jitter") o.jitter = atof(argv[++i]);
+		else if (arg == "--seconds") o.seconds = atof(argv[++i]);
+		else if (arg == "--warmup") o.warmup = atof(argv[++i]);
+		else if (arg == "--seed") o.seed = atoi(argv[++i]);
+		else if (arg == "--only") o.only = argv[++i];
+		else if (arg == "--edges") o.edgesPath = argv[++i];
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	FILE* edgesFile = nullptr;
+	if (!o.edgesPath.empty()) {
+		edgesFile = fopen(o.edgesPath.c_str(), "w");
+		if (!edgesFile) {
+			fprintf(stderr, "can't open %s\n", o.edgesPath.c_str());
+			return 1;
+		}
+		fprintf(edgesFile, "scenario,probe,sample,edge\n");
+	}
+
+	if (o.warmup < 0.f) {
+		o.warmup = 4 * 60.f / o.bpm;
+	}
+	const int64_t warmupFrames = o.warmup * o.sampleRate;
+
+	printf("sample rate %.0f Hz, %.1f BPM, width %.0f%%, swing %.0f%%, jitter +/-%.3f ms, %.0f s per run (%.2f s warmup)\n",
+	       o.sampleRate, o.bpm, o.width, o.swing, o.jitter, o.seconds, o.warmup);
+
+	int failures = 0;
+	for (auto& scenario : buildScenarios(o)) {
+		if (!o.only.empty() && scenario->name.find(o.only) == std::string::npos) {
+			continue;
+		}
+		run(*scenario, o);
+		if (!report(*scenario, o, warmupFrames, edgesFile)) {
+			++failures;
+		}
+	}
+
+	if (edgesFile) {
+		fclose(edgesFile);
+	}
+	if (failures > 0) {
+		printf("\n%d lock check%s failed\n", failures, failures > 1 ? "s" : "");
+		return 2;
+	}
+	return 0;
+}